@@ -44,6 +44,9 @@
 #include "tb-context.h"
 #include "internal-common.h"
 #include "internal-target.h"
+#ifdef CONFIG_LIBQFLEX
+#include "exec/qflex-ring.h"
+#endif
 
 /* -icount align implementation. */
 
@@ -187,7 +190,7 @@ static bool tb_lookup_cmp(const void *p, const void *d)
         tb_page_addr0(tb) == desc->page_addr0 &&
         tb->cs_base == desc->cs_base &&
         tb->flags == desc->flags &&
-        tb_cflags(tb) == desc->cflags) {
+        tb_cflags_key(tb) == desc->cflags) {
         /* check next page if needed */
         tb_page_addr_t tb_phys_page1 = tb_page_addr1(tb);
         if (tb_phys_page1 == -1) {
@@ -215,9 +218,9 @@ static bool tb_lookup_cmp(const void *p, const void *d)
     return false;
 }
 
-static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
-                                          uint64_t cs_base, uint32_t flags,
-                                          uint32_t cflags)
+TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
+                                   uint64_t cs_base, uint32_t flags,
+                                   uint32_t cflags)
 {
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
@@ -261,7 +264,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                    jc->array[hash].pc == pc &&
                    tb->cs_base == cs_base &&
                    tb->flags == flags &&
-                   tb_cflags(tb) == cflags)) {
+                   tb_cflags_key(tb) == cflags)) {
             return tb;
         }
         tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
@@ -279,7 +282,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                    tb->pc == pc &&
                    tb->cs_base == cs_base &&
                    tb->flags == flags &&
-                   tb_cflags(tb) == cflags)) {
+                   tb_cflags_key(tb) == cflags)) {
             return tb;
         }
         tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
@@ -338,8 +341,12 @@ static bool check_for_breakpoints_slow(CPUState *cpu, vaddr pc,
      * TODO: gdb singlestep should only override gdb breakpoints,
      * so that one could (gdb) singlestep into the guest kernel's
      * architectural breakpoint handler.
+     *
+     * The QFlex timing model steps every instruction, yet gdb must still
+     * stop on its breakpoints then.
      */
-    if (cpu->singlestep_enabled) {
+    if (cpu->singlestep_enabled &&
+        !(cpu->singlestep_enabled & SSTEP_QFLEX)) {
         return false;
     }
 
@@ -405,30 +412,107 @@ static inline bool check_for_breakpoints(CPUState *cpu, vaddr pc,
  * If found, return the code pointer.  If not found, return
  * the tcg epilogue so that we return into cpu_tb_exec.
  */
-const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+static inline TranslationBlock *lookup_tb_for_ptr(CPUArchState *env,
+                                                   vaddr *pc, uint32_t *cflags)
 {
     CPUState *cpu = env_cpu(env);
     TranslationBlock *tb;
-    vaddr pc;
     uint64_t cs_base;
-    uint32_t flags, cflags;
+    uint32_t flags;
 
-    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    cpu_get_tb_cpu_state(env, pc, &cs_base, &flags);
 
-    cflags = curr_cflags(cpu);
-    if (check_for_breakpoints(cpu, pc, &cflags)) {
+    *cflags = curr_cflags(cpu);
+    if (check_for_breakpoints(cpu, *pc, cflags)) {
         cpu_loop_exit(cpu);
     }
 
-    tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
+    tb = tb_lookup(cpu, *pc, cs_base, flags, *cflags);
+    if (tb && qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
+        log_cpu_exec(*pc, cpu, tb);
+    }
+    return tb;
+}
+
+const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    TranslationBlock *tb;
+    vaddr pc;
+    uint32_t cflags;
+
+    tb = lookup_tb_for_ptr(env, &pc, &cflags);
     if (tb == NULL) {
         return tcg_code_gen_epilogue;
     }
+    return tb->tc.ptr;
+}
 
-    if (qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
-        log_cpu_exec(pc, cpu, tb);
+/*
+ * Point branch cache entry @e at @tb, unless @tb has been invalidated,
+ * and add @e to the entries of @tb that tb_branch_cache_inval_tb clears.
+ */
+static void tb_branch_cache_set(CPUBranchCacheEntry *e, const void *site,
+                                vaddr pc, TranslationBlock *tb)
+{
+    int i, free = -1;
+
+    qemu_spin_lock(&tb->jmp_lock);
+    if (tb_cflags(tb) & CF_INVALID) {
+        qemu_spin_unlock(&tb->jmp_lock);
+        return;
+    }
+
+    for (i = 0; i < TB_BC_REFS; i++) {
+        CPUBranchCacheEntry *ref = tb->bc_refs[i];
+
+        if (ref == e) {
+            free = i;
+            break;
+        }
+        /* Unused, or reused for another TB since */
+        if (free < 0 && (!ref || qatomic_read(&ref->tb) != tb)) {
+            free = i;
+        }
+    }
+    if (free >= 0) {
+        tb->bc_refs[free] = e;
+    } else {
+        tb->bc_overflow = true;
     }
 
+    e->pc = pc;
+    e->ptr = tb->tc.ptr;
+    qatomic_set(&e->tb, tb);
+    qatomic_set(&e->site, site);
+    qemu_spin_unlock(&tb->jmp_lock);
+}
+
+/**
+ * helper_lookup_tb_ptr_cached: next tb after a miss in the branch cache
+ * @env: current cpu state
+ * @idx: index of the entry in CPUBranchCache that missed
+ * @site: the TB containing the branch
+ *
+ * As helper_lookup_tb_ptr, and record the TB found in entry @idx
+ * so that the branch finds it inline the next time.
+ */
+const void *HELPER(lookup_tb_ptr_cached)(CPUArchState *env, uint32_t idx,
+                                         const void *site)
+{
+    CPUBranchCacheEntry *e = &env_cpu(env)->neg.bc.entry[idx];
+    TranslationBlock *tb;
+    vaddr pc;
+    uint32_t cflags;
+
+    tb = lookup_tb_for_ptr(env, &pc, &cflags);
+    if (tb == NULL) {
+        return tcg_code_gen_epilogue;
+    }
+
+    /* A breakpoint on the target must be checked every time. */
+    if (!(cflags & CF_NO_GOTO_TB)) {
+        tb_branch_cache_set(e, site, pc, tb);
+    }
     return tb->tc.ptr;
 }
 
@@ -574,7 +658,7 @@ void cpu_exec_step_atomic(CPUState *cpu)
     int tb_exit;
 
     if (sigsetjmp(cpu->jmp_env, 0) == 0) {
-        start_exclusive();
+        start_exclusive_for(EXCLUSIVE_CAUSE_ATOMIC);
         g_assert(cpu == current_cpu);
         g_assert(!cpu->running);
         cpu->running = true;
@@ -749,6 +833,14 @@ static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
 #else
         if (replay_exception()) {
             CPUClass *cc = CPU_GET_CLASS(cpu);
+#ifdef CONFIG_LIBQFLEX
+            if (qflex_rings_enabled) {
+                /* Push the instructions that led to it first */
+                qemu_plugin_vcpu_trace_flush(cpu);
+                qflex_ring_push_exception(cpu->cpu_index, cc->get_pc(cpu),
+                                          cpu->exception_index);
+            }
+#endif
             qemu_mutex_lock_iothread();
             cc->tcg_ops->do_interrupt(cpu);
             qemu_mutex_unlock_iothread();
@@ -959,6 +1051,11 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 #endif
 }
 
+static inline bool tb_is_hot(const TranslationBlock *tb)
+{
+    return tb->hot_slot >= 0 && qatomic_read(&tb_hotness[tb->hot_slot]) <= 0;
+}
+
 /* main execution loop */
 
 static int __attribute__((noinline))
@@ -966,6 +1063,12 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
 {
     int ret;
 
+#ifndef CONFIG_USER_ONLY
+    if (unlikely(tb_cache_enabled)) {
+        tb_cache_warm(cpu);
+    }
+#endif
+
     /* if an exception is pending, we execute it here */
     while (!cpu_handle_exception(cpu, &ret)) {
         TranslationBlock *last_tb = NULL;
@@ -998,12 +1101,28 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             }
 
             tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
-            if (tb == NULL) {
+            if (tb == NULL || unlikely(tb_is_hot(tb))) {
                 CPUJumpCache *jc;
                 uint32_t h;
 
                 mmap_lock();
+                if (tb) {
+                    /*
+                     * Replace the hot TB with a superblock.  It is found
+                     * by the same lookups, since CF_SUPERBLOCK is not part
+                     * of the key, and the jumps to the old TB are undone.
+                     */
+                    qatomic_set(&tb_hotness[tb->hot_slot],
+                                tb_superblock_threshold);
+                    tb_phys_invalidate(tb, -1);
+                    cflags |= CF_SUPERBLOCK;
+                }
                 tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
+#ifndef CONFIG_USER_ONLY
+                if (tb_workers_enabled) {
+                    tb_workers_queue(cpu, tb, 1);
+                }
+#endif
                 mmap_unlock();
 
                 /*
@@ -1032,6 +1151,15 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             if (tb_page_addr1(tb) != -1) {
                 last_tb = NULL;
             }
+            /*
+             * Nor to link a TB with a one-shot TB outside of RAM: those are
+             * not in the region trees, so tcg_region_evict() would leave
+             * the jump in place.
+             */
+            if (tb_page_addr0(tb) == -1 ||
+                (last_tb && tb_page_addr0(last_tb) == -1)) {
+                last_tb = NULL;
+            }
 #endif
             /* See if we can patch the calling TB. */
             if (last_tb) {
@@ -1083,6 +1211,7 @@ int cpu_exec(CPUState *cpu)
 
     ret = cpu_exec_setjmp(cpu, &sc);
 
+    qemu_plugin_vcpu_trace_flush(cpu);
     cpu_exec_exit(cpu);
     rcu_read_unlock();
 
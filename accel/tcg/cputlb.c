@@ -107,6 +107,14 @@ static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
     CPUJumpCache *jc = cpu->tb_jmp_cache;
     int i, i0;
 
+    for (i = 0; i < ARRAY_SIZE(cpu->neg.bc.entry); i++) {
+        CPUBranchCacheEntry *e = &cpu->neg.bc.entry[i];
+
+        if ((e->pc & TARGET_PAGE_MASK) == page_addr) {
+            qatomic_set(&e->site, NULL);
+        }
+    }
+
     if (unlikely(!jc)) {
         return;
     }
@@ -232,14 +240,74 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
     }
 }
 
+/* Flush the victim tlb and the large page translations of @desc. */
+static void tlb_mmu_flush_victims_locked(CPUTLBDesc *desc)
+{
+    desc->lindex = 0;
+    for (int i = 0; i < CPU_LTLB_SIZE; i++) {
+        /* Matches no address. */
+        desc->ltlb[i].addr = -1;
+        desc->ltlb[i].mask = 0;
+    }
+    desc->vindex = 0;
+    memset(desc->vtable, -1, sizeof(desc->vtable));
+}
+
 static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
 {
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
-    desc->vindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
-    memset(desc->vtable, -1, sizeof(desc->vtable));
+    tlb_mmu_flush_victims_locked(desc);
+}
+
+/*
+ * The context of a tlb filled since it was last flushed, without
+ * tlb_set_context_by_mmuidx saying which context that was.
+ */
+#define TLB_CONTEXT_NONE  ((uint64_t)-1)
+
+/* Larger tlbs are flushed instead of set aside on a context switch. */
+#define TLB_CONTEXT_MAX_BITS  12
+
+static void tlb_context_free(CPUTLBContext *c)
+{
+    g_free(c->f.table);
+    g_free(c->fulltlb);
+    c->f.table = NULL;
+    c->fulltlb = NULL;
+}
+
+/* Drop the tlbs set aside for all contexts but the current one. */
+static void tlb_context_free_all(CPUTLBDesc *desc)
+{
+    for (int i = 0; i < CPU_TLB_CONTEXTS; i++) {
+        if (desc->saved[i].f.table) {
+            tlb_context_free(&desc->saved[i]);
+        }
+    }
+}
+
+/* Exchange the current tlb of @desc and @fast with the one in @c. */
+static void tlb_context_swap(CPUTLBDesc *desc, CPUTLBDescFast *fast,
+                             CPUTLBContext *c)
+{
+    CPUTLBContext t = *c;
+
+    c->ctx = desc->ctx;
+    c->f = *fast;
+    c->fulltlb = desc->fulltlb;
+    c->n_used_entries = desc->n_used_entries;
+    c->large_page_addr = desc->large_page_addr;
+    c->large_page_mask = desc->large_page_mask;
+
+    desc->ctx = t.ctx;
+    *fast = t.f;
+    desc->fulltlb = t.fulltlb;
+    desc->n_used_entries = t.n_used_entries;
+    desc->large_page_addr = t.large_page_addr;
+    desc->large_page_mask = t.large_page_mask;
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
@@ -261,6 +329,7 @@ static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
     fast->mask = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
     fast->table = g_new(CPUTLBEntry, n_entries);
     desc->fulltlb = g_new(CPUTLBEntryFull, n_entries);
+    desc->ctx = TLB_CONTEXT_NONE;
     tlb_mmu_flush_locked(desc, fast);
 }
 
@@ -283,6 +352,9 @@ void tlb_init(CPUState *cpu)
 
     /* All tlbs are initialized flushed. */
     cpu->neg.tlb.c.dirty = 0;
+    cpu->neg.tlb.c.pending_queued = false;
+    cpu->neg.tlb.c.pending_full = 0;
+    cpu->neg.tlb.c.n_pending = 0;
 
     for (i = 0; i < NB_MMU_MODES; i++) {
         tlb_mmu_init(&cpu->neg.tlb.d[i], &cpu->neg.tlb.f[i], now);
@@ -300,24 +372,143 @@ void tlb_destroy(CPUState *cpu)
 
         g_free(fast->table);
         g_free(desc->fulltlb);
+        tlb_context_free_all(desc);
     }
 }
 
-/* flush_all_helper: run fn across all cpus
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data);
+
+/* Queue the flush of the source cpu of the _synced variants. */
+static void tlb_flush_synced(CPUState *src, run_on_cpu_func fn,
+                             run_on_cpu_data d)
+{
+    async_safe_run_on_cpu_for(src, EXCLUSIVE_CAUSE_TLB_FLUSH, fn, d);
+}
+
+/*
+ * Return true if [@addr, @addr + @len) meets the large page region
+ * @lp_addr/@lp_mask.  The range may start or end within the region,
+ * or cover it, so test both of its ends.
+ */
+static bool tlb_range_meets_large_page(vaddr lp_addr, vaddr lp_mask,
+                                       vaddr addr, vaddr len)
+{
+    return lp_addr != (vaddr)-1 &&
+           addr <= (lp_addr | ~lp_mask) &&
+           addr + len - 1 >= lp_addr;
+}
+
+/*
+ * Return true if [@addr, @addr + @len) meets the large page region of
+ * one of the mmu indexes in @idxmap.  Called with tlb_c.lock held.
+ */
+static bool tlb_range_meets_large_pages_locked(CPUState *cpu, uint16_t idxmap,
+                                               vaddr addr, vaddr len)
+{
+    for (int mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+
+        if (((idxmap >> mmu_idx) & 1) &&
+            tlb_range_meets_large_page(desc->large_page_addr,
+                                       desc->large_page_mask, addr, len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Called with tlb_c.lock held */
+static void tlb_flush_pending_add_locked(CPUState *cpu,
+                                         const CPUTLBFlushRange *d)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+
+    /* A full flush, or one for which a full flush is already queued. */
+    if (d->bits < TARGET_PAGE_BITS || !(d->idxmap & ~c->pending_full)) {
+        c->pending_full |= d->idxmap;
+        return;
+    }
+
+    /*
+     * Extend a queued range that this one overlaps or adjoins, unless
+     * the merged range reaches into a region of large pages: those are
+     * flushed entirely, and the flushes apart may well not touch it.
+     */
+    for (size_t i = 0; i < c->n_pending; i++) {
+        CPUTLBFlushRange *p = &c->pending[i];
+        vaddr p_end = p->addr + p->len;
+        vaddr d_end = d->addr + d->len;
+        vaddr addr, len;
+
+        if (p->idxmap != d->idxmap || p->bits != d->bits ||
+            p_end <= p->addr || d_end <= d->addr ||
+            d->addr > p_end || p->addr > d_end) {
+            continue;
+        }
+        addr = MIN(p->addr, d->addr);
+        len = MAX(p_end, d_end) - addr;
+        if (tlb_range_meets_large_pages_locked(cpu, d->idxmap, addr, len)) {
+            continue;
+        }
+        p->addr = addr;
+        p->len = len;
+        return;
+    }
+
+    if (c->n_pending < CPU_TLB_PENDING_SIZE) {
+        c->pending[c->n_pending++] = *d;
+    } else {
+        /* Too many to flush one by one. */
+        c->pending_full |= d->idxmap;
+    }
+}
+
+/*
+ * tlb_flush_queue: have @cpu, which is not the one running, flush
+ * the tlb as described by CPUTLBFlushRange, before it executes again.
  *
- * If the wait flag is set then the src cpu's helper will be queued as
- * "safe" work and the loop exited creating a synchronisation point
- * where all queued work will be finished before execution starts
- * again.
+ * The flushes queued for @cpu until it gets round to them are done by
+ * a single work item, which is what a guest invalidating many pages
+ * on many cpus spends its time in queueing and running.
  */
-static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
-                             run_on_cpu_data d)
+static void tlb_flush_queue(CPUState *cpu, vaddr addr, vaddr len,
+                            uint16_t idxmap, unsigned bits)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    CPUTLBFlushRange d = {
+        .addr = addr, .len = len, .idxmap = idxmap, .bits = bits
+    };
+    bool queued;
+
+    qemu_spin_lock(&c->lock);
+    tlb_flush_pending_add_locked(cpu, &d);
+    queued = c->pending_queued;
+    c->pending_queued = true;
+    if (queued) {
+        qatomic_set(&c->merge_flush_count, c->merge_flush_count + 1);
+    }
+    qemu_spin_unlock(&c->lock);
+
+    if (!queued) {
+        async_run_on_cpu(cpu, tlb_flush_pending_async_work, RUN_ON_CPU_NULL);
+    }
+}
+
+/*
+ * tlb_flush_queue_others: tlb_flush_queue for all cpus but @src
+ *
+ * The _synced variants then queue the flush of the src cpu as "safe"
+ * work, creating a synchronisation point where all queued work will
+ * be finished before execution starts again.
+ */
+static void tlb_flush_queue_others(CPUState *src, vaddr addr, vaddr len,
+                                   uint16_t idxmap, unsigned bits)
 {
     CPUState *cpu;
 
     CPU_FOREACH(cpu) {
         if (cpu != src) {
-            async_run_on_cpu(cpu, fn, d);
+            tlb_flush_queue(cpu, addr, len, idxmap, bits);
         }
     }
 }
@@ -342,6 +533,16 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
     for (work = to_clean; work != 0; work &= work - 1) {
         int mmu_idx = ctz32(work);
         tlb_flush_one_mmuidx_locked(cpu, mmu_idx, now);
+        tlb_context_free_all(&cpu->neg.tlb.d[mmu_idx]);
+    }
+
+    /*
+     * The flush may be for a change of context that the target does
+     * not report, e.g. of the register that holds the ASID.  Entries
+     * filled from now on are of an unknown context.
+     */
+    for (work = asked; work != 0; work &= work - 1) {
+        cpu->neg.tlb.d[ctz32(work)].ctx = TLB_CONTEXT_NONE;
     }
 
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
@@ -367,8 +568,7 @@ void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
     tlb_debug("mmu_idx: 0x%" PRIx16 "\n", idxmap);
 
     if (cpu->created && !qemu_cpu_is_self(cpu)) {
-        async_run_on_cpu(cpu, tlb_flush_by_mmuidx_async_work,
-                         RUN_ON_CPU_HOST_INT(idxmap));
+        tlb_flush_queue(cpu, 0, 0, idxmap, 0);
     } else {
         tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(idxmap));
     }
@@ -381,12 +581,10 @@ void tlb_flush(CPUState *cpu)
 
 void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, uint16_t idxmap)
 {
-    const run_on_cpu_func fn = tlb_flush_by_mmuidx_async_work;
-
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    fn(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_flush_queue_others(src_cpu, 0, 0, idxmap, 0);
+    tlb_flush_by_mmuidx_async_work(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
 void tlb_flush_all_cpus(CPUState *src_cpu)
@@ -396,12 +594,11 @@ void tlb_flush_all_cpus(CPUState *src_cpu)
 
 void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 {
-    const run_on_cpu_func fn = tlb_flush_by_mmuidx_async_work;
-
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_flush_queue_others(src_cpu, 0, 0, idxmap, 0);
+    tlb_flush_synced(src_cpu, tlb_flush_by_mmuidx_async_work,
+                     RUN_ON_CPU_HOST_INT(idxmap));
 }
 
 void tlb_flush_all_cpus_synced(CPUState *src_cpu)
@@ -409,6 +606,198 @@ void tlb_flush_all_cpus_synced(CPUState *src_cpu)
     tlb_flush_by_mmuidx_all_cpus_synced(src_cpu, ALL_MMUIDX_BITS);
 }
 
+/*
+ * Pick the slot of @desc in which to set aside the current tlb: a free
+ * one if there is any, otherwise the oldest.
+ */
+static CPUTLBContext *tlb_context_victim(CPUTLBDesc *desc)
+{
+    for (int i = 0; i < CPU_TLB_CONTEXTS; i++) {
+        if (!desc->saved[i].f.table) {
+            return &desc->saved[i];
+        }
+    }
+    return &desc->saved[desc->ctx_index++ % CPU_TLB_CONTEXTS];
+}
+
+static void tlb_set_context_locked(CPUState *cpu, int mmu_idx, uint64_t ctx)
+{
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    CPUTLBDescFast *fast = &cpu->neg.tlb.f[mmu_idx];
+    CPUTLBContext *c = NULL;
+    bool keep;
+
+    /*
+     * Only set aside a tlb with something in it, which is known to
+     * belong to the context that it is set aside for.
+     */
+    keep = desc->ctx != TLB_CONTEXT_NONE && desc->n_used_entries != 0 &&
+           tlb_n_entries(fast) <= (1 << TLB_CONTEXT_MAX_BITS);
+
+    for (int i = 0; i < CPU_TLB_CONTEXTS; i++) {
+        if (desc->saved[i].f.table && desc->saved[i].ctx == ctx) {
+            c = &desc->saved[i];
+            break;
+        }
+    }
+
+    if (c) {
+        tlb_context_swap(desc, fast, c);
+        if (!keep) {
+            tlb_context_free(c);
+        }
+        /* These were filled in the old context. */
+        tlb_mmu_flush_victims_locked(desc);
+        qatomic_set(&cpu->neg.tlb.c.ctx_restore_count,
+                    cpu->neg.tlb.c.ctx_restore_count + 1);
+    } else {
+        if (keep) {
+            c = tlb_context_victim(desc);
+            if (c->f.table && c->f.mask != fast->mask) {
+                tlb_context_free(c);
+            }
+            if (!c->f.table) {
+                size_t n_entries = tlb_n_entries(fast);
+
+                c->f.mask = fast->mask;
+                c->f.table = g_try_new(CPUTLBEntry, n_entries);
+                c->fulltlb = g_try_new(CPUTLBEntryFull, n_entries);
+            }
+            if (c->f.table && c->fulltlb) {
+                /* Start the new context in the victim's tables. */
+                tlb_context_swap(desc, fast, c);
+            } else {
+                tlb_context_free(c);
+            }
+        }
+        tlb_mmu_flush_locked(desc, fast);
+    }
+    desc->ctx = ctx;
+}
+
+void tlb_set_context_by_mmuidx(CPUState *cpu, uint16_t idxmap, uint64_t ctx)
+{
+    uint16_t work, changed = 0;
+
+    tlb_debug("mmu_idx: 0x%" PRIx16 " ctx: 0x%" PRIx64 "\n", idxmap, ctx);
+
+    if (!qemu_cpu_is_self(cpu)) {
+        /* Only the cpu itself knows which context its entries are of. */
+        tlb_flush_by_mmuidx(cpu, idxmap);
+        return;
+    }
+
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    for (work = idxmap; work != 0; work &= work - 1) {
+        int mmu_idx = ctz32(work);
+
+        if (cpu->neg.tlb.d[mmu_idx].ctx != ctx) {
+            tlb_set_context_locked(cpu, mmu_idx, ctx);
+            changed |= 1 << mmu_idx;
+        }
+    }
+    /* A full flush must also drop the tlbs set aside. */
+    cpu->neg.tlb.c.dirty |= changed;
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+
+    if (changed) {
+        tcg_flush_jmp_cache(cpu);
+        qatomic_set(&cpu->neg.tlb.c.ctx_switch_count,
+                    cpu->neg.tlb.c.ctx_switch_count + 1);
+    }
+}
+
+typedef struct {
+    uint64_t ctx;
+    uint16_t idxmap;
+} TLBFlushContextData;
+
+static void tlb_flush_context_by_mmuidx_async_0(CPUState *cpu,
+                                                uint16_t idxmap, uint64_t ctx)
+{
+    uint16_t work, flushed = 0;
+    int64_t now = get_clock_realtime();
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("mmu_idx: 0x%" PRIx16 " ctx: 0x%" PRIx64 "\n", idxmap, ctx);
+
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    for (work = idxmap; work != 0; work &= work - 1) {
+        int mmu_idx = ctz32(work);
+        CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+
+        for (int i = 0; i < CPU_TLB_CONTEXTS; i++) {
+            if (desc->saved[i].f.table && desc->saved[i].ctx == ctx) {
+                tlb_context_free(&desc->saved[i]);
+            }
+        }
+        if (desc->ctx == ctx || desc->ctx == TLB_CONTEXT_NONE) {
+            tlb_flush_one_mmuidx_locked(cpu, mmu_idx, now);
+            flushed |= 1 << mmu_idx;
+        }
+    }
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+
+    if (flushed) {
+        tcg_flush_jmp_cache(cpu);
+        qatomic_set(&cpu->neg.tlb.c.part_flush_count,
+                    cpu->neg.tlb.c.part_flush_count + ctpop16(flushed));
+    }
+}
+
+/*
+ * Helper for tlb_flush_context_by_mmuidx and friends, called through
+ * async_run_on_cpu.  Free the TLBFlushContextData when done.
+ */
+static void tlb_flush_context_by_mmuidx_async_1(CPUState *cpu,
+                                                run_on_cpu_data data)
+{
+    TLBFlushContextData *d = data.host_ptr;
+
+    tlb_flush_context_by_mmuidx_async_0(cpu, d->idxmap, d->ctx);
+    g_free(d);
+}
+
+static TLBFlushContextData *tlb_flush_context_data(uint16_t idxmap,
+                                                   uint64_t ctx)
+{
+    TLBFlushContextData *d = g_new(TLBFlushContextData, 1);
+
+    d->ctx = ctx;
+    d->idxmap = idxmap;
+    return d;
+}
+
+void tlb_flush_context_by_mmuidx(CPUState *cpu, uint16_t idxmap, uint64_t ctx)
+{
+    if (qemu_cpu_is_self(cpu)) {
+        tlb_flush_context_by_mmuidx_async_0(cpu, idxmap, ctx);
+    } else {
+        async_run_on_cpu(cpu, tlb_flush_context_by_mmuidx_async_1,
+                         RUN_ON_CPU_HOST_PTR(tlb_flush_context_data(idxmap,
+                                                                    ctx)));
+    }
+}
+
+void tlb_flush_context_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                                 uint16_t idxmap,
+                                                 uint64_t ctx)
+{
+    CPUState *dst_cpu;
+
+    /* Allocate a separate data block for each destination cpu.  */
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            async_run_on_cpu(dst_cpu, tlb_flush_context_by_mmuidx_async_1,
+                             RUN_ON_CPU_HOST_PTR(
+                                 tlb_flush_context_data(idxmap, ctx)));
+        }
+    }
+    tlb_flush_synced(src_cpu, tlb_flush_context_by_mmuidx_async_1,
+                     RUN_ON_CPU_HOST_PTR(tlb_flush_context_data(idxmap, ctx)));
+}
+
 static bool tlb_hit_page_mask_anyprot(CPUTLBEntry *tlb_entry,
                                       vaddr page, vaddr mask)
 {
@@ -473,11 +862,47 @@ static inline void tlb_flush_vtlb_page_locked(CPUState *cpu, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(cpu, mmu_idx, page, -1);
 }
 
+/*
+ * Flush the pages of [@addr, @addr + @len) that match under @mask from
+ * the tlbs set aside for other contexts of @desc.  As for the current
+ * tlb, drop one altogether when that is cheaper, or when the range
+ * meets one of its large pages.
+ */
+static void tlb_flush_context_range_locked(CPUTLBDesc *desc, vaddr addr,
+                                           vaddr len, vaddr mask)
+{
+    for (int i = 0; i < CPU_TLB_CONTEXTS; i++) {
+        CPUTLBContext *c = &desc->saved[i];
+        uintptr_t size_mask = c->f.mask >> CPU_TLB_ENTRY_BITS;
+
+        if (!c->f.table) {
+            continue;
+        }
+        if (mask < c->f.mask || len > c->f.mask ||
+            tlb_range_meets_large_page(c->large_page_addr,
+                                       c->large_page_mask, addr, len)) {
+            tlb_context_free(c);
+            continue;
+        }
+        for (vaddr j = 0; j < len; j += TARGET_PAGE_SIZE) {
+            vaddr page = addr + j;
+            CPUTLBEntry *entry =
+                &c->f.table[(page >> TARGET_PAGE_BITS) & size_mask];
+
+            if (tlb_flush_entry_mask_locked(entry, page, mask)) {
+                c->n_used_entries--;
+            }
+        }
+    }
+}
+
 static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
 {
     vaddr lp_addr = cpu->neg.tlb.d[midx].large_page_addr;
     vaddr lp_mask = cpu->neg.tlb.d[midx].large_page_mask;
 
+    tlb_flush_context_range_locked(&cpu->neg.tlb.d[midx], page, 1, -1);
+
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
         tlb_debug("forcing full flush midx %d (%016"
@@ -580,22 +1005,8 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, vaddr addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
-
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        tlb_flush_queue(cpu, addr, TARGET_PAGE_SIZE, idxmap, TARGET_LONG_BITS);
     }
 }
 
@@ -612,30 +1023,8 @@ void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, vaddr addr,
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-    }
-
+    tlb_flush_queue_others(src_cpu, addr, TARGET_PAGE_SIZE,
+                           idxmap, TARGET_LONG_BITS);
     tlb_flush_page_by_mmuidx_async_0(src_cpu, addr, idxmap);
 }
 
@@ -653,35 +1042,25 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
+    tlb_flush_queue_others(src_cpu, addr, TARGET_PAGE_SIZE,
+                           idxmap, TARGET_LONG_BITS);
+
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
+        /*
+         * Most targets have only a few mmu_idx.  In the case where
+         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
+         * allocating memory for this operation.
+         */
+        tlb_flush_synced(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                          RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                              RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
+        /* Otherwise allocate a structure, freed by the worker.  */
         d->addr = addr;
         d->idxmap = idxmap;
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
-                              RUN_ON_CPU_HOST_PTR(d));
+        tlb_flush_synced(src_cpu, tlb_flush_page_by_mmuidx_async_2,
+                         RUN_ON_CPU_HOST_PTR(d));
     }
 }
 
@@ -698,6 +1077,8 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
     CPUTLBDescFast *f = &cpu->neg.tlb.f[midx];
     vaddr mask = MAKE_64BIT_MASK(0, bits);
 
+    tlb_flush_context_range_locked(d, addr, len, mask);
+
     /*
      * If @bits is smaller than the tlb size, there may be multiple entries
      * within the TLB; otherwise all addresses that match under @mask hit
@@ -716,12 +1097,9 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
         return;
     }
 
-    /*
-     * Check if we need to flush due to large pages.
-     * Because large_page_mask contains all 1's from the msb,
-     * we only need to test the end of the range.
-     */
-    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
+    /* Check if we need to flush due to large pages.  */
+    if (tlb_range_meets_large_page(d->large_page_addr, d->large_page_mask,
+                                   addr, len)) {
         tlb_debug("forcing full flush midx %d ("
                   "%016" VADDR_PRIx "/%016" VADDR_PRIx ")\n",
                   midx, d->large_page_addr, d->large_page_mask);
@@ -740,15 +1118,8 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
     }
 }
 
-typedef struct {
-    vaddr addr;
-    vaddr len;
-    uint16_t idxmap;
-    uint16_t bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
-                                              TLBFlushRangeData d)
+                                              CPUTLBFlushRange d)
 {
     int mmu_idx;
 
@@ -788,16 +1159,51 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
 static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
                                               run_on_cpu_data data)
 {
-    TLBFlushRangeData *d = data.host_ptr;
+    CPUTLBFlushRange *d = data.host_ptr;
     tlb_flush_range_by_mmuidx_async_0(cpu, *d);
     g_free(d);
 }
 
+/* Do the flushes queued by tlb_flush_queue. */
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    CPUTLBFlushRange pending[CPU_TLB_PENDING_SIZE];
+    uint16_t full;
+    size_t n;
+
+    qemu_spin_lock(&c->lock);
+    full = c->pending_full;
+    n = c->n_pending;
+    memcpy(pending, c->pending, n * sizeof(pending[0]));
+    c->pending_full = 0;
+    c->n_pending = 0;
+    c->pending_queued = false;
+    qemu_spin_unlock(&c->lock);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (size_t i = 0; i < n; i++) {
+        CPUTLBFlushRange d = pending[i];
+
+        d.idxmap &= ~full;
+        if (d.idxmap == 0) {
+            continue;
+        }
+        if (d.bits >= TARGET_LONG_BITS && d.len <= TARGET_PAGE_SIZE) {
+            tlb_flush_page_by_mmuidx_async_0(cpu, d.addr, d.idxmap);
+        } else {
+            tlb_flush_range_by_mmuidx_async_0(cpu, d);
+        }
+    }
+}
+
 void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
                                vaddr len, uint16_t idxmap,
                                unsigned bits)
 {
-    TLBFlushRangeData d;
+    CPUTLBFlushRange d;
 
     /*
      * If all bits are significant, and len is small,
@@ -822,10 +1228,7 @@ void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_range_by_mmuidx_async_0(cpu, d);
     } else {
-        /* Otherwise allocate a structure, freed by the worker.  */
-        TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
-                         RUN_ON_CPU_HOST_PTR(p));
+        tlb_flush_queue(cpu, d.addr, d.len, d.idxmap, d.bits);
     }
 }
 
@@ -839,8 +1242,7 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
                                         vaddr addr, vaddr len,
                                         uint16_t idxmap, unsigned bits)
 {
-    TLBFlushRangeData d;
-    CPUState *dst_cpu;
+    CPUTLBFlushRange d;
 
     /*
      * If all bits are significant, and len is small,
@@ -862,16 +1264,7 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu,
-                             tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
-
+    tlb_flush_queue_others(src_cpu, d.addr, d.len, d.idxmap, d.bits);
     tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
 }
 
@@ -889,8 +1282,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                                uint16_t idxmap,
                                                unsigned bits)
 {
-    TLBFlushRangeData d, *p;
-    CPUState *dst_cpu;
+    CPUTLBFlushRange d, *p;
 
     /*
      * If all bits are significant, and len is small,
@@ -912,18 +1304,11 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
+    tlb_flush_queue_others(src_cpu, d.addr, d.len, d.idxmap, d.bits);
 
     p = g_memdup(&d, sizeof(d));
-    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
-                          RUN_ON_CPU_HOST_PTR(p));
+    tlb_flush_synced(src_cpu, tlb_flush_range_by_mmuidx_async_1,
+                     RUN_ON_CPU_HOST_PTR(p));
 }
 
 void tlb_flush_page_bits_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
@@ -1024,6 +1409,19 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
             tlb_reset_dirty_range_locked(&cpu->neg.tlb.d[mmu_idx].vtable[i],
                                          start1, length);
         }
+
+        for (int c = 0; c < CPU_TLB_CONTEXTS; c++) {
+            CPUTLBContext *saved = &cpu->neg.tlb.d[mmu_idx].saved[c];
+
+            if (!saved->f.table) {
+                continue;
+            }
+            n = tlb_n_entries(&saved->f);
+            for (i = 0; i < n; i++) {
+                tlb_reset_dirty_range_locked(&saved->f.table[i],
+                                             start1, length);
+            }
+        }
     }
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
@@ -1060,13 +1458,20 @@ void tlb_set_dirty(CPUState *cpu, vaddr addr)
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+/*
+ * Our fast TLB does not support large pages, so remember the area covered
+ * by large pages and trigger a full TLB flush if these are invalidated.
+ * Remember the translation itself in the large page TLB, so that the
+ * other pages it covers can be filled from it.
+ */
 static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
-                               vaddr addr, uint64_t size)
+                               vaddr addr, uint64_t size,
+                               const CPUTLBEntryFull *full)
 {
-    vaddr lp_addr = cpu->neg.tlb.d[mmu_idx].large_page_addr;
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    vaddr lp_addr = desc->large_page_addr;
     vaddr lp_mask = ~(size - 1);
+    CPUTLBLargePage *lp = NULL;
 
     if (lp_addr == (vaddr)-1) {
         /* No previous large page.  */
@@ -1075,13 +1480,90 @@ static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
         /* Extend the existing region to include the new page.
            This is a compromise between unnecessary flushes and
            the cost of maintaining a full variable size TLB.  */
-        lp_mask &= cpu->neg.tlb.d[mmu_idx].large_page_mask;
+        lp_mask &= desc->large_page_mask;
         while (((lp_addr ^ addr) & lp_mask) != 0) {
             lp_mask <<= 1;
         }
     }
-    cpu->neg.tlb.d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    cpu->neg.tlb.d[mmu_idx].large_page_mask = lp_mask;
+    desc->large_page_addr = lp_addr & lp_mask;
+    desc->large_page_mask = lp_mask;
+
+    /*
+     * The pages can only be derived from one another if the target
+     * says that a single descriptor maps all of them, and the mapping
+     * keeps the offset within the large page.
+     */
+    if (!full->contiguous ||
+        ((addr ^ full->phys_addr) & (size - 1) & TARGET_PAGE_MASK)) {
+        return;
+    }
+
+    /* Replace any translation that overlaps, such as an older one. */
+    lp_mask = ~(size - 1);
+    for (int i = 0; i < CPU_LTLB_SIZE; i++) {
+        CPUTLBLargePage *e = &desc->ltlb[i];
+
+        if (e->mask && ((addr ^ e->addr) & lp_mask & e->mask) == 0) {
+            lp = e;
+            break;
+        }
+    }
+    if (lp == NULL) {
+        lp = &desc->ltlb[desc->lindex++ % CPU_LTLB_SIZE];
+    }
+
+    lp->addr = addr & lp_mask;
+    lp->mask = lp_mask;
+    lp->full = *full;
+    lp->full.phys_addr &= ~(hwaddr)(size - 1);
+    /*
+     * PAGE_WRITE_INV asks for tlb_fill on every write; only reads and
+     * fetches may skip it.
+     */
+    if (lp->full.prot & PAGE_WRITE_INV) {
+        lp->full.prot &= ~(PAGE_WRITE | PAGE_WRITE_INV);
+    }
+}
+
+/*
+ * Return true if ADDR is within a large page of the large page TLB that
+ * allows ACCESS_TYPE, and a TLB entry for its page has been added.
+ */
+static bool tlb_fill_large_page(CPUState *cpu, vaddr addr,
+                                MMUAccessType access_type, int mmu_idx)
+{
+    static const int access_prot[] = {
+        [MMU_DATA_LOAD] = PAGE_READ,
+        [MMU_DATA_STORE] = PAGE_WRITE,
+        [MMU_INST_FETCH] = PAGE_EXEC,
+    };
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+
+    if (desc->large_page_addr == (vaddr)-1) {
+        return false;
+    }
+    for (int i = 0; i < CPU_LTLB_SIZE; i++) {
+        CPUTLBLargePage *lp = &desc->ltlb[i];
+        CPUTLBEntryFull full;
+
+        if ((addr & lp->mask) != lp->addr) {
+            continue;
+        }
+        if (!(lp->full.prot & access_prot[access_type])) {
+            return false;
+        }
+
+        full = lp->full;
+        full.phys_addr |= addr & ~lp->mask & TARGET_PAGE_MASK;
+        tlb_debug("vaddr=%016" VADDR_PRIx " from large page %016"
+                  VADDR_PRIx "/%016" VADDR_PRIx " idx=%d\n",
+                  addr, lp->addr, lp->mask, mmu_idx);
+        tlb_set_page_full(cpu, mmu_idx, addr, &full);
+        qatomic_set(&cpu->neg.tlb.c.large_page_fill_count,
+                    cpu->neg.tlb.c.large_page_fill_count + 1);
+        return true;
+    }
+    return false;
 }
 
 static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
@@ -1105,7 +1587,8 @@ static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
 /*
  * Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
+ * supplied size is used by tlb_flush_page, and to map the other pages
+ * of a large page on a later miss without calling tlb_fill.
  *
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
@@ -1130,7 +1613,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
         sz = TARGET_PAGE_SIZE;
     } else {
         sz = (hwaddr)1 << full->lg_page_size;
-        tlb_add_large_page(cpu, mmu_idx, addr, sz);
+        tlb_add_large_page(cpu, mmu_idx, addr, sz, full);
     }
     addr_page = addr & TARGET_PAGE_MASK;
     paddr_page = full->phys_addr & TARGET_PAGE_MASK;
@@ -1308,6 +1791,10 @@ static void tlb_fill(CPUState *cpu, vaddr addr, int size,
 {
     bool ok;
 
+    if (tlb_fill_large_page(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1429,7 +1916,8 @@ static int probe_access_internal(CPUState *cpu, vaddr addr,
 
     if (!tlb_hit_page(tlb_addr, page_addr)) {
         if (!victim_tlb_hit(cpu, mmu_idx, index, access_type, page_addr)) {
-            if (!cpu->cc->tcg_ops->tlb_fill(cpu, addr, fault_size, access_type,
+            if (!tlb_fill_large_page(cpu, addr, access_type, mmu_idx) &&
+                !cpu->cc->tcg_ops->tlb_fill(cpu, addr, fault_size, access_type,
                                             mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
                 *phost = NULL;
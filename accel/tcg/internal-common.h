@@ -14,6 +14,45 @@
 extern int64_t max_delay;
 extern int64_t max_advance;
 
+#ifdef CONFIG_LIBQFLEX
+/* Per-vCPU fast-forward length before QFlex timing mode, 0 if none */
+extern uint64_t qflex_ff_insns;
+#endif
+
+/*
+ * Execution count after which a TB is retranslated as a superblock that
+ * follows direct branches, 0 to never form superblocks.  TBs count down
+ * in tb_hotness[], shared by TBs whose guest PCs hash to the same slot.
+ */
+extern uint32_t tb_superblock_threshold;
+
+#define TB_HOTNESS_BITS 14
+#define TB_HOTNESS_SIZE (1 << TB_HOTNESS_BITS)
+
+extern int32_t tb_hotness[TB_HOTNESS_SIZE];
+
+static inline unsigned int tb_hotness_slot(vaddr pc)
+{
+    return (pc ^ (pc >> TB_HOTNESS_BITS)) & (TB_HOTNESS_SIZE - 1);
+}
+
+/*
+ * With -accel tcg,tb-profile=on, each TB counts its executions in a slot
+ * of tb_exec_count[] of its own.  Slots are handed out in translation
+ * order, and given back when the TB is evicted with its code region or
+ * by tb_flush; TBs translated while all are in use are not counted, but
+ * tb_ctx.tb_profile_missed is.  NULL when profiling is off.
+ */
+#define TB_PROFILE_SLOTS (1 << 18)
+
+extern uint64_t *tb_exec_count;
+
+void tb_profile_init(void);
+void tb_profile_reset(void);
+void tb_profile_slot_free(TranslationBlock *tb);
+
+void tb_reclaim(CPUState *cpu);
+
 /*
  * Return true if CS is not running in parallel with other cpus, either
  * because there are no other cpus or we are within an exclusive context.
@@ -72,6 +72,9 @@ G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUState *cpu, vaddr pc,
                               uint64_t cs_base, uint32_t flags,
                               int cflags);
+TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
+                                   uint64_t cs_base, uint32_t flags,
+                                   uint32_t cflags);
 void page_init(void);
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
@@ -80,6 +83,25 @@ bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
                                uintptr_t host_pc);
 
+#ifndef CONFIG_USER_ONLY
+/* Persistent translation cache, see tb-cache.c */
+extern bool tb_cache_enabled;
+void tb_cache_init(const char *path, unsigned max_cpus);
+void tb_cache_warm(CPUState *cpu);
+
+TranslationBlock *tb_gen_code_ahead(CPUState *cpu, vaddr pc,
+                                    uint64_t cs_base, uint32_t flags,
+                                    int cflags, tb_page_addr_t phys_pc,
+                                    void *host_pc);
+
+/* Translation workers, see tb-workers.c */
+extern bool tb_workers_enabled;
+void tb_workers_init(unsigned nr_workers);
+void tb_workers_queue(CPUState *cpu, const TranslationBlock *tb, int depth);
+void tb_workers_pause(void);
+void tb_workers_resume(void);
+#endif
+
 bool tcg_exec_realizefn(CPUState *cpu, Error **errp);
 void tcg_exec_unrealizefn(CPUState *cpu);
 
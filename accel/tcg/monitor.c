@@ -12,10 +12,13 @@
 #include "qapi/error.h"
 #include "qapi/type-helpers.h"
 #include "qapi/qapi-commands-machine.h"
+#include "qapi/qmp/qdict.h"
+#include "monitor/hmp.h"
 #include "monitor/monitor.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-timers.h"
 #include "sysemu/tcg.h"
+#include "qemu/timer.h"
 #include "tcg/tcg.h"
 #include "internal-common.h"
 #include "tb-context.h"
@@ -126,19 +129,63 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
-static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
+static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide,
+                             size_t *pmerge)
 {
     CPUState *cpu;
-    size_t full = 0, part = 0, elide = 0;
+    size_t full = 0, part = 0, elide = 0, merge = 0;
 
     CPU_FOREACH(cpu) {
         full += qatomic_read(&cpu->neg.tlb.c.full_flush_count);
         part += qatomic_read(&cpu->neg.tlb.c.part_flush_count);
         elide += qatomic_read(&cpu->neg.tlb.c.elide_flush_count);
+        merge += qatomic_read(&cpu->neg.tlb.c.merge_flush_count);
     }
     *pfull = full;
     *ppart = part;
     *pelide = elide;
+    *pmerge = merge;
+}
+
+static size_t tlb_large_page_fills(void)
+{
+    CPUState *cpu;
+    size_t fills = 0;
+
+    CPU_FOREACH(cpu) {
+        fills += qatomic_read(&cpu->neg.tlb.c.large_page_fill_count);
+    }
+    return fills;
+}
+
+static void tlb_context_counts(size_t *pswitch, size_t *prestore)
+{
+    CPUState *cpu;
+    size_t switches = 0, restores = 0;
+
+    CPU_FOREACH(cpu) {
+        switches += qatomic_read(&cpu->neg.tlb.c.ctx_switch_count);
+        restores += qatomic_read(&cpu->neg.tlb.c.ctx_restore_count);
+    }
+    *pswitch = switches;
+    *prestore = restores;
+}
+
+static void dump_exclusive_info(GString *buf)
+{
+    ExclusiveStats stats[EXCLUSIVE_CAUSE__MAX];
+
+    exclusive_get_stats(stats);
+    g_string_append_printf(buf, "\nExclusive sections:\n");
+    for (int i = 0; i < EXCLUSIVE_CAUSE__MAX; i++) {
+        g_string_append_printf(buf, "%-10s %" PRIu64 " (%" PRIu64
+                               " batched) wait %" PRIu64 " us"
+                               " run %" PRIu64 " us\n",
+                               exclusive_cause_name(i),
+                               stats[i].sections, stats[i].batched,
+                               stats[i].wait_ns / SCALE_US,
+                               stats[i].run_ns / SCALE_US);
+    }
 }
 
 static void tcg_dump_info(GString *buf)
@@ -150,7 +197,8 @@ static void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
-    size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t nb_tbs, flush_full, flush_part, flush_elide, flush_merge;
+    size_t ctx_switch, ctx_restore;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -192,10 +240,17 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
 
-    tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
+    tlb_flush_counts(&flush_full, &flush_part, &flush_elide, &flush_merge);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    g_string_append_printf(buf, "TLB merged flushes  %zu\n", flush_merge);
+    g_string_append_printf(buf, "TLB huge page fills %zu\n",
+                           tlb_large_page_fills());
+    tlb_context_counts(&ctx_switch, &ctx_restore);
+    g_string_append_printf(buf, "TLB ctx switches    %zu\n", ctx_switch);
+    g_string_append_printf(buf, "TLB ctx restores    %zu\n", ctx_restore);
+    dump_exclusive_info(buf);
     tcg_dump_info(buf);
 }
 
@@ -215,6 +270,204 @@ HumanReadableText *qmp_x_query_jit(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+/* TBs are binned by guest instruction count, in powers of two.  */
+#define TB_ICOUNT_BINS  16
+
+typedef struct TBProfileEntry {
+    vaddr pc;
+    tb_page_addr_t phys_pc;
+    uint16_t icount;
+    uint32_t host_size;
+    uint64_t count;
+} TBProfileEntry;
+
+struct tb_cache_stats {
+    size_t nb_tbs;
+    size_t host_size;
+    size_t icount;
+    size_t icount_bins[TB_ICOUNT_BINS];
+    GArray *hot;
+};
+
+static gboolean tb_cache_stats_iter(gpointer key, gpointer value,
+                                    gpointer data)
+{
+    const TranslationBlock *tb = value;
+    struct tb_cache_stats *tst = data;
+
+    if (tb_cflags(tb) & CF_INVALID) {
+        return false;
+    }
+    tst->nb_tbs++;
+    tst->host_size += tb->tc.size;
+    tst->icount += tb->icount;
+    if (tb->icount) {
+        tst->icount_bins[MIN(31 - clz32(tb->icount), TB_ICOUNT_BINS - 1)]++;
+    }
+    if (tb_exec_count && tb->profile_slot >= 0) {
+        TBProfileEntry e = {
+            .pc = tb->pc,
+            .phys_pc = tb_page_addr0(tb),
+            .icount = tb->icount,
+            .host_size = tb->tc.size,
+            .count = qatomic_read(&tb_exec_count[tb->profile_slot]),
+        };
+
+        if (e.count) {
+            g_array_append_val(tst->hot, e);
+        }
+    }
+    return false;
+}
+
+static gint tb_profile_cmp(gconstpointer a, gconstpointer b)
+{
+    const TBProfileEntry *ea = a;
+    const TBProfileEntry *eb = b;
+
+    return ea->count < eb->count ? 1 : ea->count > eb->count ? -1 : 0;
+}
+
+static void dump_code_regions(GString *buf)
+{
+    size_t n = tcg_region_usage(NULL, 0);
+    g_autofree TCGRegionUsage *usage = g_new(TCGRegionUsage, n);
+    size_t r, used = 0, size = 0, full = 0;
+
+    tcg_region_usage(usage, n);
+    for (r = 0; r < n; r++) {
+        used += usage[r].used;
+        size += usage[r].size;
+        if (usage[r].ctx < 0 && usage[r].used) {
+            full++;
+        }
+    }
+    g_string_append_printf(buf, "Code regions        %zu (%zu used up, "
+                           "%zu/%zu bytes)\n", n, full, used, size);
+    for (r = 0; r < n; r++) {
+        if (usage[r].ctx < 0) {
+            continue;
+        }
+        g_string_append_printf(buf, "  region %-4zu       %zu/%zu bytes "
+                               "(%zu%%), context %d\n", r,
+                               usage[r].used, usage[r].size,
+                               usage[r].size ?
+                               usage[r].used * 100 / usage[r].size : 0,
+                               usage[r].ctx);
+    }
+}
+
+static void dump_code_cache_info(GString *buf, int64_t top)
+{
+    struct tb_cache_stats tst = {};
+    int64_t flush_time = qatomic_read(&tb_ctx.tb_flush_time);
+    uint64_t gen_count = stat64_get(&tb_ctx.tb_gen_count);
+    size_t i;
+
+    tst.hot = g_array_new(false, false, sizeof(TBProfileEntry));
+    tcg_tb_foreach(tb_cache_stats_iter, &tst);
+
+    g_string_append_printf(buf, "Code cache:\n");
+    dump_code_regions(buf);
+    g_string_append_printf(buf, "TB count            %zu\n", tst.nb_tbs);
+    g_string_append_printf(buf, "TB host bytes/insn  %0.1f\n",
+                           tst.icount ?
+                           (double)tst.host_size / tst.icount : 0);
+    g_string_append_printf(buf, "TB size (insns)     TB count\n");
+    for (i = 0; i < TB_ICOUNT_BINS; i++) {
+        if (tst.icount_bins[i]) {
+            g_string_append_printf(buf, "  %5u-%-5u        %zu\n",
+                                   1u << i, (2u << i) - 1,
+                                   tst.icount_bins[i]);
+        }
+    }
+
+    g_string_append_printf(buf, "\nFlushes:\n");
+    g_string_append_printf(buf, "TB flush count      %u (%u when full)\n",
+                           qatomic_read(&tb_ctx.tb_flush_count),
+                           qatomic_read(&tb_ctx.tb_flush_full_count));
+    g_string_append_printf(buf, "region evictions    %u\n",
+                           qatomic_read(&tb_ctx.tb_evict_count));
+    if (flush_time) {
+        g_string_append_printf(buf, "last flush          %0.3f s ago\n",
+                               (get_clock_realtime() - flush_time) /
+                               (double)NANOSECONDS_PER_SECOND);
+    }
+    if (qatomic_read(&tb_ctx.tb_flush_interval)) {
+        g_string_append_printf(buf, "flush interval      %0.3f s\n",
+                               qatomic_read(&tb_ctx.tb_flush_interval) /
+                               (double)NANOSECONDS_PER_SECOND);
+    }
+
+    g_string_append_printf(buf, "\nTranslation:\n");
+    g_string_append_printf(buf, "TB translations     %" PRIu64 "\n",
+                           gen_count);
+    g_string_append_printf(buf, "TB avg gen time     %" PRIu64 " ns\n",
+                           gen_count ?
+                           stat64_get(&tb_ctx.tb_gen_time) / gen_count : 0);
+
+    g_string_append_printf(buf, "\nHottest TBs:\n");
+    if (!tb_exec_count) {
+        g_string_append_printf(buf, "[enable with -accel tcg,tb-profile=on]\n");
+    } else {
+        unsigned missed = qatomic_read(&tb_ctx.tb_profile_missed);
+
+        if (missed) {
+            g_string_append_printf(buf, "[%u TBs not counted, all %u slots "
+                                   "were in use]\n", missed,
+                                   TB_PROFILE_SLOTS);
+        }
+        g_array_sort(tst.hot, tb_profile_cmp);
+        g_string_append_printf(buf, "%-18s %-18s %6s %6s %s\n",
+                               "pc", "phys", "insns", "host", "count");
+        for (i = 0; i < MIN(tst.hot->len, top); i++) {
+            const TBProfileEntry *e = &g_array_index(tst.hot,
+                                                     TBProfileEntry, i);
+
+            g_string_append_printf(buf, "0x%016" VADDR_PRIx
+                                   " 0x%016" PRIx64 " %6u %6u %" PRIu64 "\n",
+                                   e->pc, (uint64_t)e->phys_pc, e->icount,
+                                   e->host_size, e->count);
+        }
+    }
+    g_array_free(tst.hot, true);
+}
+
+HumanReadableText *qmp_x_query_code_cache(bool has_top, int64_t top,
+                                          Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+
+    if (!tcg_enabled()) {
+        error_setg(errp,
+                   "Code cache information is only available with accel=tcg");
+        return NULL;
+    }
+    if (!has_top) {
+        top = 10;
+    } else if (top < 0) {
+        error_setg(errp, "Parameter 'top' must not be negative");
+        return NULL;
+    }
+
+    dump_code_cache_info(buf, top);
+
+    return human_readable_text_from_str(buf);
+}
+
+void hmp_info_code_cache(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+    g_autoptr(HumanReadableText) info = NULL;
+
+    info = qmp_x_query_code_cache(qdict_haskey(qdict, "top"),
+                                  qdict_get_try_int(qdict, "top", 10), &err);
+    if (hmp_handle_error(mon, err)) {
+        return;
+    }
+    monitor_puts(mon, info->human_readable_text);
+}
+
 static void tcg_dump_op_count(GString *buf)
 {
     g_string_append_printf(buf, "[TCG profiler not compiled]\n");
@@ -98,6 +98,16 @@ void HELPER(plugin_vcpu_mem_cb)(unsigned int vcpu_index,
                                 void *userdata)
 { }
 
+void HELPER(plugin_trace_flush)(void *buf)
+{
+    qemu_plugin_trace_flush(buf);
+}
+
+void HELPER(plugin_trace_append)(void *buf, uint64_t addr, uint32_t info)
+{
+    qemu_plugin_trace_append(buf, addr, info);
+}
+
 static void gen_empty_udata_cb(void)
 {
     TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
@@ -200,6 +210,80 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
     }
 }
 
+/*
+ * Trace buffers are filled by code generated directly at translation time,
+ * rather than through empty callbacks: whether to trace does not depend on
+ * what plugins ask for each TB, and enabling it flushes the code cache.
+ */
+static TCGv_ptr gen_plugin_trace_buf(void)
+{
+    TCGv_ptr buf = tcg_temp_ebb_new_ptr();
+
+    tcg_gen_ld_ptr(buf, tcg_env, offsetof(CPUState, plugin_trace) -
+                                 offsetof(ArchCPU, env));
+    return buf;
+}
+
+static void gen_plugin_trace_record(TCGv_ptr buf, TCGv_i64 addr,
+                                    uint32_t info)
+{
+    TCGv_ptr cur = tcg_temp_ebb_new_ptr();
+
+    tcg_gen_ld_ptr(cur, buf, offsetof(struct qemu_plugin_trace_buf, cur));
+    tcg_gen_st_i64(addr, cur, offsetof(struct qemu_plugin_trace_record, addr));
+    tcg_gen_st_i32(tcg_constant_i32(info), cur,
+                   offsetof(struct qemu_plugin_trace_record, info));
+    tcg_gen_addi_ptr(cur, cur, sizeof(struct qemu_plugin_trace_record));
+    tcg_gen_st_ptr(cur, buf, offsetof(struct qemu_plugin_trace_buf, cur));
+    tcg_temp_free_ptr(cur);
+}
+
+/*
+ * Make room for QEMU_PLUGIN_TRACE_SLACK records, then record the insn.
+ * Memory accesses beyond the slack go through a helper.
+ */
+static void plugin_gen_trace_insn(struct qemu_plugin_tb *ptb,
+                                  struct qemu_plugin_insn *pinsn)
+{
+    TCGv_ptr buf = gen_plugin_trace_buf();
+    TCGv_ptr cur = tcg_temp_ebb_new_ptr();
+    TCGv_ptr limit = tcg_temp_ebb_new_ptr();
+    TCGLabel *l = gen_new_label();
+
+    tcg_gen_ld_ptr(cur, buf, offsetof(struct qemu_plugin_trace_buf, cur));
+    tcg_gen_ld_ptr(limit, buf, offsetof(struct qemu_plugin_trace_buf, limit));
+    tcg_gen_brcond_ptr(TCG_COND_LEU, cur, limit, l);
+    tcg_temp_free_ptr(limit);
+    tcg_temp_free_ptr(cur);
+    gen_helper_plugin_trace_flush(buf);
+    tcg_temp_free_ptr(buf);
+    gen_set_label(l);
+
+    ptb->trace_inline = QEMU_PLUGIN_TRACE_SLACK;
+    if (!ptb->mem_only) {
+        /* the label ended the extended basic block, reload */
+        buf = gen_plugin_trace_buf();
+        gen_plugin_trace_record(buf, tcg_constant_i64(pinsn->vaddr),
+                                QEMU_PLUGIN_TRACE_INSN);
+        tcg_temp_free_ptr(buf);
+        ptb->trace_inline--;
+    }
+}
+
+static void plugin_gen_trace_mem(struct qemu_plugin_tb *ptb, TCGv_i64 addr,
+                                 uint32_t info)
+{
+    TCGv_ptr buf = gen_plugin_trace_buf();
+
+    if (ptb->trace_inline) {
+        gen_plugin_trace_record(buf, addr, info);
+        ptb->trace_inline--;
+    } else {
+        gen_helper_plugin_trace_append(buf, addr, tcg_constant_i32(info));
+    }
+    tcg_temp_free_ptr(buf);
+}
+
 void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info)
 {
     enum qemu_plugin_mem_rw rw = get_plugin_meminfo_rw(info);
@@ -211,6 +295,10 @@ void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info)
     gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE, rw);
     gen_empty_inline_cb();
     tcg_gen_plugin_cb_end();
+
+    if (tcg_ctx->plugin_tb->trace) {
+        plugin_gen_trace_mem(tcg_ctx->plugin_tb, addr, info);
+    }
 }
 
 static TCGOp *find_op(TCGOp *op, TCGOpcode opc)
@@ -796,7 +884,8 @@ bool plugin_gen_tb_start(CPUState *cpu, const DisasContextBase *db,
 {
     bool ret = false;
 
-    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask) ||
+        cpu->plugin_trace) {
         struct qemu_plugin_tb *ptb = tcg_ctx->plugin_tb;
         int i;
 
@@ -816,6 +905,7 @@ bool plugin_gen_tb_start(CPUState *cpu, const DisasContextBase *db,
         ptb->haddr2 = NULL;
         ptb->mem_only = mem_only;
         ptb->mem_helper = false;
+        ptb->trace = cpu->plugin_trace != NULL;
 
         plugin_gen_empty_callback(PLUGIN_GEN_FROM_TB);
     }
@@ -833,6 +923,9 @@ void plugin_gen_insn_start(CPUState *cpu, const DisasContextBase *db)
     pinsn = qemu_plugin_tb_insn_get(ptb, db->pc_next);
     tcg_ctx->plugin_insn = pinsn;
     plugin_gen_empty_callback(PLUGIN_GEN_FROM_INSN);
+    if (ptb->trace) {
+        plugin_gen_trace_insn(ptb, pinsn);
+    }
 
     /*
      * Detect page crossing to get the new host address.
@@ -1,4 +1,6 @@
 #ifdef CONFIG_PLUGIN
 DEF_HELPER_FLAGS_2(plugin_vcpu_udata_cb, TCG_CALL_NO_RWG | TCG_CALL_PLUGIN, void, i32, ptr)
 DEF_HELPER_FLAGS_4(plugin_vcpu_mem_cb, TCG_CALL_NO_RWG | TCG_CALL_PLUGIN, void, i32, i32, i64, ptr)
+DEF_HELPER_FLAGS_1(plugin_trace_flush, TCG_CALL_NO_RWG | TCG_CALL_PLUGIN, void, ptr)
+DEF_HELPER_FLAGS_3(plugin_trace_append, TCG_CALL_NO_RWG | TCG_CALL_PLUGIN, void, ptr, i64, i32)
 #endif
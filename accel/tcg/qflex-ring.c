@@ -0,0 +1,200 @@
+/*
+ * QFlex instruction-record rings
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/memalign.h"
+#include "qemu/memfd.h"
+#include "qemu/timer.h"
+#include "exec/memopidx.h"
+#include "exec/qflex-ring.h"
+
+/* How long a producer waits for room before dropping its record */
+#define QFLEX_RING_WAIT_NS  (10 * SCALE_MS)
+
+bool qflex_rings_enabled;
+
+static struct {
+    QFlexRingHeader *hdr;
+    size_t size;
+    int fd;
+    /* pc of the last instruction pushed by qflex_ring_push_trace() */
+    uint64_t *last_pc;
+} qflex_rings = { .fd = -1 };
+
+bool qflex_rings_init(int nr_vcpus, uint32_t nr_slots, Error **errp)
+{
+    QFlexRingHeader *hdr;
+    size_t offset, stride, size;
+    int i;
+
+    assert(!qflex_rings.hdr);
+
+    if (!is_power_of_2(nr_slots)) {
+        error_setg(errp, "QFlex ring size must be a power of two");
+        return false;
+    }
+
+    offset = ROUND_UP(sizeof(QFlexRingHeader), SPSC_RING_ALIGN);
+    stride = ROUND_UP(spsc_ring_size(nr_slots, sizeof(QFlexInsnRecord)),
+                      qemu_real_host_page_size());
+    size = offset + stride * nr_vcpus;
+
+    if (qemu_memfd_alloc_check()) {
+        hdr = qemu_memfd_alloc("qflex-rings", size, 0, &qflex_rings.fd, errp);
+        if (!hdr) {
+            return false;
+        }
+    } else {
+        hdr = qemu_memalign(qemu_real_host_page_size(), size);
+        memset(hdr, 0, size);
+        qflex_rings.fd = -1;
+    }
+
+    hdr->magic = QFLEX_RING_MAGIC;
+    hdr->version = QFLEX_RING_VERSION;
+    hdr->nr_rings = nr_vcpus;
+    hdr->nr_slots = nr_slots;
+    hdr->ring_offset = offset;
+    hdr->ring_stride = stride;
+
+    qflex_rings.hdr = hdr;
+    qflex_rings.size = size;
+    qflex_rings.last_pc = g_new0(uint64_t, nr_vcpus);
+
+    for (i = 0; i < nr_vcpus; i++) {
+        spsc_ring_init(qflex_ring_get(i), nr_slots, sizeof(QFlexInsnRecord));
+    }
+
+    qatomic_set_mb(&qflex_rings_enabled, true);
+    return true;
+}
+
+int qflex_rings_fd(void)
+{
+    return qflex_rings.fd;
+}
+
+size_t qflex_rings_size(void)
+{
+    return qflex_rings.size;
+}
+
+uint64_t qflex_rings_dropped(void)
+{
+    QFlexRingHeader *hdr = qflex_rings.hdr;
+
+    return hdr ? qatomic_read(&hdr->dropped) : 0;
+}
+
+SPSCRing *qflex_ring_get(int cpu_index)
+{
+    QFlexRingHeader *hdr = qflex_rings.hdr;
+
+    if (!hdr || cpu_index < 0 || cpu_index >= hdr->nr_rings) {
+        return NULL;
+    }
+    return (SPSCRing *)((uint8_t *)hdr + hdr->ring_offset +
+                        cpu_index * hdr->ring_stride);
+}
+
+QFlexInsnRecord *qflex_ring_reserve_slow(SPSCRing *ring)
+{
+    int64_t deadline = get_clock() + QFLEX_RING_WAIT_NS;
+    QFlexInsnRecord *rec;
+
+    /*
+     * The consumer may be another process that died or stalled, so don't
+     * hold the vCPU forever: functional emulation goes on and the timing
+     * model can tell from the drop count that its trace has holes.
+     */
+    while (!(rec = spsc_ring_reserve(ring))) {
+        if (get_clock() > deadline) {
+            qatomic_inc(&qflex_rings.hdr->dropped);
+            return NULL;
+        }
+        g_thread_yield();
+    }
+    return rec;
+}
+
+void qflex_ring_push_exception(int cpu_index, uint64_t pc, int excp)
+{
+    SPSCRing *ring = qflex_ring_get(cpu_index);
+    QFlexInsnRecord *rec;
+
+    if (!ring) {
+        return;
+    }
+    rec = qflex_ring_reserve(ring);
+    if (!rec) {
+        return;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    rec->pc = pc;
+    rec->flags = QFLEX_INSN_EXCP;
+    rec->excp = excp;
+    spsc_ring_commit(ring);
+}
+
+void qflex_ring_push_trace(unsigned int cpu_index,
+                           const struct qemu_plugin_trace_record *recs,
+                           size_t n, void *opaque)
+{
+    SPSCRing *ring = qflex_ring_get(cpu_index);
+    QFlexInsnRecord *rec = NULL;
+    uint64_t pc;
+    size_t i;
+
+    if (!ring) {
+        return;
+    }
+
+    /* The accesses of an instruction may start the next buffer */
+    pc = qflex_rings.last_pc[cpu_index];
+
+    for (i = 0; i < n; i++) {
+        const struct qemu_plugin_trace_record *t = &recs[i];
+        /* See make_plugin_meminfo() */
+        bool store = (t->info >> 16) & QEMU_PLUGIN_MEM_W;
+
+        if (t->info == QEMU_PLUGIN_TRACE_INSN) {
+            if (rec) {
+                spsc_ring_commit(ring);
+            }
+            pc = t->addr;
+            rec = qflex_ring_reserve(ring);
+            if (rec) {
+                memset(rec, 0, sizeof(*rec));
+                rec->pc = pc;
+            }
+            continue;
+        }
+
+        if (!rec || (rec->flags & (QFLEX_INSN_LOAD | QFLEX_INSN_STORE))) {
+            if (rec) {
+                spsc_ring_commit(ring);
+            }
+            rec = qflex_ring_reserve(ring);
+            if (!rec) {
+                continue;
+            }
+            memset(rec, 0, sizeof(*rec));
+            rec->pc = pc;
+            rec->flags = QFLEX_INSN_MORE;
+        }
+        rec->mem_vaddr = t->addr;
+        rec->mem_size = memop_size(get_memop(t->info));
+        rec->flags |= store ? QFLEX_INSN_STORE : QFLEX_INSN_LOAD;
+    }
+
+    if (rec) {
+        spsc_ring_commit(ring);
+    }
+    qflex_rings.last_pc[cpu_index] = pc;
+}
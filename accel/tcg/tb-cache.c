@@ -0,0 +1,247 @@
+/*
+ * Persistent translation cache
+ *
+ * At exit, remember every translation block of the run by guest
+ * physical address, CPU state flags and a checksum of the guest page it
+ * was translated from.  When a later run starts from the same memory
+ * contents, for instance by restoring the same checkpoint, each vCPU
+ * translates the blocks that match its state before it first executes
+ * guest code, instead of exiting to translate them one by one.
+ *
+ * Host code itself is not kept: it embeds absolute host addresses
+ * (helpers, TranslationBlock structures, CPU state objects) that differ
+ * from one process to the next and cannot be told apart from other
+ * constants for relocation.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/crc32c.h"
+#include "qemu/error-report.h"
+#include "qemu/notify.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "sysemu/sysemu.h"
+#include "tcg/tcg.h"
+#include "trace.h"
+#include "internal-common.h"
+#include "internal-target.h"
+
+#define TB_CACHE_MAGIC      "QEMUTBC"
+#define TB_CACHE_VERSION    1
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_bits;
+    uint64_t nr_entries;
+} TBCacheHeader;
+
+typedef struct TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t phys_pc;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t crc;           /* crc32c of the guest page at phys_pc */
+    uint32_t pad;
+} TBCacheEntry;
+
+bool tb_cache_enabled;
+
+static struct {
+    char *path;
+    TBCacheEntry *entries;
+    size_t nr_entries;
+    unsigned long *warmed;  /* by cpu_index */
+    Notifier exit;
+} tb_cache;
+
+/* Return the checksum of guest page @page, computing it once.  */
+static uint32_t tb_cache_page_crc(GHashTable *crcs, ram_addr_t page)
+{
+    gpointer key = GSIZE_TO_POINTER(page >> TARGET_PAGE_BITS);
+    gpointer crc;
+
+    if (!g_hash_table_lookup_extended(crcs, key, NULL, &crc)) {
+        crc = GUINT_TO_POINTER(crc32c(0xffffffff,
+                                      qemu_map_ram_ptr(NULL, page),
+                                      TARGET_PAGE_SIZE));
+        g_hash_table_insert(crcs, key, crc);
+    }
+    return GPOINTER_TO_UINT(crc);
+}
+
+/*
+ * Blocks that can be translated again from their first page alone, by
+ * a vCPU whose state matches their flags.
+ */
+static bool tb_cache_eligible(const TranslationBlock *tb)
+{
+    return tb_page_addr0(tb) != -1
+        && tb_page_addr1(tb) == -1
+        && !(tb_cflags(tb) & (CF_INVALID | CF_NOIRQ | CF_SINGLE_STEP |
+                              CF_COUNT_MASK));
+}
+
+typedef struct TBCacheSave {
+    GArray *entries;
+    GHashTable *crcs;
+} TBCacheSave;
+
+static gboolean tb_cache_collect(gpointer key, gpointer value, gpointer data)
+{
+    const TranslationBlock *tb = value;
+    TBCacheSave *save = data;
+    TBCacheEntry e = { 0 };
+
+    if (tb_cache_eligible(tb)) {
+        e.pc = tb->pc;
+        e.cs_base = tb->cs_base;
+        e.phys_pc = tb_page_addr0(tb);
+        e.flags = tb->flags;
+        e.cflags = tb_cflags(tb);
+        e.crc = tb_cache_page_crc(save->crcs, e.phys_pc & TARGET_PAGE_MASK);
+        g_array_append_val(save->entries, e);
+    }
+    return FALSE;
+}
+
+static void tb_cache_save(Notifier *n, void *data)
+{
+    TBCacheSave save;
+    TBCacheHeader hdr = { .magic = TB_CACHE_MAGIC };
+    g_autoptr(GError) err = NULL;
+    g_autofree char *buf = NULL;
+    size_t size;
+
+    save.entries = g_array_new(false, false, sizeof(TBCacheEntry));
+    save.crcs = g_hash_table_new(NULL, NULL);
+    tcg_tb_foreach(tb_cache_collect, &save);
+
+    hdr.version = TB_CACHE_VERSION;
+    hdr.page_bits = TARGET_PAGE_BITS;
+    hdr.nr_entries = save.entries->len;
+
+    size = sizeof(hdr) + save.entries->len * sizeof(TBCacheEntry);
+    buf = g_malloc(size);
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), save.entries->data,
+           save.entries->len * sizeof(TBCacheEntry));
+
+    if (!g_file_set_contents(tb_cache.path, buf, size, &err)) {
+        warn_report("tb-cache: cannot save %s: %s",
+                    tb_cache.path, err->message);
+    }
+
+    g_array_free(save.entries, true);
+    g_hash_table_destroy(save.crcs);
+}
+
+static void tb_cache_load(void)
+{
+    g_autoptr(GError) err = NULL;
+    g_autofree char *buf = NULL;
+    const TBCacheHeader *hdr;
+    gsize size;
+
+    if (!g_file_get_contents(tb_cache.path, &buf, &size, &err)) {
+        if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            warn_report("tb-cache: cannot load %s: %s",
+                        tb_cache.path, err->message);
+        }
+        return;
+    }
+
+    hdr = (const TBCacheHeader *)buf;
+    if (size < sizeof(*hdr)
+        || memcmp(hdr->magic, TB_CACHE_MAGIC, sizeof(hdr->magic))
+        || hdr->version != TB_CACHE_VERSION
+        || hdr->page_bits != TARGET_PAGE_BITS
+        || hdr->nr_entries != (size - sizeof(*hdr)) / sizeof(TBCacheEntry)) {
+        warn_report("tb-cache: %s is not a translation cache for this "
+                    "target, ignoring it", tb_cache.path);
+        return;
+    }
+
+    tb_cache.nr_entries = hdr->nr_entries;
+    tb_cache.entries = g_memdup2(buf + sizeof(*hdr),
+                                 hdr->nr_entries * sizeof(TBCacheEntry));
+    tb_cache_enabled = tb_cache.nr_entries != 0;
+}
+
+void tb_cache_init(const char *path, unsigned max_cpus)
+{
+    tb_cache.path = g_strdup(path);
+    tb_cache.warmed = bitmap_new(max_cpus);
+    tb_cache_load();
+
+    tb_cache.exit.notify = tb_cache_save;
+    qemu_add_exit_notifier(&tb_cache.exit);
+}
+
+/*
+ * Called by each vCPU when it enters the execution loop.  The first time,
+ * translate the cached blocks that were translated for the same CPU state
+ * from a guest page that still has the same contents.
+ */
+void tb_cache_warm(CPUState *cpu)
+{
+    CPUArchState *env = cpu_env(cpu);
+    GHashTable *crcs;
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags, cflags;
+    size_t i, n = 0;
+    int mmu_idx;
+
+    if (test_bit(cpu->cpu_index, tb_cache.warmed)) {
+        return;
+    }
+    /*
+     * Set first: tb_gen_code may leave through cpu_loop_exit when the
+     * code buffer fills up, and the rest is then left to run time.
+     */
+    set_bit_atomic(cpu->cpu_index, tb_cache.warmed);
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    cflags = curr_cflags(cpu);
+    mmu_idx = cpu_mmu_index(env, true);
+    crcs = g_hash_table_new(NULL, NULL);
+
+    for (i = 0; i < tb_cache.nr_entries; i++) {
+        const TBCacheEntry *e = &tb_cache.entries[i];
+        CPUTLBEntryFull *full;
+        void *host;
+
+        if (e->flags != flags || e->cs_base != cs_base
+            || (e->cflags & ~CF_SUPERBLOCK) != cflags
+            || ((e->cflags & CF_SUPERBLOCK) && !tb_superblock_threshold)) {
+            continue;
+        }
+
+        /* The guest must still map the block, to the same page. */
+        if (probe_access_full(env, e->pc, 1, MMU_INST_FETCH, mmu_idx,
+                              true, &host, &full, 0) & TLB_INVALID_MASK
+            || host == NULL
+            || full->lg_page_size < TARGET_PAGE_BITS
+            || qemu_ram_addr_from_host(host) != e->phys_pc) {
+            continue;
+        }
+        if (tb_cache_page_crc(crcs, e->phys_pc & TARGET_PAGE_MASK) != e->crc
+            || tb_htable_lookup(cpu, e->pc, cs_base, flags, e->cflags)) {
+            continue;
+        }
+
+        mmap_lock();
+        tb_gen_code(cpu, e->pc, cs_base, flags, e->cflags);
+        mmap_unlock();
+        n++;
+    }
+
+    g_hash_table_destroy(crcs);
+    trace_tb_cache_warm(cpu->cpu_index, n, tb_cache.nr_entries);
+}
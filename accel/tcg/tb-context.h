@@ -22,6 +22,7 @@
 
 #include "qemu/thread.h"
 #include "qemu/qht.h"
+#include "qemu/stats64.h"
 
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
@@ -34,7 +35,17 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_flush_full_count;   /* ... because the code buffer was full */
+    int64_t tb_flush_time;          /* get_clock_realtime() of the last one */
+    int64_t tb_flush_interval;      /* ... and time since the one before */
+    unsigned tb_evict_count;        /* code regions evicted */
     unsigned tb_phys_invalidate_count;
+    Stat64 tb_gen_count;            /* calls to tb_gen_code */
+    Stat64 tb_gen_time;             /* ... and host ns spent in them */
+
+    /* slots of tb_exec_count[] handed out, some may be free again */
+    unsigned tb_profile_slots;
+    unsigned tb_profile_missed;     /* TBs translated without a slot */
 };
 
 extern TBContext tb_ctx;
@@ -20,6 +20,7 @@
 #include "qemu/osdep.h"
 #include "qemu/interval-tree.h"
 #include "qemu/qtree.h"
+#include "qemu/timer.h"
 #include "exec/cputlb.h"
 #include "exec/log.h"
 #include "exec/exec-all.h"
@@ -50,7 +51,8 @@ static bool tb_cmp(const void *ap, const void *bp)
     return (a->pc == b->pc &&
             a->cs_base == b->cs_base &&
             a->flags == b->flags &&
-            (tb_cflags(a) & ~CF_INVALID) == (tb_cflags(b) & ~CF_INVALID) &&
+            (tb_cflags_key(a) & ~CF_INVALID) ==
+            (tb_cflags_key(b) & ~CF_INVALID) &&
             tb_page_addr0(a) == tb_page_addr0(b) &&
             tb_page_addr1(a) == tb_page_addr1(b));
 }
@@ -754,10 +756,21 @@ static void tb_remove(TranslationBlock *tb)
 }
 #endif /* CONFIG_USER_ONLY */
 
+/* Set by do_tb_reclaim() for the flush it falls back to.  */
+static bool tb_flush_full_pending;
+
+/*
+ * Set by do_tb_reclaim() while it evicts a region.  The jump and branch
+ * caches of every vCPU are flushed afterwards, rather than cleared of
+ * each TB.
+ */
+static bool tb_evicting;
+
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
     bool did_flush = false;
+    int64_t now;
 
     mmap_lock();
     /* If it is already been done on request of another CPU, just retry. */
@@ -765,6 +778,11 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
         goto done;
     }
     did_flush = true;
+#ifndef CONFIG_USER_ONLY
+    if (tb_workers_enabled) {
+        tb_workers_pause();
+    }
+#endif
 
     CPU_FOREACH(cpu) {
         tcg_flush_jmp_cache(cpu);
@@ -777,6 +795,23 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     /* XXX: flush processor icache at this point if cache flush is expensive */
     qatomic_inc(&tb_ctx.tb_flush_count);
 
+    if (qatomic_xchg(&tb_flush_full_pending, false)) {
+        qatomic_inc(&tb_ctx.tb_flush_full_count);
+    }
+    now = get_clock_realtime();
+    if (tb_ctx.tb_flush_time) {
+        tb_ctx.tb_flush_interval = now - tb_ctx.tb_flush_time;
+    }
+    tb_ctx.tb_flush_time = now;
+    if (tb_exec_count) {
+        tb_profile_reset();
+    }
+#ifndef CONFIG_USER_ONLY
+    if (tb_workers_enabled) {
+        tb_workers_resume();
+    }
+#endif
+
 done:
     mmap_unlock();
     if (did_flush) {
@@ -792,9 +827,82 @@ void tb_flush(CPUState *cpu)
         if (cpu_in_serial_context(cpu)) {
             do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
         } else {
-            async_safe_run_on_cpu(cpu, do_tb_flush,
-                                  RUN_ON_CPU_HOST_INT(tb_flush_count));
+            async_safe_run_on_cpu_for(cpu, EXCLUSIVE_CAUSE_TB_FLUSH,
+                                      do_tb_flush,
+                                      RUN_ON_CPU_HOST_INT(tb_flush_count));
+        }
+    }
+}
+
+static unsigned tb_reclaim_count(void)
+{
+    return qatomic_read(&tb_ctx.tb_flush_count) +
+           qatomic_read(&tb_ctx.tb_evict_count);
+}
+
+static void tb_evict_invalidate(TranslationBlock *tb)
+{
+    if (!(tb_cflags(tb) & CF_INVALID)) {
+        tb_phys_invalidate(tb, -1);
+    }
+    tb_profile_slot_free(tb);
+}
+
+/*
+ * Evict the oldest region of the code buffer, with its TBs, or flush
+ * everything if every region is in use by a TCG context.
+ */
+static void do_tb_reclaim(CPUState *cpu, run_on_cpu_data reclaim_count)
+{
+    CPUState *other;
+    bool evicted;
+
+    mmap_lock();
+    /* If it is already been done on request of another CPU, just retry. */
+    if (tb_reclaim_count() != reclaim_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+#ifndef CONFIG_USER_ONLY
+    if (tb_workers_enabled) {
+        tb_workers_pause();
+    }
+#endif
+
+    tb_evicting = true;
+    evicted = tcg_region_evict(tb_evict_invalidate);
+    tb_evicting = false;
+    if (evicted) {
+        /* Drop the entries of the evicted TBs.  */
+        CPU_FOREACH(other) {
+            tcg_flush_jmp_cache(other);
         }
+        qatomic_inc(&tb_ctx.tb_evict_count);
+    }
+
+#ifndef CONFIG_USER_ONLY
+    if (tb_workers_enabled) {
+        tb_workers_resume();
+    }
+#endif
+    mmap_unlock();
+
+    if (!evicted) {
+        qatomic_set(&tb_flush_full_pending, true);
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_ctx.tb_flush_count));
+    }
+}
+
+/* Make room in the code buffer, once it is full.  */
+void tb_reclaim(CPUState *cpu)
+{
+    unsigned count = tb_reclaim_count();
+
+    if (cpu_in_serial_context(cpu)) {
+        do_tb_reclaim(cpu, RUN_ON_CPU_HOST_INT(count));
+    } else {
+        async_safe_run_on_cpu_for(cpu, EXCLUSIVE_CAUSE_TB_FLUSH, do_tb_reclaim,
+                                  RUN_ON_CPU_HOST_INT(count));
     }
 }
 
@@ -896,6 +1004,38 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
     }
 }
 
+/*
+ * Unlike the jump cache, the branch cache is not indexed by the pc of the
+ * target, so clear the entries recorded in @tb by tb_branch_cache_set.
+ * Only if there were too many, look through all of it.
+ */
+static void tb_branch_cache_inval_tb(TranslationBlock *tb)
+{
+    CPUState *cpu;
+
+    qemu_spin_lock(&tb->jmp_lock);
+    if (unlikely(tb->bc_overflow)) {
+        CPU_FOREACH(cpu) {
+            CPUBranchCache *bc = &cpu->neg.bc;
+
+            for (int i = 0; i < ARRAY_SIZE(bc->entry); i++) {
+                if (qatomic_read(&bc->entry[i].tb) == tb) {
+                    qatomic_set(&bc->entry[i].site, NULL);
+                }
+            }
+        }
+    } else {
+        for (int i = 0; i < TB_BC_REFS; i++) {
+            CPUBranchCacheEntry *e = tb->bc_refs[i];
+
+            if (e && qatomic_read(&e->tb) == tb) {
+                qatomic_set(&e->site, NULL);
+            }
+        }
+    }
+    qemu_spin_unlock(&tb->jmp_lock);
+}
+
 /*
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
@@ -928,7 +1068,10 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    if (!tb_evicting) {
+        tb_jmp_cache_inval_tb(tb);
+        tb_branch_cache_inval_tb(tb);
+    }
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
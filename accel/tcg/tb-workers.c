@@ -0,0 +1,241 @@
+/*
+ * Translation workers
+ *
+ * When a vCPU translates a block, the targets of its direct jumps that
+ * stay on the same guest page, typically the taken branch and the
+ * fall-through, are likely to run next.  Worker threads translate them
+ * ahead of time on otherwise idle host cores and insert them into the
+ * TB hash table, so that the vCPU finds them there rather than stopping
+ * to translate them itself.  The blocks translated ahead queue their own
+ * successors in turn, up to TB_WORKERS_DEPTH jumps away from a block the
+ * vCPU actually ran.
+ *
+ * A worker has its own TCG context and code region, and uses the CPU of
+ * the block only for its static translation state: it reads guest code
+ * through the physical address of the block, since the soft TLB belongs
+ * to the vCPU thread.  Blocks that continue onto the next guest page are
+ * given up and left to be translated on demand.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "tcg/startup.h"
+#include "tcg/tcg.h"
+#include "trace.h"
+#include "tb-hash.h"
+#include "tb-context.h"
+#include "internal-common.h"
+#include "internal-target.h"
+
+#define TB_WORKERS_QUEUE    256
+#define TB_WORKERS_DEPTH    2
+
+typedef struct TBWorkItem {
+    CPUState *cpu;
+    vaddr pc;
+    uint64_t cs_base;
+    tb_page_addr_t phys_pc;
+    uint32_t flags;
+    uint32_t cflags;
+    int depth;
+} TBWorkItem;
+
+typedef struct TBWorker {
+    QemuThread thread;
+    QemuMutex busy;         /* held while translating */
+} TBWorker;
+
+bool tb_workers_enabled;
+
+static struct {
+    QemuMutex lock;         /* protects the fields below */
+    QemuCond cond;
+    TBWorkItem queue[TB_WORKERS_QUEUE];
+    unsigned head;
+    unsigned len;
+    bool started;
+    unsigned nr_workers;
+    TBWorker *workers;
+} tb_workers;
+
+static bool tb_workers_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const TBWorkItem *item = d;
+
+    return tb->pc == item->pc &&
+           tb_page_addr0(tb) == item->phys_pc &&
+           tb->cs_base == item->cs_base &&
+           tb->flags == item->flags &&
+           tb_cflags_key(tb) == item->cflags;
+}
+
+static void tb_workers_translate(TBWorkItem *item)
+{
+    TranslationBlock *tb;
+    uint32_t h;
+
+    /*
+     * Unlike tb_htable_lookup, a block spanning two pages matches on its
+     * first page alone: either way the vCPU has no use for another one.
+     */
+    h = tb_hash_func(item->phys_pc, item->pc,
+                     item->flags, item->cs_base, item->cflags);
+    if (qht_lookup_custom(&tb_ctx.htable, item, h, tb_workers_cmp)) {
+        return;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        mmap_lock();
+        tb = tb_gen_code_ahead(item->cpu, item->pc, item->cs_base,
+                               item->flags, item->cflags, item->phys_pc,
+                               qemu_map_ram_ptr(NULL, item->phys_pc));
+        mmap_unlock();
+    }
+    trace_tb_workers_translate(item->cpu->cpu_index, item->pc,
+                               item->depth, tb != NULL);
+
+    if (tb && item->depth < TB_WORKERS_DEPTH) {
+        tb_workers_queue(item->cpu, tb, item->depth + 1);
+    }
+}
+
+static void *tb_worker_thread(void *opaque)
+{
+    TBWorker *w = opaque;
+    TBWorkItem item;
+
+    rcu_register_thread();
+    /* Not while tb_flush resets the code regions of every context.  */
+    qemu_mutex_lock(&w->busy);
+    tcg_register_thread();
+    qemu_mutex_unlock(&w->busy);
+
+    for (;;) {
+        qemu_mutex_lock(&tb_workers.lock);
+        while (tb_workers.len == 0) {
+            qemu_cond_wait(&tb_workers.cond, &tb_workers.lock);
+        }
+        item = tb_workers.queue[tb_workers.head];
+        tb_workers.head = (tb_workers.head + 1) % TB_WORKERS_QUEUE;
+        tb_workers.len--;
+        qemu_mutex_unlock(&tb_workers.lock);
+
+        qemu_mutex_lock(&w->busy);
+        tb_workers_translate(&item);
+        qemu_mutex_unlock(&w->busy);
+    }
+    return NULL;
+}
+
+/*
+ * The workers copy the TCG globals of the target when they register
+ * their TCG context, so they are started once a vCPU has translated its
+ * first block rather than with the accelerator.
+ */
+static void tb_workers_start(void)
+{
+    unsigned i;
+
+    for (i = 0; i < tb_workers.nr_workers; i++) {
+        TBWorker *w = &tb_workers.workers[i];
+        g_autofree char *name = g_strdup_printf("TCG worker %u", i);
+
+        qemu_thread_create(&w->thread, name, tb_worker_thread, w,
+                           QEMU_THREAD_DETACHED);
+    }
+    tb_workers.started = true;
+}
+
+void tb_workers_init(unsigned nr_workers)
+{
+    unsigned i;
+
+    qemu_mutex_init(&tb_workers.lock);
+    qemu_cond_init(&tb_workers.cond);
+    tb_workers.nr_workers = nr_workers;
+    tb_workers.workers = g_new0(TBWorker, nr_workers);
+    for (i = 0; i < nr_workers; i++) {
+        qemu_mutex_init(&tb_workers.workers[i].busy);
+    }
+    tb_workers_enabled = true;
+}
+
+/*
+ * Queue the successors of @tb, just translated for @cpu, to be translated
+ * ahead for the same CPU state.  When the queue is full, they are dropped.
+ */
+void tb_workers_queue(CPUState *cpu, const TranslationBlock *tb, int depth)
+{
+    uint32_t cflags = tb_cflags_key(tb);
+    int i;
+
+    if (tb_page_addr0(tb) == -1 ||
+        (cflags & (CF_INVALID | CF_NOIRQ | CF_SINGLE_STEP | CF_COUNT_MASK))) {
+        return;
+    }
+#ifdef CONFIG_PLUGIN
+    /* Translation callbacks expect to run on the vCPU thread.  */
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask) ||
+        cpu->plugin_trace) {
+        return;
+    }
+#endif
+
+    qemu_mutex_lock(&tb_workers.lock);
+    if (unlikely(!tb_workers.started)) {
+        tb_workers_start();
+    }
+    for (i = 0; i < ARRAY_SIZE(tb->succ_pc); i++) {
+        TBWorkItem *item;
+
+        if (tb->succ_pc[i] == -1 || tb_workers.len == TB_WORKERS_QUEUE) {
+            continue;
+        }
+        item = &tb_workers.queue[(tb_workers.head + tb_workers.len++) %
+                                 TB_WORKERS_QUEUE];
+        item->cpu = cpu;
+        item->pc = tb->succ_pc[i];
+        item->cs_base = tb->cs_base;
+        item->phys_pc = (tb_page_addr0(tb) & TARGET_PAGE_MASK) |
+                        (tb->succ_pc[i] & ~TARGET_PAGE_MASK);
+        item->flags = tb->flags;
+        item->cflags = cflags;
+        item->depth = depth;
+    }
+    qemu_cond_broadcast(&tb_workers.cond);
+    qemu_mutex_unlock(&tb_workers.lock);
+}
+
+/*
+ * Wait for the translations in progress and drop the queue, before the
+ * code buffer is flushed.  Every worker is then kept out of its TCG
+ * context until tb_workers_resume().  A worker queues the successors of
+ * a block with its busy lock held, so take those first.
+ */
+void tb_workers_pause(void)
+{
+    unsigned i;
+
+    for (i = 0; i < tb_workers.nr_workers; i++) {
+        qemu_mutex_lock(&tb_workers.workers[i].busy);
+    }
+    qemu_mutex_lock(&tb_workers.lock);
+    tb_workers.len = 0;
+    qemu_mutex_unlock(&tb_workers.lock);
+}
+
+void tb_workers_resume(void)
+{
+    unsigned i;
+
+    for (i = 0; i < tb_workers.nr_workers; i++) {
+        qemu_mutex_unlock(&tb_workers.workers[i].busy);
+    }
+}
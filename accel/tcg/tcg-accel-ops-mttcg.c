@@ -27,6 +27,7 @@
 #include "sysemu/tcg.h"
 #include "sysemu/replay.h"
 #include "sysemu/cpu-timers.h"
+#include "sysemu/cpus.h"
 #include "qemu/main-loop.h"
 #include "qemu/notify.h"
 #include "qemu/guest-random.h"
@@ -36,6 +37,11 @@
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-mttcg.h"
 
+#ifdef CONFIG_LIBQFLEX
+#include "middleware/libqflex/libqflex-module.h"
+#include "middleware/libqflex/libqflex.h"
+#endif
+
 typedef struct MttcgForceRcuNotifier {
     Notifier notifier;
     CPUState *cpu;
@@ -56,6 +62,272 @@ static void mttcg_force_rcu(Notifier *notify, void *data)
     async_run_on_cpu(cpu, do_nothing, RUN_ON_CPU_NULL);
 }
 
+#ifdef CONFIG_LIBQFLEX
+/*
+ * QFlex timing mode
+ *
+ * Rather than free-running, each vCPU thread waits for the timing model
+ * to open a cycle window, steps its own vCPU for the budget it was given
+ * and reports back, so that functional emulation of all vCPUs proceeds
+ * in parallel.  Windows are numbered; a thread takes part in every
+ * window opened after it joined.  The timing model runs on a separate
+ * driver thread and is the only one opening windows.
+ *
+ * Between windows a thread sleeps on its halt_cond, like any idle vCPU
+ * thread, so that kicks, queued work and stop requests are seen to
+ * while the timing model is busy.  A window is opened with the
+ * iothread lock held, and its opening wakes them up in the same way.
+ */
+static struct {
+    QemuMutex lock;
+    QemuCond done_cond;     /* a thread joined or finished its slot */
+    QFlexWindowSlot *slots;
+    uint32_t stop_mask;
+    uint64_t generation;    /* written with the iothread lock held too */
+    int nr_vcpus;           /* threads taking part in windows */
+    int pending;            /* threads still busy in the current window */
+} qflex_window;
+
+static void *mttcg_qflex_driver_fn(void *arg)
+{
+    int nr_cpus = GPOINTER_TO_INT(arg);
+
+    rcu_register_thread();
+
+    /* Only open the first window once every vCPU thread has joined */
+    qemu_mutex_lock(&qflex_window.lock);
+    while (qflex_window.nr_vcpus < nr_cpus) {
+        qemu_cond_wait(&qflex_window.done_cond, &qflex_window.lock);
+    }
+    qemu_mutex_unlock(&qflex_window.lock);
+
+    qemu_mutex_lock_iothread();
+    flexus_api.start(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    qemu_mutex_unlock_iothread();
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* Called with the iothread lock held by every vCPU thread */
+static void mttcg_qflex_start_driver(void)
+{
+    static QemuThread driver_thread;
+    static bool started;
+    CPUState *cpu;
+    int nr_cpus = 0;
+
+    if (started) {
+        return;
+    }
+    started = true;
+
+    qemu_mutex_init(&qflex_window.lock);
+    qemu_cond_init(&qflex_window.done_cond);
+
+    CPU_FOREACH(cpu) {
+        nr_cpus++;
+    }
+
+    qemu_thread_create(&driver_thread, "QFlex/timing",
+                       mttcg_qflex_driver_fn, GINT_TO_POINTER(nr_cpus),
+                       QEMU_THREAD_DETACHED);
+}
+
+/*
+ * Every step ends with EXCP_DEBUG, as we single-step the vCPU.  Tell the
+ * end of a QFlex step apart from a stop gdb asked for: a watchpoint, one
+ * of its breakpoints, or a single-step of its own, which replaces ours.
+ */
+static bool mttcg_qflex_debug_stop(CPUState *cpu, vaddr pc)
+{
+    return !(cpu->singlestep_enabled & SSTEP_QFLEX) ||
+           cpu->watchpoint_hit ||
+           cpu_breakpoint_test(cpu, pc, BP_GDB);
+}
+
+static uint64_t mttcg_qflex_step(CPUState *cpu, QFlexWindowSlot *slot,
+                                 uint32_t stop_mask)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    uint64_t i = 0;
+
+    /* A halted vCPU idles until the next window rather than spin */
+    stop_mask |= QFLEX_STEP_EV_EXIT | QFLEX_STEP_EV_STOP |
+                 QFLEX_STEP_EV_DEBUG | QFLEX_STEP_EV_HALT;
+
+    while (i < slot->budget) {
+        QFlexStepEvent *e = &slot->ev[i++];
+        int r;
+
+        /*
+         * Stop requests end the window here too, as they kick the vCPU;
+         * cpu_can_run() is checked under the iothread lock beforehand.
+         */
+        if (!cpu_work_list_empty(cpu) || qatomic_read(&cpu->exit_request)) {
+            e->pc = cc->get_pc(cpu);
+            e->excp = EXCP_QFLEX_IDLE;
+            e->flags = QFLEX_STEP_EV_EXIT;
+            break;
+        }
+
+        r = tcg_cpus_exec(cpu);
+        e->pc = cc->get_pc(cpu);
+        if (r == EXCP_ATOMIC) {
+            cpu_exec_step_atomic(cpu);
+            e->pc = cc->get_pc(cpu);
+        } else if (r == EXCP_DEBUG) {
+            if (mttcg_qflex_debug_stop(cpu, e->pc)) {
+                qemu_mutex_lock_iothread();
+                cpu_handle_guest_debug(cpu);
+                qemu_mutex_unlock_iothread();
+            } else {
+                /*
+                 * The end of the step: report it as an expired one
+                 * instruction budget, like libqflex_step() under icount.
+                 */
+                r = EXCP_INTERRUPT;
+            }
+        }
+
+        e->excp = r;
+        e->flags = tcg_cpus_step_events(cpu, r);
+
+        if (e->flags & stop_mask) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/*
+ * Report a window the vCPU cannot take part in, as a single event.
+ * Called with the iothread lock held.
+ */
+static uint64_t mttcg_qflex_skip(CPUState *cpu, QFlexWindowSlot *slot)
+{
+    QFlexStepEvent *e = &slot->ev[0];
+
+    if (slot->budget == 0) {
+        return 0;
+    }
+
+    e->pc = CPU_GET_CLASS(cpu)->get_pc(cpu);
+    if (cpu->stop) {
+        e->excp = cpu->unplug ? EXCP_QFLEX_UNPLUG : EXCP_QFLEX_STOP;
+        e->flags = QFLEX_STEP_EV_STOP;
+    } else if (cpu_can_run(cpu)) {
+        e->excp = EXCP_HALTED;
+        e->flags = tcg_cpus_step_events(cpu, EXCP_HALTED);
+    } else {
+        e->excp = EXCP_QFLEX_UNKNOWN;
+        e->flags = QFLEX_STEP_EV_STOP;
+    }
+    return 1;
+}
+
+/* Has a window been opened since @seen?  Called with the iothread lock held */
+static bool mttcg_qflex_window_opened(uint64_t seen)
+{
+    bool opened;
+
+    qemu_mutex_lock(&qflex_window.lock);
+    opened = qflex_window.generation != seen;
+    qemu_mutex_unlock(&qflex_window.lock);
+    return opened;
+}
+
+/*
+ * Timing mode body of a vCPU thread, entered with the iothread lock held.
+ * Returns once the vCPU has been unplugged.
+ */
+static void mttcg_qflex_vcpu_loop(CPUState *cpu)
+{
+    uint64_t seen;
+    bool unplugged = false;
+
+    mttcg_qflex_start_driver();
+
+    /* Make every cpu_exec() return after a single instruction */
+    cpu_single_step(cpu, SSTEP_ENABLE | SSTEP_QFLEX);
+
+    qemu_mutex_lock(&qflex_window.lock);
+    seen = qflex_window.generation;
+    qflex_window.nr_vcpus++;
+    qemu_cond_broadcast(&qflex_window.done_cond);
+    qemu_mutex_unlock(&qflex_window.lock);
+
+    while (!unplugged) {
+        QFlexWindowSlot *slot;
+        uint32_t stop_mask;
+
+        qemu_wait_io_event_common(cpu);
+        while (!mttcg_qflex_window_opened(seen)) {
+            qemu_cond_wait_iothread(cpu->halt_cond);
+            qemu_wait_io_event_common(cpu);
+        }
+
+        qemu_mutex_lock(&qflex_window.lock);
+        seen = qflex_window.generation;
+        slot = &qflex_window.slots[cpu->cpu_index];
+        stop_mask = qflex_window.stop_mask;
+        qemu_mutex_unlock(&qflex_window.lock);
+
+        if (!cpu->singlestep_enabled) {
+            /* gdb turns single-stepping off when it stops the guest */
+            cpu_single_step(cpu, SSTEP_ENABLE | SSTEP_QFLEX);
+        }
+
+        if (cpu_can_run(cpu) && !cpu_thread_is_idle(cpu)) {
+            qemu_mutex_unlock_iothread();
+            slot->done = mttcg_qflex_step(cpu, slot, stop_mask);
+            qemu_mutex_lock_iothread();
+            qatomic_set_mb(&cpu->exit_request, 0);
+        } else {
+            slot->done = mttcg_qflex_skip(cpu, slot);
+        }
+        unplugged = cpu->unplug && !cpu_can_run(cpu);
+
+        qemu_mutex_lock(&qflex_window.lock);
+        if (unplugged) {
+            qflex_window.nr_vcpus--;
+        }
+        if (--qflex_window.pending == 0) {
+            qemu_cond_broadcast(&qflex_window.done_cond);
+        }
+        qemu_mutex_unlock(&qflex_window.lock);
+    }
+}
+
+void libqflex_mttcg_run_window(QFlexWindowSlot *slots, uint32_t stop_mask)
+{
+    CPUState *cpu;
+
+    qemu_mutex_lock(&qflex_window.lock);
+    qflex_window.slots = slots;
+    qflex_window.stop_mask = stop_mask;
+    qflex_window.pending = qflex_window.nr_vcpus;
+    qflex_window.generation++;
+    qemu_mutex_unlock(&qflex_window.lock);
+
+    /* The vCPU threads wait for it on their halt_cond */
+    CPU_FOREACH(cpu) {
+        qemu_cond_broadcast(cpu->halt_cond);
+    }
+
+    qemu_mutex_unlock_iothread();
+
+    qemu_mutex_lock(&qflex_window.lock);
+    while (qflex_window.pending) {
+        qemu_cond_wait(&qflex_window.done_cond, &qflex_window.lock);
+    }
+    qemu_mutex_unlock(&qflex_window.lock);
+
+    qemu_mutex_lock_iothread();
+}
+#endif
+
 /*
  * In the multi-threaded case each vCPU has its own thread. The TLS
  * variable current_cpu can be used deep in the code to find the
@@ -89,6 +361,12 @@ static void *mttcg_cpu_thread_fn(void *arg)
     cpu->exit_request = 1;
 
     do {
+#ifdef CONFIG_LIBQFLEX
+        if (libqflex_is_timing_ready() && cpu_can_run(cpu)) {
+            mttcg_qflex_vcpu_loop(cpu);
+            break;
+        }
+#endif
         if (cpu_can_run(cpu)) {
             int r;
             qemu_mutex_unlock_iothread();
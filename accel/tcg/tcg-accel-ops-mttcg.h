@@ -16,4 +16,27 @@ void mttcg_kick_vcpu_thread(CPUState *cpu);
 /* start an mttcg vCPU thread */
 void mttcg_start_vcpu_thread(CPUState *cpu);
 
+#ifdef CONFIG_LIBQFLEX
+/*
+ * Per-vCPU slot of a QFlex cycle window, indexed by cpu_index.  The
+ * timing model fills @budget and @ev (room for @budget records); the
+ * vCPU thread sets @done to the number of records written.
+ */
+typedef struct QFlexWindowSlot {
+    uint64_t budget;
+    QFlexStepEvent *ev;
+    uint64_t done;
+} QFlexWindowSlot;
+
+/*
+ * Open a cycle window: every vCPU thread steps its own vCPU, one
+ * instruction per step, in parallel with the others, as described by
+ * @slots.  A vCPU stops early on events in @stop_mask, see
+ * libqflex_step_batch().  Returns once every vCPU thread is done.
+ * Must be called with the iothread lock held, from the thread running
+ * the timing model.
+ */
+void libqflex_mttcg_run_window(QFlexWindowSlot *slots, uint32_t stop_mask);
+#endif
+
 #endif /* TCG_ACCEL_OPS_MTTCG_H */
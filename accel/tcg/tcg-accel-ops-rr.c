@@ -36,6 +36,7 @@
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-rr.h"
 #include "tcg-accel-ops-icount.h"
+#include "internal-common.h"
 
 #ifdef CONFIG_LIBQFLEX
 #include "middleware/libqflex/libqflex-module.h"
@@ -174,6 +175,96 @@ static int rr_cpu_count(void)
     return cpu_count;
 }
 
+#ifdef CONFIG_LIBQFLEX
+/*
+ * QFlex fast-forward
+ *
+ * With qflex-ff-insns set, the round-robin loop first runs every vCPU at
+ * full speed for that many instructions, with the icount budget clamped
+ * so that no vCPU overshoots, and only then hands over to the timing
+ * model as if it had been ready from the start.  A halted vCPU cannot
+ * make progress, so it does not hold the switch back.
+ */
+static uint64_t *rr_qflex_ff_left;
+
+static void rr_qflex_ff_init(void)
+{
+    CPUState *cpu;
+    int i, nr_cpus = 0;
+
+    CPU_FOREACH(cpu) {
+        nr_cpus = MAX(nr_cpus, cpu->cpu_index + 1);
+    }
+
+    rr_qflex_ff_left = g_new(uint64_t, nr_cpus);
+    for (i = 0; i < nr_cpus; i++) {
+        rr_qflex_ff_left[i] = qflex_ff_insns;
+    }
+}
+
+static int64_t rr_qflex_ff_budget(CPUState *cpu, int64_t budget)
+{
+    if (rr_qflex_ff_left) {
+        budget = MIN(budget,
+                     (int64_t)MIN(rr_qflex_ff_left[cpu->cpu_index], INT64_MAX));
+    }
+    return budget;
+}
+
+/* Account a run of @cpu started with an icount budget of @budget */
+static void rr_qflex_ff_account(CPUState *cpu, int64_t budget)
+{
+    int64_t executed;
+
+    if (!rr_qflex_ff_left) {
+        return;
+    }
+
+    executed = budget - (cpu->neg.icount_decr.u16.low + cpu->icount_extra);
+    rr_qflex_ff_left[cpu->cpu_index] -=
+        MIN(rr_qflex_ff_left[cpu->cpu_index], (uint64_t)executed);
+}
+
+static bool rr_qflex_ff_done(void)
+{
+    CPUState *cpu;
+    bool reached = false;
+
+    CPU_FOREACH(cpu) {
+        if (rr_qflex_ff_left[cpu->cpu_index] == 0) {
+            reached = true;
+        } else if (!cpu->halted) {
+            return false;
+        }
+    }
+    return reached;
+}
+
+/* Hand every vCPU over to the timing model, with the iothread lock held */
+static void rr_qflex_start_timing(void)
+{
+    CPUState *cpu;
+
+    flexus_api.start(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+
+    // stop all the cpus
+    CPU_FOREACH(cpu) {
+        cpu->stopped = 1;
+    }
+
+    qemu_mutex_unlock_iothread();
+}
+#else
+static inline int64_t rr_qflex_ff_budget(CPUState *cpu, int64_t budget)
+{
+    return budget;
+}
+
+static inline void rr_qflex_ff_account(CPUState *cpu, int64_t budget)
+{
+}
+#endif
+
 /*
  * In the single-threaded case each vCPU is simulated in turn. If
  * there is more than a single vCPU we create a simple timer to kick
@@ -222,21 +313,25 @@ static void *rr_cpu_thread_fn(void *arg)
 #ifdef CONFIG_LIBQFLEX
     if (libqflex_is_timing_ready())
     {
-        flexus_api.start(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
-
-        // stop all the cpus
-        CPU_FOREACH(cpu) {
-            cpu->stopped = 1;
+        if (!qflex_ff_insns) {
+            rr_qflex_start_timing();
+            goto out;
         }
-
-        qemu_mutex_unlock_iothread();
-        goto out;
+        rr_qflex_ff_init();
     }
 #endif
     while (1) {
         /* Only used for icount_enabled() */
         int64_t cpu_budget = 0;
 
+#ifdef CONFIG_LIBQFLEX
+        if (rr_qflex_ff_left && rr_qflex_ff_done()) {
+            g_clear_pointer(&rr_qflex_ff_left, g_free);
+            rr_qflex_start_timing();
+            goto out;
+        }
+#endif
+
         qemu_mutex_unlock_iothread();
         replay_mutex_lock();
         qemu_mutex_lock_iothread();
@@ -271,14 +366,18 @@ static void *rr_cpu_thread_fn(void *arg)
                               (cpu->singlestep_enabled & SSTEP_NOTIMER) == 0);
 
             if (cpu_can_run(cpu)) {
+                int64_t run_budget = 0;
                 int r;
 
                 qemu_mutex_unlock_iothread();
                 if (icount_enabled()) {
-                    icount_prepare_for_run(cpu, cpu_budget);
+                    icount_prepare_for_run(cpu,
+                                           rr_qflex_ff_budget(cpu, cpu_budget));
+                    run_budget = cpu->icount_budget;
                 }
                 r = tcg_cpus_exec(cpu);
                 if (icount_enabled()) {
+                    rr_qflex_ff_account(cpu, run_budget);
                     icount_process_data(cpu);
                 }
                 qemu_mutex_lock_iothread();
@@ -362,6 +461,27 @@ void rr_start_vcpu_thread(CPUState *cpu)
 
 
 #ifdef CONFIG_LIBQFLEX
+/* Common tail of a libqflex step, called with the iothread lock held */
+static void libqflex_step_finish(CPUState *cpu)
+{
+    qatomic_set(&rr_current_cpu, NULL);
+
+    if (cpu && cpu->exit_request) {
+        qatomic_set_mb(&cpu->exit_request, 0);
+    }
+
+    if (icount_enabled() && all_cpu_threads_idle()) {
+        /*
+         * When all cpus are sleeping (e.g in WFI), to avoid a deadlock
+         * in the main_loop, wake it up in order to start the warp timer.
+         */
+        qemu_notify_event();
+    }
+
+    rr_wait_io_event();
+    rr_deal_with_unplugged_cpus();
+}
+
 uint64_t
 libqflex_step(CPUState* cpu)
 {
@@ -426,23 +546,115 @@ libqflex_step(CPUState* cpu)
         r = EXCP_QFLEX_UNKNOWN;
 
 out:
-    qatomic_set(&rr_current_cpu, NULL);
+    libqflex_step_finish(cpu);
 
-    if (cpu && cpu->exit_request) {
+    return r;
+}
+
+uint64_t
+libqflex_step_batch(CPUState *cpu, uint64_t n, QFlexStepEvent *ev,
+                    uint32_t stop_mask)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    uint64_t i = 0;
+
+    stop_mask |= QFLEX_STEP_EV_EXIT | QFLEX_STEP_EV_STOP;
+
+    qemu_mutex_unlock_iothread();
+    replay_mutex_lock();
+    qemu_mutex_lock_iothread();
+
+    if (icount_enabled()) {
+        icount_account_warp_timer();
+        icount_handle_deadline();
+    }
+
+    replay_mutex_unlock();
+
+    if (cpu->exit_request) {
+        /* See libqflex_step(), a pending kick has no effect here */
         qatomic_set_mb(&cpu->exit_request, 0);
     }
 
-    if (icount_enabled() && all_cpu_threads_idle()) {
+    qatomic_set_mb(&rr_current_cpu, cpu);
+
+    current_cpu = cpu;
+
+    qemu_clock_enable(QEMU_CLOCK_VIRTUAL,
+                     (cpu->singlestep_enabled & SSTEP_NOTIMER) == 0);
+
+    /* cpu->stop and cpu->stopped are written under the iothread lock */
+    if (n > 0 && !cpu_can_run(cpu)) {
+        QFlexStepEvent *e = &ev[i++];
+
+        e->pc = cc->get_pc(cpu);
+        if (cpu->stop) {
+            e->excp = cpu->unplug ? EXCP_QFLEX_UNPLUG : EXCP_QFLEX_STOP;
+        } else {
+            e->excp = EXCP_QFLEX_UNKNOWN;
+        }
+        e->flags = QFLEX_STEP_EV_STOP;
+        goto out;
+    }
+
+    qemu_mutex_unlock_iothread();
+
+    while (i < n) {
+        QFlexStepEvent *e = &ev[i++];
+        int r;
+
         /*
-         * When all cpus are sleeping (e.g in WFI), to avoid a deadlock
-         * in the main_loop, wake it up in order to start the warp timer.
+         * Anything needing the main loop ends the batch.  That includes
+         * a stop request: pause_all_vcpus() and friends set cpu->stop
+         * and then kick the cpu, which sets exit_request, so the batch
+         * ends here and the next one sees cpu->stop under the lock.
          */
-        qemu_notify_event();
+        if (!cpu_work_list_empty(cpu) || qatomic_read(&cpu->exit_request)) {
+            e->pc = cc->get_pc(cpu);
+            e->excp = EXCP_QFLEX_IDLE;
+            e->flags = QFLEX_STEP_EV_EXIT;
+            break;
+        }
+
+        if (icount_enabled()) {
+            /*
+             * As in the regular loop, take the replay mutex for this
+             * step only, and recompute the deadline, which timers and
+             * replay events may have moved since the previous step.
+             */
+            icount_prepare_for_run(cpu, 1);
+            if (cpu->icount_budget == 0) {
+                /* A timer is due, let the main loop see to it */
+                icount_process_data(cpu);
+                e->pc = cc->get_pc(cpu);
+                e->excp = EXCP_QFLEX_IDLE;
+                e->flags = QFLEX_STEP_EV_EXIT;
+                break;
+            }
+        }
+        r = tcg_cpus_exec(cpu);
+        if (icount_enabled()) {
+            icount_process_data(cpu);
+        }
+
+        if (r == EXCP_ATOMIC) {
+            cpu_exec_step_atomic(cpu);
+        }
+
+        e->pc = cc->get_pc(cpu);
+        e->excp = r;
+        e->flags = tcg_cpus_step_events(cpu, r);
+
+        if (e->flags & stop_mask) {
+            break;
+        }
     }
 
-    rr_wait_io_event();
-    rr_deal_with_unplugged_cpus();
+    qemu_mutex_lock_iothread();
 
-    return r;
+out:
+    libqflex_step_finish(cpu);
+
+    return i;
 }
 #endif
@@ -18,4 +18,17 @@ void rr_kick_vcpu_thread(CPUState *unused);
 /* start the round robin vcpu thread */
 void rr_start_vcpu_thread(CPUState *cpu);
 
+#ifdef CONFIG_LIBQFLEX
+/*
+ * Step @cpu up to @n times, one instruction per step, recording one
+ * QFlexStepEvent per step in @ev.  The batch ends early after a step
+ * raising any event in @stop_mask, or raising QFLEX_STEP_EV_EXIT or
+ * QFLEX_STEP_EV_STOP.  Locking and icount deadline handling are done
+ * once per batch.  Returns the number of records written.
+ */
+uint64_t libqflex_step_batch(CPUState *cpu, uint64_t n,
+                             QFlexStepEvent *ev, uint32_t stop_mask);
+#endif
+
+
 #endif /* TCG_ACCEL_OPS_RR_H */
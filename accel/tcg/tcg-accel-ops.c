@@ -78,6 +78,32 @@ int tcg_cpus_exec(CPUState *cpu)
     return ret;
 }
 
+#ifdef CONFIG_LIBQFLEX
+uint32_t tcg_cpus_step_events(CPUState *cpu, int r)
+{
+    uint32_t flags = 0;
+
+    switch (r) {
+    case EXCP_HLT:
+    case EXCP_HALTED:
+        flags |= QFLEX_STEP_EV_HALT;
+        break;
+    case EXCP_ATOMIC:
+        flags |= QFLEX_STEP_EV_ATOMIC;
+        break;
+    case EXCP_DEBUG:
+        flags |= QFLEX_STEP_EV_DEBUG;
+        break;
+    }
+
+    if (qatomic_read(&cpu->interrupt_request)) {
+        flags |= QFLEX_STEP_EV_IRQ;
+    }
+
+    return flags;
+}
+#endif
+
 static void tcg_cpu_reset_hold(CPUState *cpu)
 {
     tcg_flush_jmp_cache(cpu);
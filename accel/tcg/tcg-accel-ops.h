@@ -19,4 +19,29 @@ int tcg_cpus_exec(CPUState *cpu);
 void tcg_handle_interrupt(CPUState *cpu, int mask);
 void tcg_cpu_init_cflags(CPUState *cpu, bool parallel);
 
+#ifdef CONFIG_LIBQFLEX
+/*
+ * Outcome of one QFlex timing-mode step, either from libqflex_step_batch()
+ * or from an MTTCG cycle window.  @excp is the value libqflex_step() would
+ * have returned for that step, @pc the guest PC once it has completed.
+ */
+typedef struct QFlexStepEvent {
+    uint64_t pc;
+    int32_t excp;
+    uint32_t flags;
+} QFlexStepEvent;
+
+/* QFlexStepEvent.flags */
+#define QFLEX_STEP_EV_IRQ     (1u << 0) /* interrupt pending after the step */
+#define QFLEX_STEP_EV_HALT    (1u << 1) /* vCPU halted (WFI/WFE) */
+#define QFLEX_STEP_EV_ATOMIC  (1u << 2) /* step needed the exclusive path */
+#define QFLEX_STEP_EV_DEBUG   (1u << 3) /* breakpoint or gdb single-step */
+/* Always end the batch, whatever the stop mask */
+#define QFLEX_STEP_EV_EXIT    (1u << 4) /* exit request or queued work */
+#define QFLEX_STEP_EV_STOP    (1u << 5) /* vCPU stopped or unplugged */
+
+/* Events raised by a step of @cpu that returned @r */
+uint32_t tcg_cpus_step_events(CPUState *cpu, int r);
+#endif
+
 #endif /* TCG_ACCEL_OPS_H */
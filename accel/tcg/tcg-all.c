@@ -28,6 +28,7 @@
 #include "exec/replay-core.h"
 #include "sysemu/cpu-timers.h"
 #include "tcg/startup.h"
+#include "tcg/tcg.h"
 #include "tcg/oversized-guest.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
@@ -37,7 +38,12 @@
 #include "qemu/units.h"
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
+#ifdef CONFIG_LIBQFLEX
+#include "exec/qflex-ring.h"
+#include "qemu/plugin.h"
 #endif
+#endif
+#include "internal-common.h"
 #include "internal-target.h"
 
 struct TCGState {
@@ -45,8 +51,19 @@ struct TCGState {
 
     bool mttcg_enabled;
     bool one_insn_per_tb;
+    uint32_t superblock_threshold;
     int splitwx_enabled;
     unsigned long tb_size;
+    char *tb_cache;
+    uint32_t tb_workers;
+    bool tb_profile;
+#ifdef CONFIG_TCG_INTERPRETER
+    bool tci_fast_path;
+#endif
+#ifdef CONFIG_LIBQFLEX
+    uint64_t qflex_ff_insns;
+    uint32_t qflex_ring_slots;
+#endif
 };
 typedef struct TCGState TCGState;
 
@@ -88,6 +105,9 @@ static void tcg_accel_instance_init(Object *obj)
     TCGState *s = TCG_STATE(obj);
 
     s->mttcg_enabled = default_mttcg_enabled();
+#ifdef CONFIG_TCG_INTERPRETER
+    s->tci_fast_path = true;
+#endif
 
     /* If debugging enabled, default "auto on", otherwise off. */
 #if defined(CONFIG_DEBUG_TCG) && !defined(CONFIG_USER_ONLY)
@@ -99,6 +119,10 @@ static void tcg_accel_instance_init(Object *obj)
 
 bool mttcg_enabled;
 bool one_insn_per_tb;
+uint32_t tb_superblock_threshold;
+#ifdef CONFIG_LIBQFLEX
+uint64_t qflex_ff_insns;
+#endif
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -108,13 +132,62 @@ static int tcg_init_machine(MachineState *ms)
 #else
     unsigned max_cpus = ms->smp.max_cpus;
 #endif
+    unsigned max_threads;
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
 
+#ifdef CONFIG_LIBQFLEX
+    if (s->qflex_ff_insns && (mttcg_enabled || !icount_enabled())) {
+        error_report("qflex-ff-insns requires -icount and thread=single");
+        return -EINVAL;
+    }
+    qflex_ff_insns = s->qflex_ff_insns;
+#endif
+
+    tb_superblock_threshold = MIN(s->superblock_threshold, INT32_MAX);
+    for (int i = 0; i < TB_HOTNESS_SIZE; i++) {
+        tb_hotness[i] = tb_superblock_threshold;
+    }
+
+#ifdef CONFIG_TCG_INTERPRETER
+    tci_fast_path = s->tci_fast_path;
+#endif
+
     page_init();
     tb_htable_init();
-    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+    max_threads = mttcg_enabled ? max_cpus : 1;
+#ifndef CONFIG_USER_ONLY
+    max_threads += s->tb_workers;
+#endif
+    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_threads);
+#ifndef CONFIG_USER_ONLY
+    if (s->tb_cache) {
+        tb_cache_init(s->tb_cache, max_cpus);
+    }
+    if (s->tb_workers) {
+        tb_workers_init(s->tb_workers);
+    }
+    if (s->tb_profile) {
+        tb_profile_init();
+    }
+#ifdef CONFIG_LIBQFLEX
+    if (s->qflex_ring_slots) {
+        Error *local_err = NULL;
+
+        if (!qflex_rings_init(max_cpus, s->qflex_ring_slots, &local_err)) {
+            error_report_err(local_err);
+            return -EINVAL;
+        }
+#ifdef CONFIG_PLUGIN
+        /* Fails if QFlex's own trace plugin already feeds the rings */
+        qemu_plugin_register_vcpu_trace_cb(qemu_plugin_register_builtin(),
+                                           QFLEX_RING_TRACE_RECORDS,
+                                           qflex_ring_push_trace, NULL);
+#endif
+    }
+#endif
+#endif
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -157,6 +230,73 @@ static void tcg_set_thread(Object *obj, const char *value, Error **errp)
     }
 }
 
+#ifndef CONFIG_USER_ONLY
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache);
+    s->tb_cache = g_strdup(value);
+}
+#endif
+
+#ifndef CONFIG_USER_ONLY
+static void tcg_get_tb_workers(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->tb_workers, errp);
+}
+
+static void tcg_set_tb_workers(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->tb_workers, errp);
+}
+
+static bool tcg_get_tb_profile(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->tb_profile;
+}
+
+static void tcg_set_tb_profile(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->tb_profile = value;
+}
+#endif
+
+#ifdef CONFIG_TCG_INTERPRETER
+static bool tcg_get_tci_fast_path(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->tci_fast_path;
+}
+
+static void tcg_set_tci_fast_path(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->tci_fast_path = value;
+}
+#endif
+
 static void tcg_get_tb_size(Object *obj, Visitor *v,
                             const char *name, void *opaque,
                             Error **errp)
@@ -207,6 +347,62 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+static void tcg_get_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->superblock_threshold, errp);
+}
+
+static void tcg_set_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->superblock_threshold, errp);
+}
+
+#ifdef CONFIG_LIBQFLEX
+static void tcg_get_qflex_ff_insns(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint64(v, name, &s->qflex_ff_insns, errp);
+}
+
+static void tcg_set_qflex_ff_insns(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint64(v, name, &s->qflex_ff_insns, errp);
+}
+
+static void tcg_get_qflex_ring_slots(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->qflex_ring_slots, errp);
+}
+
+static void tcg_set_qflex_ring_slots(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->qflex_ring_slots, errp);
+}
+#endif
+
 static int tcg_gdbstub_supported_sstep_flags(void)
 {
     /*
@@ -242,6 +438,36 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache,
+                                  tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "File remembering translated blocks from one run to the next");
+
+    object_class_property_add(oc, "tb-workers", "uint32",
+        tcg_get_tb_workers, tcg_set_tb_workers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-workers",
+        "Threads translating likely successors of translation blocks "
+        "ahead of execution (0: none)");
+
+    object_class_property_add_bool(oc, "tb-profile",
+                                   tcg_get_tb_profile,
+                                   tcg_set_tb_profile);
+    object_class_property_set_description(oc, "tb-profile",
+        "Count the executions of each translation block");
+#endif
+
+#ifdef CONFIG_TCG_INTERPRETER
+    object_class_property_add_bool(oc, "tci-fast-path",
+                                   tcg_get_tci_fast_path,
+                                   tcg_set_tci_fast_path);
+    object_class_property_set_description(oc, "tci-fast-path",
+        "Threaded dispatch, superinstructions and inline TLB lookups "
+        "in the TCG interpreter");
+#endif
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -252,6 +478,28 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+    object_class_property_add(oc, "superblock-threshold", "uint32",
+        tcg_get_superblock_threshold, tcg_set_superblock_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "superblock-threshold",
+        "Executions after which a translation block is retranslated as "
+        "a superblock (0: never)");
+
+#ifdef CONFIG_LIBQFLEX
+    object_class_property_add(oc, "qflex-ff-insns", "uint64",
+        tcg_get_qflex_ff_insns, tcg_set_qflex_ff_insns,
+        NULL, NULL);
+    object_class_property_set_description(oc, "qflex-ff-insns",
+        "Instructions each vCPU runs at full speed before QFlex timing starts");
+
+    object_class_property_add(oc, "qflex-ring-slots", "uint32",
+        tcg_get_qflex_ring_slots, tcg_set_qflex_ring_slots,
+        NULL, NULL);
+    object_class_property_set_description(oc, "qflex-ring-slots",
+        "Records in each vCPU's QFlex instruction ring, a power of two "
+        "(0: no rings)");
+#endif
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -195,6 +195,71 @@ static int cpu_unwind_data_from_tb(TranslationBlock *tb, uintptr_t host_pc,
     return -1;
 }
 
+int32_t tb_hotness[TB_HOTNESS_SIZE];
+uint64_t *tb_exec_count;
+
+/* Slots given back by evicted or discarded TBs, below tb_profile_slots */
+static QemuSpin tb_profile_lock;
+static int32_t *tb_profile_free;
+static unsigned tb_profile_nr_free;
+
+void tb_profile_init(void)
+{
+    qemu_spin_init(&tb_profile_lock);
+    tb_exec_count = g_new0(uint64_t, TB_PROFILE_SLOTS);
+    tb_profile_free = g_new(int32_t, TB_PROFILE_SLOTS);
+}
+
+/* Called by tb_flush, with every slot becoming free again */
+void tb_profile_reset(void)
+{
+    memset(tb_exec_count, 0, TB_PROFILE_SLOTS * sizeof(*tb_exec_count));
+    qatomic_set(&tb_ctx.tb_profile_slots, 0);
+    tb_profile_nr_free = 0;
+}
+
+static int32_t tb_profile_slot_alloc(void)
+{
+    int32_t slot = -1;
+
+    if (qatomic_read(&tb_ctx.tb_profile_slots) < TB_PROFILE_SLOTS) {
+        unsigned next = qatomic_fetch_inc(&tb_ctx.tb_profile_slots);
+
+        if (next < TB_PROFILE_SLOTS) {
+            return next;
+        }
+    }
+
+    qemu_spin_lock(&tb_profile_lock);
+    if (tb_profile_nr_free) {
+        slot = tb_profile_free[--tb_profile_nr_free];
+    }
+    qemu_spin_unlock(&tb_profile_lock);
+
+    if (slot < 0) {
+        qatomic_inc(&tb_ctx.tb_profile_missed);
+    }
+    return slot;
+}
+
+/*
+ * Give back the slot of @tb, which must not be able to run any more:
+ * either it was never linked, or it is being evicted.
+ */
+void tb_profile_slot_free(TranslationBlock *tb)
+{
+    if (tb->profile_slot < 0) {
+        return;
+    }
+    qatomic_set(&tb_exec_count[tb->profile_slot], 0);
+
+    qemu_spin_lock(&tb_profile_lock);
+    tb_profile_free[tb_profile_nr_free++] = tb->profile_slot;
+    qemu_spin_unlock(&tb_profile_lock);
+
+    tb->profile_slot = -1;
+}
+
 /*
  * The cpu state corresponding to 'host_pc' is restored in
  * preparation for exiting the TB.
@@ -276,6 +341,8 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     tcg_func_start(tcg_ctx);
 
     tcg_ctx->cpu = env_cpu(env);
+    tb->succ_pc[0] = -1;
+    tb->succ_pc[1] = -1;
     gen_intermediate_code(env_cpu(env), tb, max_insns, pc, host_pc);
     assert(tb->size != 0);
     tcg_ctx->cpu = NULL;
@@ -284,28 +351,18 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              vaddr pc, uint64_t cs_base,
-                              uint32_t flags, int cflags)
+static TranslationBlock *tb_gen_code_common(CPUState *cpu,
+                                            vaddr pc, uint64_t cs_base,
+                                            uint32_t flags, int cflags,
+                                            tb_page_addr_t phys_pc,
+                                            void *host_pc)
 {
     CPUArchState *env = cpu_env(cpu);
     TranslationBlock *tb, *existing_tb;
-    tb_page_addr_t phys_pc, phys_p2;
+    tb_page_addr_t phys_p2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size, max_insns;
     int64_t ti;
-    void *host_pc;
-
-    assert_memory_lock();
-    qemu_thread_jit_write();
-
-    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
-
-    if (phys_pc == -1) {
-        /* Generate a one-shot TB with 1 insn in it */
-        cflags = (cflags & ~CF_COUNT_MASK) | 1;
-    }
 
     max_insns = cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
@@ -317,8 +374,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        if (tcg_ctx->gen_ahead) {
+            /* Leave the flush to the vCPUs.  */
+            return NULL;
+        }
+        /* room must be made */
+        tb_reclaim(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -337,6 +398,16 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tb_lock_page0(phys_pc);
     }
 
+    /*
+     * A one-insn TB without a RAM page is never looked up nor evicted,
+     * so it would never give its slot back.
+     */
+    if (tb_exec_count && phys_pc != -1) {
+        tb->profile_slot = tb_profile_slot_alloc();
+    } else {
+        tb->profile_slot = -1;
+    }
+
     tcg_ctx->gen_tb = tb;
     tcg_ctx->addr_type = TARGET_LONG_BITS == 32 ? TCG_TYPE_I32 : TCG_TYPE_I64;
 #ifdef CONFIG_SOFTMMU
@@ -371,6 +442,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                           "Restarting code generation for "
                           "code_gen_buffer overflow\n");
             tb_unlock_pages(tb);
+            tb_profile_slot_free(tb);
             tcg_ctx->gen_tb = NULL;
             goto buffer_overflow;
 
@@ -414,6 +486,18 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                           "Restarting code generation with re-locked pages");
             goto restart_translate;
 
+        case -4:
+            /*
+             * Translating ahead, the block continues onto a page that
+             * only its vCPU can look up.  Drop it; it is translated on
+             * demand if it is ever run.
+             */
+            tb_unlock_pages(tb);
+            tb_profile_slot_free(tb);
+            tcg_ctx->gen_tb = NULL;
+            qatomic_set(&tcg_ctx->code_gen_ptr, (void *)tb);
+            return NULL;
+
         default:
             g_assert_not_reached();
         }
@@ -423,6 +507,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
     if (unlikely(search_size < 0)) {
         tb_unlock_pages(tb);
+        tb_profile_slot_free(tb);
         goto buffer_overflow;
     }
     tb->tc.size = gen_code_size;
@@ -517,6 +602,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->jmp_list_next[1] = (uintptr_t)NULL;
     tb->jmp_dest[0] = (uintptr_t)NULL;
     tb->jmp_dest[1] = (uintptr_t)NULL;
+    memset(tb->bc_refs, 0, sizeof(tb->bc_refs));
+    tb->bc_overflow = false;
 
     /* init original jump addresses which have been set during tcg_gen_code() */
     if (tb->jmp_reset_offset[0] != TB_JMP_OFFSET_INVALID) {
@@ -557,11 +644,68 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         orig_aligned -= ROUND_UP(sizeof(*tb), qemu_icache_linesize);
         qatomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
         tcg_tb_remove(tb);
+        tb_profile_slot_free(tb);
         return existing_tb;
     }
     return tb;
 }
 
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              vaddr pc, uint64_t cs_base,
+                              uint32_t flags, int cflags)
+{
+    int64_t start = get_clock();
+    TranslationBlock *tb;
+    tb_page_addr_t phys_pc;
+    void *host_pc;
+
+    assert_memory_lock();
+    qemu_thread_jit_write();
+
+    phys_pc = get_page_addr_code_hostp(cpu_env(cpu), pc, &host_pc);
+
+    if (phys_pc == -1) {
+        /* Generate a one-shot TB with 1 insn in it */
+        cflags = (cflags & ~CF_COUNT_MASK) | 1;
+    }
+
+    tb = tb_gen_code_common(cpu, pc, cs_base, flags, cflags,
+                            phys_pc, host_pc);
+    stat64_add(&tb_ctx.tb_gen_time, get_clock() - start);
+    stat64_add(&tb_ctx.tb_gen_count, 1);
+    return tb;
+}
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * Translate ahead of execution, from a thread other than the vCPU thread
+ * of @cpu: the block is read at @host_pc, the host address of @phys_pc,
+ * rather than looked up in the soft TLB of @cpu.  Return NULL instead of
+ * flushing when the code buffer is full, and when the block would need
+ * its next guest page.
+ */
+TranslationBlock *tb_gen_code_ahead(CPUState *cpu,
+                                    vaddr pc, uint64_t cs_base,
+                                    uint32_t flags, int cflags,
+                                    tb_page_addr_t phys_pc, void *host_pc)
+{
+    int64_t start = get_clock();
+    TranslationBlock *tb;
+
+    assert_memory_lock();
+    qemu_thread_jit_write();
+
+    tcg_ctx->gen_ahead = true;
+    tb = tb_gen_code_common(cpu, pc, cs_base, flags, cflags,
+                            phys_pc, host_pc);
+    tcg_ctx->gen_ahead = false;
+    stat64_add(&tb_ctx.tb_gen_time, get_clock() - start);
+    stat64_add(&tb_ctx.tb_gen_count, 1);
+    return tb;
+}
+#endif
+
 /* user-mode: call with mmap_lock held */
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
 {
@@ -662,6 +806,10 @@ void tcg_flush_jmp_cache(CPUState *cpu)
 {
     CPUJumpCache *jc = cpu->tb_jmp_cache;
 
+    for (int i = 0; i < ARRAY_SIZE(cpu->neg.bc.entry); i++) {
+        qatomic_set(&cpu->neg.bc.entry[i].site, NULL);
+    }
+
     /* During early initialization, the cache may not yet be allocated. */
     if (unlikely(jc == NULL)) {
         return;
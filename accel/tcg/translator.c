@@ -14,6 +14,7 @@
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
 #include "tcg/tcg-op-common.h"
+#include "internal-common.h"
 #include "internal-target.h"
 
 static void set_can_do_io(DisasContextBase *db, bool val)
@@ -42,11 +43,61 @@ bool translator_io_start(DisasContextBase *db)
     return true;
 }
 
+/*
+ * Count down the executions of a TB that can be retranslated as a
+ * superblock.  Once it is hot, request an exit, which the check in
+ * gen_tb_start() takes before any guest insn runs, so that cpu_exec()
+ * retranslates it.
+ */
+static void gen_tb_hotness(DisasContextBase *db)
+{
+    TCGv_ptr slot = tcg_constant_ptr(&tb_hotness[db->tb->hot_slot]);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel *cold = gen_new_label();
+
+    tcg_gen_ld_i32(count, slot, 0);
+    tcg_gen_subi_i32(count, count, 1);
+    tcg_gen_st_i32(count, slot, 0);
+    tcg_gen_brcondi_i32(TCG_COND_GT, count, 0, cold);
+    tcg_gen_st16_i32(tcg_constant_i32(-1), tcg_env,
+                     offsetof(ArchCPU, parent_obj.neg.icount_decr.u16.high)
+                     - offsetof(ArchCPU, env));
+    gen_set_label(cold);
+}
+
+/* Count the executions of a TB for -accel tcg,tb-profile=on.  */
+static void gen_tb_exec_count(DisasContextBase *db)
+{
+    TCGv_ptr slot = tcg_constant_ptr(&tb_exec_count[db->tb->profile_slot]);
+    TCGv_i64 count = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(count, slot, 0);
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, slot, 0);
+}
+
 static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
 {
     TCGv_i32 count = NULL;
     TCGOp *icount_start_insn = NULL;
 
+    if (db->tb->profile_slot >= 0) {
+        gen_tb_exec_count(db);
+    }
+
+    /*
+     * Exact instruction counts do not survive the early exits of a
+     * superblock, and TBs with an explicit size are one-offs.
+     */
+    if (tb_superblock_threshold &&
+        !(cflags & (CF_SUPERBLOCK | CF_USE_ICOUNT | CF_NOIRQ |
+                    CF_SINGLE_STEP | CF_COUNT_MASK))) {
+        db->tb->hot_slot = tb_hotness_slot(db->pc_first);
+        gen_tb_hotness(db);
+    } else {
+        db->tb->hot_slot = -1;
+    }
+
     if ((cflags & CF_USE_ICOUNT) || !(cflags & CF_NOIRQ)) {
         count = tcg_temp_new_i32();
         tcg_gen_ld_i32(count, tcg_env,
@@ -120,7 +171,38 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     }
 
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    if ((db->pc_first ^ dest) & TARGET_PAGE_MASK) {
+        return false;
+    }
+
+    /* Record it as a likely successor.  */
+    if (db->tb->succ_pc[0] == -1) {
+        db->tb->succ_pc[0] = dest;
+    } else if (db->tb->succ_pc[0] != dest && db->tb->succ_pc[1] == -1) {
+        db->tb->succ_pc[1] = dest;
+    }
+    return true;
+}
+
+bool translator_follow_branch(DisasContextBase *db, vaddr dest)
+{
+    if (!(tb_cflags(db->tb) & CF_SUPERBLOCK) || db->plugin_enabled) {
+        return false;
+    }
+
+    /* Page tracking only knows [pc_first, pc_first + tb->size). */
+    if (dest < db->pc_first || !is_same_page(db, dest)) {
+        return false;
+    }
+
+    /* The branch insn would be the last one anyway. */
+    if (db->num_insns >= db->max_insns || tcg_op_buf_full()) {
+        return false;
+    }
+
+    db->pc_end = MAX(db->pc_end, db->pc_next);
+    db->pc_next = dest;
+    return true;
 }
 
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
@@ -142,6 +224,7 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     db->saved_can_do_io = -1;
     db->host_addr[0] = host_pc;
     db->host_addr[1] = NULL;
+    db->pc_end = pc;
 
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
@@ -210,7 +293,7 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     }
 
     /* The disas_log hook may use these values rather than recompute.  */
-    tb->size = db->pc_next - db->pc_first;
+    tb->size = MAX(db->pc_end, db->pc_next) - db->pc_first;
     tb->icount = db->num_insns;
 
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
@@ -249,6 +332,11 @@ static void *translator_access(CPUArchState *env, DisasContextBase *db,
         if (host == NULL) {
             tb_page_addr_t page0, old_page1, new_page1;
 
+            /* Only the vCPU thread may use its soft TLB.  */
+            if (tcg_ctx->gen_ahead) {
+                siglongjmp(tcg_ctx->jmp_trans, -4);
+            }
+
             new_page1 = get_page_addr_code_hostp(env, base, &db->host_addr[1]);
 
             /*
@@ -7,6 +7,7 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include <glib.h>
 
 #include <qemu-plugin.h>
@@ -18,6 +19,7 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
 static GHashTable *miss_ht;
+static GHashTable *exec_ht;
 
 static GMutex hashtable_lock;
 static GRand *rng;
@@ -89,6 +91,45 @@ typedef struct {
     uint64_t l2_misses;
 } InsnData;
 
+/*
+ * What the execution callback of one translation of an instruction is
+ * given.  InsnData is shared by every translation of the instruction at
+ * the same address, which may map other virtual addresses or end a TB in
+ * one translation and not in another, so those live here.  Entries are
+ * interned in exec_ht, retranslations reusing them.
+ */
+typedef struct {
+    InsnData *data;
+    uint64_t vaddr;
+    size_t size;
+    bool ends_tb;
+} InsnExec;
+
+/*
+ * The branch predictor is a gshare direction predictor, a table of 2-bit
+ * saturating counters indexed by the branch address xor-ed with the global
+ * history of outcomes, next to a direct-mapped branch target buffer.
+ *
+ * Instructions are not decoded, so every instruction that ends a
+ * translation block is taken for a branch, and its outcome is only known
+ * when the next instruction runs: taken if that is not the fall-through.
+ * Blocks that end at a page boundary or an instruction limit train the
+ * predictor as never-taken branches.
+ */
+typedef struct {
+    uint8_t *counters;
+    uint64_t *btb_tags;
+    uint64_t *btb_targets;
+    uint64_t history;
+    /* last instruction, whose outcome is pending if it ended a block */
+    bool pending;
+    uint64_t pc;
+    uint64_t fallthrough;
+    uint64_t branches;
+    uint64_t mispredicts;
+    uint64_t btb_misses;
+} BranchPredictor;
+
 void (*update_hit)(Cache *cache, int set, int blk);
 void (*update_miss)(Cache *cache, int set, int blk);
 
@@ -113,6 +154,14 @@ static uint64_t l1_dmisses;
 static uint64_t l2_mem_accesses;
 static uint64_t l2_misses;
 
+static bool use_bpred;
+static int bht_bits;
+static int btb_entries;
+static BranchPredictor **bpreds;
+
+/* save and restore the warmed state with every checkpoint */
+static bool warm;
+
 static int pow_of_two(int num)
 {
     g_assert((num & (num - 1)) == 0);
@@ -385,6 +434,86 @@ static bool access_cache(Cache *cache, uint64_t addr)
     return false;
 }
 
+static BranchPredictor *bpred_init(void)
+{
+    BranchPredictor *bp = g_new0(BranchPredictor, 1);
+    int i;
+
+    bp->counters = g_new(uint8_t, 1 << bht_bits);
+    /* weakly not-taken */
+    memset(bp->counters, 1, 1 << bht_bits);
+    bp->btb_tags = g_new(uint64_t, btb_entries);
+    bp->btb_targets = g_new0(uint64_t, btb_entries);
+    for (i = 0; i < btb_entries; i++) {
+        bp->btb_tags[i] = UINT64_MAX;
+    }
+    return bp;
+}
+
+static BranchPredictor **bpreds_init(void)
+{
+    BranchPredictor **bps = g_new(BranchPredictor *, cores);
+    int i;
+
+    for (i = 0; i < cores; i++) {
+        bps[i] = bpred_init();
+    }
+    return bps;
+}
+
+static void bpreds_free(BranchPredictor **bps)
+{
+    int i;
+
+    for (i = 0; i < cores; i++) {
+        g_free(bps[i]->counters);
+        g_free(bps[i]->btb_tags);
+        g_free(bps[i]->btb_targets);
+        g_free(bps[i]);
+    }
+    g_free(bps);
+}
+
+/* Resolve branch @pc, whose next instruction turned out to be @next */
+static void bpred_update(BranchPredictor *bp, uint64_t pc, uint64_t next)
+{
+    uint64_t hist_mask = (1ull << bht_bits) - 1;
+    uint64_t idx = ((pc >> 2) ^ bp->history) & hist_mask;
+    uint64_t slot;
+    bool taken = next != bp->fallthrough;
+
+    bp->branches++;
+    if ((bp->counters[idx] >= 2) != taken) {
+        bp->mispredicts++;
+    }
+    if (taken && bp->counters[idx] < 3) {
+        bp->counters[idx]++;
+    } else if (!taken && bp->counters[idx] > 0) {
+        bp->counters[idx]--;
+    }
+    bp->history = ((bp->history << 1) | taken) & hist_mask;
+
+    if (!taken) {
+        return;
+    }
+    slot = (pc >> 2) & (btb_entries - 1);
+    if (bp->btb_tags[slot] != pc || bp->btb_targets[slot] != next) {
+        bp->btb_misses++;
+        bp->btb_tags[slot] = pc;
+        bp->btb_targets[slot] = next;
+    }
+}
+
+static void bpred_exec(BranchPredictor *bp, InsnExec *insn)
+{
+    if (bp->pending) {
+        bpred_update(bp, bp->pc, insn->vaddr);
+    }
+    bp->pending = insn->ends_tb;
+    bp->pc = insn->vaddr;
+    bp->fallthrough = insn->vaddr + insn->size;
+}
+
 static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
                             uint64_t vaddr, void *userdata)
 {
@@ -429,18 +558,20 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
 
 static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
 {
-    uint64_t insn_addr;
-    InsnData *insn;
+    InsnExec *exec = userdata;
+    InsnData *insn = exec->data;
+    uint64_t insn_addr = insn->addr;
     int cache_idx;
     bool hit_in_l1;
 
-    insn_addr = ((InsnData *) userdata)->addr;
-
     cache_idx = vcpu_index % cores;
     g_mutex_lock(&l1_icache_locks[cache_idx]);
+    /* the predictor of a core is covered by its L1 icache lock */
+    if (use_bpred) {
+        bpred_exec(bpreds[cache_idx], exec);
+    }
     hit_in_l1 = access_cache(l1_icaches[cache_idx], insn_addr);
     if (!hit_in_l1) {
-        insn = userdata;
         __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_SEQ_CST);
         l1_icaches[cache_idx]->misses++;
     }
@@ -454,7 +585,6 @@ static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
 
     g_mutex_lock(&l2_ucache_locks[cache_idx]);
     if (!access_cache(l2_ucaches[cache_idx], insn_addr)) {
-        insn = userdata;
         __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
         l2_ucaches[cache_idx]->misses++;
     }
@@ -462,11 +592,27 @@ static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
     g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
+static guint insn_exec_hash(gconstpointer key)
+{
+    const InsnExec *e = key;
+
+    return g_direct_hash(e->data) ^ g_int64_hash(&e->vaddr) ^ e->ends_tb;
+}
+
+static gboolean insn_exec_equal(gconstpointer a, gconstpointer b)
+{
+    const InsnExec *ea = a, *eb = b;
+
+    return ea->data == eb->data && ea->vaddr == eb->vaddr &&
+           ea->size == eb->size && ea->ends_tb == eb->ends_tb;
+}
+
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     size_t n_insns;
     size_t i;
     InsnData *data;
+    InsnExec key, *exec;
 
     n_insns = qemu_plugin_tb_n_insns(tb);
     for (i = 0; i < n_insns; i++) {
@@ -494,6 +640,16 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
             g_hash_table_insert(miss_ht, GUINT_TO_POINTER(effective_addr),
                                (gpointer) data);
         }
+
+        key.data = data;
+        key.vaddr = qemu_plugin_insn_vaddr(insn);
+        key.size = qemu_plugin_insn_size(insn);
+        key.ends_tb = i == n_insns - 1;
+        exec = g_hash_table_lookup(exec_ht, &key);
+        if (exec == NULL) {
+            exec = g_memdup2(&key, sizeof(key));
+            g_hash_table_add(exec_ht, exec);
+        }
         g_mutex_unlock(&hashtable_lock);
 
         qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
@@ -501,7 +657,7 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                                          rw, data);
 
         qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
-                                               QEMU_PLUGIN_CB_NO_REGS, data);
+                                               QEMU_PLUGIN_CB_NO_REGS, exec);
     }
 }
 
@@ -535,6 +691,320 @@ static void caches_free(Cache **caches)
     }
 }
 
+/*
+ * With warm=on, the tag state of every cache and the branch predictors are
+ * written to <checkpoint>.cache whenever an external checkpoint is saved,
+ * and read back when one is loaded, so that a sample restored from it
+ * starts with warm caches instead of running a detailed warming window.
+ *
+ * The file is in host byte order: a WarmHeader, then for the L1 dcache,
+ * L1 icache and, if present, L2 cache of every core in turn, for each set,
+ * the 64-bit LRU generation counter followed by a (tag, age) pair of 64-bit
+ * words per block.  Age is 0 for an invalid block; otherwise it is the LRU
+ * priority plus one, the FIFO position plus one (1 is the newest block), or
+ * 1 with random eviction.  With bpred=on, the predictor of every core
+ * follows: the 64-bit global history, one byte per gshare counter, then the
+ * BTB tags and targets, 64 bits each.
+ *
+ * State is only restored into the same configuration it was saved from.
+ */
+#define WARM_MAGIC "QEMUWARM"
+#define WARM_VERSION 1
+
+enum { WARM_L1D, WARM_L1I, WARM_L2, WARM_NR_CACHES };
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t cores;
+    uint32_t policy;
+    uint32_t bht_bits;      /* 0 without branch predictor */
+    uint32_t btb_entries;
+    struct {
+        uint32_t num_sets;  /* 0 for a missing cache */
+        uint32_t assoc;
+        uint32_t blksize_shift;
+    } caches[WARM_NR_CACHES];
+} WarmHeader;
+
+static Cache **warm_caches(int i)
+{
+    switch (i) {
+    case WARM_L1D:
+        return l1_dcaches;
+    case WARM_L1I:
+        return l1_icaches;
+    case WARM_L2:
+        return use_l2 ? l2_ucaches : NULL;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void warm_header_init(WarmHeader *hdr)
+{
+    int i;
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, WARM_MAGIC, sizeof(hdr->magic));
+    hdr->version = WARM_VERSION;
+    hdr->cores = cores;
+    hdr->policy = policy;
+    if (use_bpred) {
+        hdr->bht_bits = bht_bits;
+        hdr->btb_entries = btb_entries;
+    }
+    for (i = 0; i < WARM_NR_CACHES; i++) {
+        Cache **caches = warm_caches(i);
+
+        if (caches) {
+            hdr->caches[i].num_sets = caches[0]->num_sets;
+            hdr->caches[i].assoc = caches[0]->assoc;
+            hdr->caches[i].blksize_shift = caches[0]->blksize_shift;
+        }
+    }
+}
+
+static size_t warm_size(const WarmHeader *hdr)
+{
+    size_t size = sizeof(*hdr);
+    size_t per_core = 0;
+    int i;
+
+    for (i = 0; i < WARM_NR_CACHES; i++) {
+        per_core += hdr->caches[i].num_sets *
+            (sizeof(uint64_t) + hdr->caches[i].assoc * 2 * sizeof(uint64_t));
+    }
+    if (hdr->bht_bits) {
+        per_core += sizeof(uint64_t) + (1 << hdr->bht_bits) +
+                    hdr->btb_entries * 2 * sizeof(uint64_t);
+    }
+    return size + per_core * hdr->cores;
+}
+
+static void put_u64(GByteArray *buf, uint64_t val)
+{
+    g_byte_array_append(buf, (guint8 *) &val, sizeof(val));
+}
+
+static uint64_t get_u64(const uint8_t **p)
+{
+    uint64_t val;
+
+    memcpy(&val, *p, sizeof(val));
+    *p += sizeof(val);
+    return val;
+}
+
+static uint64_t block_age(Cache *cache, int set, int blk)
+{
+    CacheSet *s = &cache->sets[set];
+    GList *l;
+    int pos;
+
+    if (!s->blocks[blk].valid) {
+        return 0;
+    }
+    switch (policy) {
+    case LRU:
+        return s->lru_priorities[blk] + 1;
+    case FIFO:
+        for (l = s->fifo_queue->head, pos = 1; l; l = l->next, pos++) {
+            if (GPOINTER_TO_INT(l->data) == blk) {
+                return pos;
+            }
+        }
+        g_assert_not_reached();
+    default:
+        return 1;
+    }
+}
+
+static void cache_save(GByteArray *buf, Cache *cache)
+{
+    int i, j;
+
+    for (i = 0; i < cache->num_sets; i++) {
+        put_u64(buf, policy == LRU ? cache->sets[i].lru_gen_counter : 0);
+        for (j = 0; j < cache->assoc; j++) {
+            put_u64(buf, cache->sets[i].blocks[j].tag);
+            put_u64(buf, block_age(cache, i, j));
+        }
+    }
+}
+
+static void cache_load(const uint8_t **p, Cache *cache)
+{
+    uint64_t *ages = g_new(uint64_t, cache->assoc);
+    CacheSet *s;
+    uint64_t age;
+    int i, j;
+
+    for (i = 0; i < cache->num_sets; i++) {
+        s = &cache->sets[i];
+        if (policy == LRU) {
+            s->lru_gen_counter = get_u64(p);
+        } else {
+            get_u64(p);
+        }
+        for (j = 0; j < cache->assoc; j++) {
+            s->blocks[j].tag = get_u64(p);
+            ages[j] = get_u64(p);
+            s->blocks[j].valid = ages[j] != 0;
+            if (policy == LRU) {
+                s->lru_priorities[j] = ages[j] ? ages[j] - 1 : 0;
+            }
+        }
+        if (policy != FIFO) {
+            continue;
+        }
+        /* rebuild the queue newest first, as fifo_update_on_miss() does */
+        g_queue_clear(s->fifo_queue);
+        for (age = 1; age <= cache->assoc; age++) {
+            for (j = 0; j < cache->assoc; j++) {
+                if (ages[j] == age) {
+                    g_queue_push_tail(s->fifo_queue, GINT_TO_POINTER(j));
+                }
+            }
+        }
+    }
+    g_free(ages);
+}
+
+static void bpred_save(GByteArray *buf, BranchPredictor *bp)
+{
+    int i;
+
+    put_u64(buf, bp->history);
+    g_byte_array_append(buf, bp->counters, 1 << bht_bits);
+    for (i = 0; i < btb_entries; i++) {
+        put_u64(buf, bp->btb_tags[i]);
+        put_u64(buf, bp->btb_targets[i]);
+    }
+}
+
+static void bpred_load(const uint8_t **p, BranchPredictor *bp)
+{
+    int i;
+
+    bp->history = get_u64(p);
+    memcpy(bp->counters, *p, 1 << bht_bits);
+    *p += 1 << bht_bits;
+    for (i = 0; i < btb_entries; i++) {
+        bp->btb_tags[i] = get_u64(p);
+        bp->btb_targets[i] = get_u64(p);
+    }
+    /* the pending branch belongs to the execution being replaced */
+    bp->pending = false;
+}
+
+static void warm_lock(bool lock)
+{
+    int i;
+
+    for (i = 0; i < cores; i++) {
+        if (lock) {
+            g_mutex_lock(&l1_dcache_locks[i]);
+            g_mutex_lock(&l1_icache_locks[i]);
+            if (use_l2) {
+                g_mutex_lock(&l2_ucache_locks[i]);
+            }
+        } else {
+            if (use_l2) {
+                g_mutex_unlock(&l2_ucache_locks[i]);
+            }
+            g_mutex_unlock(&l1_icache_locks[i]);
+            g_mutex_unlock(&l1_dcache_locks[i]);
+        }
+    }
+}
+
+static void warm_save(const char *path)
+{
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    g_autoptr(GError) err = NULL;
+    WarmHeader hdr;
+    Cache **caches;
+    int i, c;
+
+    warm_header_init(&hdr);
+    g_byte_array_append(buf, (guint8 *) &hdr, sizeof(hdr));
+
+    warm_lock(true);
+    for (c = 0; c < cores; c++) {
+        for (i = 0; i < WARM_NR_CACHES; i++) {
+            caches = warm_caches(i);
+            if (caches) {
+                cache_save(buf, caches[c]);
+            }
+        }
+        if (use_bpred) {
+            bpred_save(buf, bpreds[c]);
+        }
+    }
+    warm_lock(false);
+
+    g_assert(buf->len == warm_size(&hdr));
+    if (!g_file_set_contents(path, (const gchar *) buf->data, buf->len,
+                             &err)) {
+        g_autofree gchar *out = g_strdup_printf("cache: %s\n", err->message);
+        qemu_plugin_outs(out);
+    }
+}
+
+static void warm_load(const char *path)
+{
+    g_autofree gchar *contents = NULL;
+    g_autoptr(GError) err = NULL;
+    g_autofree gchar *out = NULL;
+    const uint8_t *p;
+    WarmHeader hdr;
+    gsize len;
+    Cache **caches;
+    int i, c;
+
+    if (!g_file_get_contents(path, &contents, &len, &err)) {
+        out = g_strdup_printf("cache: %s, starting cold\n", err->message);
+        qemu_plugin_outs(out);
+        return;
+    }
+
+    warm_header_init(&hdr);
+    if (len != warm_size(&hdr) || memcmp(contents, &hdr, sizeof(hdr))) {
+        out = g_strdup_printf("cache: %s was saved from another "
+                              "configuration, starting cold\n", path);
+        qemu_plugin_outs(out);
+        return;
+    }
+
+    p = (const uint8_t *) contents + sizeof(hdr);
+    warm_lock(true);
+    for (c = 0; c < cores; c++) {
+        for (i = 0; i < WARM_NR_CACHES; i++) {
+            caches = warm_caches(i);
+            if (caches) {
+                cache_load(&p, caches[c]);
+            }
+        }
+        if (use_bpred) {
+            bpred_load(&p, bpreds[c]);
+        }
+    }
+    warm_lock(false);
+}
+
+static void checkpoint(qemu_plugin_id_t id, const char *ckpt, bool save,
+                       void *p)
+{
+    g_autofree gchar *path = g_strdup_printf("%s.cache", ckpt);
+
+    if (save) {
+        warm_save(path);
+    } else {
+        warm_load(path);
+    }
+}
+
 static void append_stats_line(GString *line,
                               uint64_t l1_daccess, uint64_t l1_dmisses,
                               uint64_t l1_iaccess, uint64_t l1_imisses,
@@ -641,6 +1111,23 @@ static void log_stats(void)
     }
 
     g_string_append(rep, "\n");
+
+    if (use_bpred) {
+        g_string_append(rep, "core #, branches, mispredicts,"
+                             " mispredict rate, btb misses\n");
+        for (i = 0; i < cores; i++) {
+            BranchPredictor *bp = bpreds[i];
+            double rate = bp->branches ?
+                ((double) bp->mispredicts) / bp->branches * 100.0 : 0.0;
+
+            g_string_append_printf(rep, "%-8d%-14" PRIu64 " %-12" PRIu64
+                                   " %9.4lf%%  %-12" PRIu64 "\n",
+                                   i, bp->branches, bp->mispredicts, rate,
+                                   bp->btb_misses);
+        }
+        g_string_append(rep, "\n");
+    }
+
     qemu_plugin_outs(rep->str);
 }
 
@@ -716,6 +1203,11 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
         g_free(l2_ucache_locks);
     }
 
+    if (use_bpred) {
+        bpreds_free(bpreds);
+    }
+
+    g_hash_table_destroy(exec_ht);
     g_hash_table_destroy(miss_ht);
 }
 
@@ -767,6 +1259,9 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
 
     policy = LRU;
 
+    bht_bits = 12;
+    btb_entries = 2048;
+
     cores = sys ? qemu_plugin_n_vcpus() : 1;
 
     for (i = 0; i < argc; i++) {
@@ -803,6 +1298,22 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "bhtbits") == 0) {
+            use_bpred = true;
+            bht_bits = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "btbsize") == 0) {
+            use_bpred = true;
+            btb_entries = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "bpred") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &use_bpred)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "warm") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &warm)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "evict") == 0) {
             if (g_strcmp0(tokens[1], "rand") == 0) {
                 policy = RAND;
@@ -846,14 +1357,31 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         return -1;
     }
 
+    if (use_bpred) {
+        if (bht_bits < 1 || bht_bits > 30) {
+            fprintf(stderr, "bhtbits must be between 1 and 30\n");
+            return -1;
+        }
+        if (btb_entries <= 0 || (btb_entries & (btb_entries - 1))) {
+            fprintf(stderr, "btbsize must be a power of two\n");
+            return -1;
+        }
+        bpreds = bpreds_init();
+    }
+
     l1_dcache_locks = g_new0(GMutex, cores);
     l1_icache_locks = g_new0(GMutex, cores);
     l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
 
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    if (warm) {
+        qemu_plugin_register_checkpoint_cb(id, checkpoint, NULL);
+    }
 
     miss_ht = g_hash_table_new_full(NULL, g_direct_equal, NULL, insn_free);
+    exec_ht = g_hash_table_new_full(insn_exec_hash, insn_exec_equal,
+                                    g_free, NULL);
 
     return 0;
 }
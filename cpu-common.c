@@ -23,6 +23,7 @@
 #include "hw/core/cpu.h"
 #include "sysemu/cpus.h"
 #include "qemu/lockable.h"
+#include "qemu/timer.h"
 #include "trace/trace-root.h"
 
 QemuMutex qemu_cpu_list_lock;
@@ -35,6 +36,13 @@ static QemuCond qemu_work_cond;
  */
 static int pending_cpus;
 
+/* The exclusive section in progress, and the statistics of all of them.
+ * Written only inside exclusive sections, read with atomic operations.
+ */
+static ExclusiveCause exclusive_cause;
+static int64_t exclusive_start_ns;
+static ExclusiveStats exclusive_stats[EXCLUSIVE_CAUSE__MAX];
+
 void qemu_init_cpu_list(void)
 {
     /* This is needed because qemu_init_cpu_list is also called by the
@@ -128,6 +136,7 @@ struct qemu_work_item {
     run_on_cpu_func func;
     run_on_cpu_data data;
     bool free, exclusive, done;
+    ExclusiveCause cause;
 };
 
 static void queue_work_on_cpu(CPUState *cpu, struct qemu_work_item *wi)
@@ -186,18 +195,25 @@ static inline void exclusive_idle(void)
     }
 }
 
+static void exclusive_stats_add(uint64_t *stat, uint64_t n)
+{
+    qatomic_set_u64(stat, qatomic_read_u64(stat) + n);
+}
+
 /* Start an exclusive operation.
    Must only be called from outside cpu_exec.  */
-void start_exclusive(void)
+void start_exclusive_for(ExclusiveCause cause)
 {
     CPUState *other_cpu;
     int running_cpus;
+    int64_t wait_start_ns;
 
     if (current_cpu->exclusive_context_count) {
         current_cpu->exclusive_context_count++;
         return;
     }
 
+    wait_start_ns = get_clock();
     qemu_mutex_lock(&qemu_cpu_list_lock);
     exclusive_idle();
 
@@ -226,6 +242,17 @@ void start_exclusive(void)
     qemu_mutex_unlock(&qemu_cpu_list_lock);
 
     current_cpu->exclusive_context_count = 1;
+
+    exclusive_cause = cause;
+    exclusive_start_ns = get_clock();
+    exclusive_stats_add(&exclusive_stats[cause].sections, 1);
+    exclusive_stats_add(&exclusive_stats[cause].wait_ns,
+                        exclusive_start_ns - wait_start_ns);
+}
+
+void start_exclusive(void)
+{
+    start_exclusive_for(EXCLUSIVE_CAUSE_OTHER);
 }
 
 /* Finish an exclusive operation.  */
@@ -236,6 +263,9 @@ void end_exclusive(void)
         return;
     }
 
+    exclusive_stats_add(&exclusive_stats[exclusive_cause].run_ns,
+                        get_clock() - exclusive_start_ns);
+
     qemu_mutex_lock(&qemu_cpu_list_lock);
     qatomic_set(&pending_cpus, 0);
     qemu_cond_broadcast(&exclusive_resume);
@@ -317,8 +347,31 @@ void cpu_exec_end(CPUState *cpu)
     }
 }
 
-void async_safe_run_on_cpu(CPUState *cpu, run_on_cpu_func func,
-                           run_on_cpu_data data)
+void exclusive_get_stats(ExclusiveStats *stats)
+{
+    for (int i = 0; i < EXCLUSIVE_CAUSE__MAX; i++) {
+        stats[i].sections = qatomic_read_u64(&exclusive_stats[i].sections);
+        stats[i].batched = qatomic_read_u64(&exclusive_stats[i].batched);
+        stats[i].wait_ns = qatomic_read_u64(&exclusive_stats[i].wait_ns);
+        stats[i].run_ns = qatomic_read_u64(&exclusive_stats[i].run_ns);
+    }
+}
+
+const char *exclusive_cause_name(ExclusiveCause cause)
+{
+    static const char * const names[EXCLUSIVE_CAUSE__MAX] = {
+        [EXCLUSIVE_CAUSE_OTHER] = "other",
+        [EXCLUSIVE_CAUSE_SAFE_WORK] = "safe work",
+        [EXCLUSIVE_CAUSE_ATOMIC] = "atomic",
+        [EXCLUSIVE_CAUSE_TB_FLUSH] = "tb flush",
+        [EXCLUSIVE_CAUSE_TLB_FLUSH] = "tlb flush",
+    };
+
+    return names[cause];
+}
+
+void async_safe_run_on_cpu_for(CPUState *cpu, ExclusiveCause cause,
+                               run_on_cpu_func func, run_on_cpu_data data)
 {
     struct qemu_work_item *wi;
 
@@ -327,10 +380,27 @@ void async_safe_run_on_cpu(CPUState *cpu, run_on_cpu_func func,
     wi->data = data;
     wi->free = true;
     wi->exclusive = true;
+    wi->cause = cause;
 
     queue_work_on_cpu(cpu, wi);
 }
 
+void async_safe_run_on_cpu(CPUState *cpu, run_on_cpu_func func,
+                           run_on_cpu_data data)
+{
+    async_safe_run_on_cpu_for(cpu, EXCLUSIVE_CAUSE_SAFE_WORK, func, data);
+}
+
+/* Called with cpu->work_mutex held.  */
+static void work_item_done(struct qemu_work_item *wi)
+{
+    if (wi->free) {
+        g_free(wi);
+    } else {
+        qatomic_store_release(&wi->done, true);
+    }
+}
+
 void process_queued_cpu_work(CPUState *cpu)
 {
     struct qemu_work_item *wi;
@@ -352,18 +422,41 @@ void process_queued_cpu_work(CPUState *cpu)
              * neither CPU can proceed.
              */
             qemu_mutex_unlock_iothread();
-            start_exclusive();
-            wi->func(cpu, wi->data);
+            start_exclusive_for(wi->cause);
+            for (;;) {
+                struct qemu_work_item *next;
+
+                wi->func(cpu, wi->data);
+
+                /*
+                 * Run the safe work of the same cause queued right after
+                 * this item in the same section, rather than let the
+                 * other CPUs resume only to stop them again.  Work of
+                 * another cause gets its own section, so that its time
+                 * is accounted to it.
+                 */
+                qemu_mutex_lock(&cpu->work_mutex);
+                next = QSIMPLEQ_FIRST(&cpu->work_list);
+                if (next && next->exclusive && next->cause == wi->cause) {
+                    QSIMPLEQ_REMOVE_HEAD(&cpu->work_list, node);
+                } else {
+                    next = NULL;
+                }
+                work_item_done(wi);
+                qemu_mutex_unlock(&cpu->work_mutex);
+                if (!next) {
+                    break;
+                }
+                wi = next;
+                exclusive_stats_add(&exclusive_stats[wi->cause].batched, 1);
+            }
             end_exclusive();
             qemu_mutex_lock_iothread();
+            qemu_mutex_lock(&cpu->work_mutex);
         } else {
             wi->func(cpu, wi->data);
-        }
-        qemu_mutex_lock(&cpu->work_mutex);
-        if (wi->free) {
-            g_free(wi);
-        } else {
-            qatomic_store_release(&wi->done, true);
+            qemu_mutex_lock(&cpu->work_mutex);
+            work_item_done(wi);
         }
     }
     qemu_mutex_unlock(&cpu->work_mutex);
@@ -269,6 +269,25 @@ SRST
     Show dynamic compiler info.
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "code-cache",
+        .args_type  = "top:i?",
+        .params     = "[top]",
+        .help       = "show dynamic compiler code cache statistics and the "
+                      "top most executed blocks (default: 10)",
+        .cmd        = hmp_info_code_cache,
+    },
+#endif
+
+SRST
+  ``info code-cache`` [*top*]
+    Show the fill of each dynamic compiler code region, the distribution
+    of translation block sizes, code cache flushes, the average
+    translation time and the *top* most executed blocks (default: 10).
+    Blocks are only counted with ``-accel tcg,tb-profile=on``.
+ERST
+
 #if defined(CONFIG_TCG)
     {
         .name       = "opcount",
@@ -178,6 +178,43 @@ void tlb_flush_by_mmuidx_all_cpus(CPUState *cpu, uint16_t idxmap);
  * depend on when the guests translation ends the TB.
  */
 void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu, uint16_t idxmap);
+/**
+ * tlb_set_context_by_mmuidx:
+ * @cpu: CPU whose TLB is switched
+ * @idxmap: bitmap of MMU indexes to switch
+ * @ctx: the address space context now in use, e.g. an ASID
+ *
+ * Set aside the entries of the specified MMU indexes for the context
+ * used until now, and continue with those set aside earlier for @ctx,
+ * or with none.  The entries set aside stay subject to every flush of
+ * the MMU indexes, except for those that are by context, see
+ * tlb_flush_context_by_mmuidx.  Flushing all entries drops them, after
+ * which the context is unknown until the next switch.  Must be called
+ * by @cpu itself; from another thread this is tlb_flush_by_mmuidx.
+ */
+void tlb_set_context_by_mmuidx(CPUState *cpu, uint16_t idxmap, uint64_t ctx);
+/**
+ * tlb_flush_context_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @idxmap: bitmap of MMU indexes to flush
+ * @ctx: the context to flush, as passed to tlb_set_context_by_mmuidx
+ *
+ * Flush all entries of context @ctx from the TLB of the specified CPU,
+ * for the specified MMU indexes, including those of an unknown context.
+ */
+void tlb_flush_context_by_mmuidx(CPUState *cpu, uint16_t idxmap, uint64_t ctx);
+/**
+ * tlb_flush_context_by_mmuidx_all_cpus_synced:
+ * @cpu: Originating CPU of the flush
+ * @idxmap: bitmap of MMU indexes to flush
+ * @ctx: the context to flush
+ *
+ * Like tlb_flush_context_by_mmuidx, for all CPUs, with the work of the
+ * source vCPU scheduled as safe work like tlb_flush_all_cpus_synced.
+ */
+void tlb_flush_context_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                                 uint16_t idxmap,
+                                                 uint64_t ctx);
 
 /**
  * tlb_flush_page_bits_by_mmuidx
@@ -329,6 +366,19 @@ static inline void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                        uint16_t idxmap)
 {
 }
+static inline void tlb_set_context_by_mmuidx(CPUState *cpu, uint16_t idxmap,
+                                             uint64_t ctx)
+{
+}
+static inline void tlb_flush_context_by_mmuidx(CPUState *cpu, uint16_t idxmap,
+                                               uint64_t ctx)
+{
+}
+static inline void tlb_flush_context_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                                               uint16_t idxmap,
+                                                               uint64_t ctx)
+{
+}
 static inline void tlb_flush_page_bits_by_mmuidx(CPUState *cpu,
                                                  vaddr addr,
                                                  uint16_t idxmap,
@@ -465,6 +515,12 @@ static inline uint32_t tb_cflags(const TranslationBlock *tb)
     return qatomic_read(&tb->cflags);
 }
 
+/* The cflags that a TB is looked up with */
+static inline uint32_t tb_cflags_key(const TranslationBlock *tb)
+{
+    return tb_cflags(tb) & ~CF_SUPERBLOCK;
+}
+
 static inline tb_page_addr_t tb_page_addr0(const TranslationBlock *tb)
 {
 #ifdef CONFIG_USER_ONLY
@@ -0,0 +1,150 @@
+/*
+ * QFlex instruction-record rings
+ *
+ * One single-producer/single-consumer ring per vCPU, carrying instruction
+ * records from the TCG side to the timing model.  All rings
+ * live in one shared memory region (a memfd when the host has it), so
+ * the timing model can consume them from another thread or another
+ * process while functional emulation keeps running.
+ *
+ * The region starts with a QFlexRingHeader, followed by @nr_rings rings
+ * each @ring_stride bytes apart.
+ *
+ * The records of executed instructions and their memory accesses come
+ * from the per-vCPU trace buffers of the plugin layer, see
+ * qemu_plugin_register_vcpu_trace_cb(), and are pushed when a buffer is
+ * flushed.  Exceptions are pushed as they are taken.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef EXEC_QFLEX_RING_H
+#define EXEC_QFLEX_RING_H
+
+#include "qemu/spsc-ring.h"
+#include "qemu/qemu-plugin.h"
+
+#define QFLEX_RING_MAGIC    0x51464c58 /* "QFLX" */
+#define QFLEX_RING_VERSION  2
+
+typedef struct QFlexRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nr_rings;
+    uint32_t nr_slots;
+    uint64_t ring_offset;
+    uint64_t ring_stride;
+    uint64_t dropped;       /* records lost to full rings, all vCPUs */
+} QFlexRingHeader;
+
+/*
+ * An instruction executed at @pc, with its first memory access if any.
+ * Each further access of the same instruction gets a record of its own,
+ * with QFLEX_INSN_MORE set.
+ */
+typedef struct QFlexInsnRecord {
+    uint64_t pc;
+    uint64_t mem_vaddr;     /* valid with QFLEX_INSN_LOAD/STORE */
+    int32_t excp;           /* valid with QFLEX_INSN_EXCP */
+    uint16_t mem_size;      /* bytes accessed */
+    uint8_t flags;
+    uint8_t pad;
+} QFlexInsnRecord;
+
+/* QFlexInsnRecord.flags */
+#define QFLEX_INSN_LOAD     (1u << 0)
+#define QFLEX_INSN_STORE    (1u << 1)
+/* Exception taken at @pc, not an executed instruction */
+#define QFLEX_INSN_EXCP     (1u << 2)
+/* Another access of the instruction of the previous record */
+#define QFLEX_INSN_MORE     (1u << 3)
+
+/* Size of the trace buffers feeding the rings, in trace records */
+#define QFLEX_RING_TRACE_RECORDS 4096
+
+extern bool qflex_rings_enabled;
+
+/**
+ * qflex_rings_init:
+ * @nr_vcpus: number of rings to create, one per cpu_index
+ * @nr_slots: records per ring, must be a power of two
+ * @errp: error object
+ *
+ * Allocate and initialise the shared ring region.  Returns false on
+ * failure.
+ */
+bool qflex_rings_init(int nr_vcpus, uint32_t nr_slots, Error **errp);
+
+/**
+ * qflex_rings_fd:
+ *
+ * Returns the file descriptor backing the ring region, for the consumer
+ * to map, or -1 if the region is private to this process.
+ */
+int qflex_rings_fd(void);
+
+/**
+ * qflex_rings_size:
+ *
+ * Returns the size of the ring region in bytes.
+ */
+size_t qflex_rings_size(void);
+
+/**
+ * qflex_rings_dropped:
+ *
+ * Returns the number of records dropped so far because the consumer
+ * did not make room in time.
+ */
+uint64_t qflex_rings_dropped(void);
+
+/**
+ * qflex_ring_get:
+ * @cpu_index: vCPU
+ *
+ * Returns the ring fed by vCPU @cpu_index, or NULL if there is none,
+ * e.g. for a vCPU hotplugged beyond the count given to qflex_rings_init().
+ */
+SPSCRing *qflex_ring_get(int cpu_index);
+
+QFlexInsnRecord *qflex_ring_reserve_slow(SPSCRing *ring);
+
+/**
+ * qflex_ring_reserve:
+ * @ring: ring of the vCPU producing the record
+ *
+ * Returns the next record to fill in place, waiting a few milliseconds
+ * for the consumer to make room if the ring is full.  Returns NULL if it
+ * still is, the record being counted in qflex_rings_dropped().
+ * Publish the record with spsc_ring_commit().
+ */
+static inline QFlexInsnRecord *qflex_ring_reserve(SPSCRing *ring)
+{
+    QFlexInsnRecord *rec = spsc_ring_reserve(ring);
+
+    if (unlikely(!rec)) {
+        rec = qflex_ring_reserve_slow(ring);
+    }
+    return rec;
+}
+
+/* Record that @cpu is taking exception @excp at @pc */
+void qflex_ring_push_exception(int cpu_index, uint64_t pc, int excp);
+
+/**
+ * qflex_ring_push_trace:
+ * @cpu_index: vCPU that filled the trace buffer
+ * @recs: trace records, oldest first
+ * @n: number of records
+ * @opaque: unused
+ *
+ * Push the instructions and memory accesses of a trace buffer to the
+ * ring of vCPU @cpu_index.  This is the qemu_plugin_vcpu_trace_cb_t
+ * registered when the rings are created.
+ */
+void qflex_ring_push_trace(unsigned int cpu_index,
+                           const struct qemu_plugin_trace_record *recs,
+                           size_t n, void *opaque);
+
+#endif /* EXEC_QFLEX_RING_H */
@@ -77,6 +77,11 @@ struct TranslationBlock {
 #define CF_PARALLEL      0x00008000 /* Generate code for a parallel context */
 #define CF_NOIRQ         0x00010000 /* Generate an uninterruptible TB */
 #define CF_PCREL         0x00020000 /* Opcodes in TB are PC-relative */
+/*
+ * Hot trace that may continue past direct branches.  Not part of the
+ * lookup key: a superblock replaces the TB it was retranslated from.
+ */
+#define CF_SUPERBLOCK    0x00040000
 #define CF_CLUSTER_MASK  0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 
@@ -88,6 +93,22 @@ struct TranslationBlock {
     uint16_t size;
     uint16_t icount;
 
+    /*
+     * Slot of tb_hotness[] this TB counts its executions down in, to be
+     * retranslated as a superblock when it reaches zero; -1 if it never is.
+     */
+    int32_t hot_slot;
+
+    /* Slot of tb_exec_count[] counting executions of this TB, or -1.  */
+    int32_t profile_slot;
+
+    /*
+     * Targets of the direct jumps out of this TB that stay on its first
+     * page, such as the taken branch and the fall-through, for the
+     * translation workers to translate ahead; -1 if unused.
+     */
+    vaddr succ_pc[2];
+
     struct tb_tc tc;
 
     /*
@@ -140,6 +161,18 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /*
+     * Entries of the vCPUs' branch caches that were pointed at this TB,
+     * to be cleared when it is invalidated.  Some may have been pointed
+     * at other TBs since.  If there were more than TB_BC_REFS of them at
+     * once, bc_overflow is set and all branch caches are looked through.
+     * Protected by jmp_lock, as is the test of CF_INVALID that comes
+     * before adding an entry.
+     */
+#define TB_BC_REFS 4
+    struct CPUBranchCacheEntry *bc_refs[TB_BC_REFS];
+    bool bc_overflow;
 };
 
 /* The alignment given to TranslationBlock during allocation. */
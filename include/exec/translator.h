@@ -88,6 +88,8 @@ typedef struct DisasContextBase {
     int8_t saved_can_do_io;
     bool plugin_enabled;
     void *host_addr[2];
+    /* End of the guest code translated before following a branch back */
+    target_ulong pc_end;
 } DisasContextBase;
 
 /**
@@ -159,6 +161,21 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+/**
+ * translator_follow_branch
+ * @db: Disassembly context
+ * @dest: target pc of a direct branch
+ *
+ * In a superblock (CF_SUPERBLOCK), continue translating at @dest instead
+ * of ending the TB after the current branch insn, and return true.  The
+ * caller must then emit the exits for the paths not followed itself.
+ * Return false if the TB must end as usual.
+ *
+ * Only targets on the first page of the TB, at or after its first insn,
+ * can be followed, so that the TB still covers one range of guest code.
+ */
+bool translator_follow_branch(DisasContextBase *db, vaddr dest);
+
 /**
  * translator_io_start
  * @db: Disassembly context
@@ -234,6 +234,14 @@ typedef struct CPUTLBEntryFull {
     /* @lg_page_size contains the log2 of the page size. */
     uint8_t lg_page_size;
 
+    /*
+     * @contiguous is set if a single descriptor maps the whole page of
+     * @lg_page_size, with the same attributes and protections, so that
+     * the other pages it covers can be filled without tlb_fill.
+     * Otherwise @lg_page_size is only used for invalidation.
+     */
+    bool contiguous;
+
     /*
      * Additional tlb flags for use by the slow path. If non-zero,
      * the corresponding CPUTLBEntry comparator must have TLB_FORCE_SLOW.
@@ -262,6 +270,35 @@ typedef struct CPUTLBEntryFull {
     } extra;
 } CPUTLBEntryFull;
 
+#define CPU_LTLB_SIZE 16
+
+/*
+ * A guest translation for a page larger than TARGET_PAGE_SIZE, which
+ * covers the addresses for which (addr & mask) == addr.  full is as
+ * passed to tlb_set_page_full, with phys_addr for the start of the page.
+ */
+typedef struct CPUTLBLargePage {
+    vaddr addr;
+    vaddr mask;
+    CPUTLBEntryFull full;
+} CPUTLBLargePage;
+
+#define CPU_TLB_CONTEXTS 8
+
+/*
+ * The tlb of one MMU mode for an address space context other than the
+ * current one, set aside by tlb_set_context_by_mmuidx until the cpu
+ * switches back to it.  Unused if f.table is NULL.
+ */
+typedef struct CPUTLBContext {
+    uint64_t ctx;
+    CPUTLBDescFast f;
+    CPUTLBEntryFull *fulltlb;
+    size_t n_used_entries;
+    vaddr large_page_addr;
+    vaddr large_page_mask;
+} CPUTLBContext;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
@@ -275,6 +312,13 @@ typedef struct CPUTLBDesc {
      */
     vaddr large_page_addr;
     vaddr large_page_mask;
+    /*
+     * The most recent large page translations, all of which are within
+     * the region above.  A tlb miss within one of them is filled from it,
+     * one TARGET_PAGE_SIZE entry at a time, without calling tlb_fill.
+     */
+    size_t lindex;
+    CPUTLBLargePage ltlb[CPU_LTLB_SIZE];
     /* host time (in ns) at the beginning of the time window */
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
@@ -286,8 +330,29 @@ typedef struct CPUTLBDesc {
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
+    /*
+     * The address space context that the entries above belong to, as
+     * passed to tlb_set_context_by_mmuidx, and the tlbs of the contexts
+     * used most recently before it.
+     */
+    uint64_t ctx;
+    size_t ctx_index;
+    CPUTLBContext saved[CPU_TLB_CONTEXTS];
 } CPUTLBDesc;
 
+#define CPU_TLB_PENDING_SIZE 16
+
+/*
+ * A flush of the pages in [addr, addr + len) that match under the low
+ * @bits bits of the address, from the tlbs of the MMU modes in idxmap.
+ */
+typedef struct CPUTLBFlushRange {
+    vaddr addr;
+    vaddr len;
+    uint16_t idxmap;
+    uint16_t bits;
+} CPUTLBFlushRange;
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -300,6 +365,16 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Flushes queued by other cpus, to be done by a single work item,
+     * once pending_queued.  The MMU modes in pending_full are flushed
+     * entirely, instead of the ranges in pending that are for them.
+     * Protected by tlb_c.lock.
+     */
+    bool pending_queued;
+    uint16_t pending_full;
+    size_t n_pending;
+    CPUTLBFlushRange pending[CPU_TLB_PENDING_SIZE];
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -308,6 +383,10 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t merge_flush_count;
+    size_t large_page_fill_count;
+    size_t ctx_switch_count;
+    size_t ctx_restore_count;
 } CPUTLBCommon;
 
 /*
@@ -324,6 +403,37 @@ typedef struct CPUTLB {
 #endif
 } CPUTLB;
 
+/*
+ * Predicted targets of indirect branches, checked inline by the branch
+ * itself before calling helper_lookup_tb_ptr; see
+ * tcg_gen_lookup_and_goto_ptr_cached.  An entry is keyed by the
+ * TranslationBlock containing the branch, whose flags determine those
+ * of the target, and by the target pc.  The first half is indexed by
+ * the pc of the branch, the second half by the pc of the call insn
+ * whose return is predicted; the return stack holds indexes into the
+ * second half.
+ */
+#define CPU_BRANCH_CACHE_BITS 8
+#define CPU_BRANCH_CACHE_SIZE (1 << CPU_BRANCH_CACHE_BITS)
+#define CPU_RETURN_STACK_BITS 4
+#define CPU_RETURN_STACK_SIZE (1 << CPU_RETURN_STACK_BITS)
+
+typedef struct CPUBranchCacheEntry {
+    /* Read by this cpu only; other threads may clear site concurrently. */
+    const TranslationBlock *site;
+    vaddr pc;
+    const void *ptr;
+    TranslationBlock *tb;
+} CPUBranchCacheEntry;
+
+typedef struct CPUBranchCache {
+#ifdef CONFIG_TCG
+    CPUBranchCacheEntry entry[2 * CPU_BRANCH_CACHE_SIZE];
+    uint32_t ret_stack[CPU_RETURN_STACK_SIZE];
+    uint32_t ret_top;
+#endif
+} CPUBranchCache;
+
 /*
  * Low 16 bits: number of cycles left, used only in icount mode.
  * High 16 bits: Set to -1 to force TCG to stop executing linked TBs
@@ -349,6 +459,8 @@ typedef union IcountDecr {
  * via small negative offsets.
  */
 typedef struct CPUNegativeOffsetState {
+    /* First, so as not to move tlb further away from CPUArchState. */
+    CPUBranchCache bc;
     CPUTLB tlb;
     IcountDecr icount_decr;
     bool can_do_io;
@@ -536,6 +648,7 @@ struct CPUState {
 
 #ifdef CONFIG_PLUGIN
     GArray *plugin_mem_cbs;
+    struct qemu_plugin_trace_buf *plugin_trace;
 #endif
 
     /* TODO Move common fields from CPUArchState here. */
@@ -891,6 +1004,33 @@ void async_run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data)
  */
 void async_safe_run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data);
 
+/**
+ * ExclusiveCause:
+ *
+ * What an exclusive section is for, to account the time spent in it.
+ */
+typedef enum ExclusiveCause {
+    EXCLUSIVE_CAUSE_OTHER,
+    EXCLUSIVE_CAUSE_SAFE_WORK,
+    EXCLUSIVE_CAUSE_ATOMIC,
+    EXCLUSIVE_CAUSE_TB_FLUSH,
+    EXCLUSIVE_CAUSE_TLB_FLUSH,
+    EXCLUSIVE_CAUSE__MAX,
+} ExclusiveCause;
+
+/**
+ * async_safe_run_on_cpu_for:
+ * @cpu: The vCPU to run on.
+ * @cause: What the function is run for.
+ * @func: The function to be executed.
+ * @data: Data to pass to the function.
+ *
+ * Like async_safe_run_on_cpu, with the exclusive section accounted
+ * to @cause.
+ */
+void async_safe_run_on_cpu_for(CPUState *cpu, ExclusiveCause cause,
+                               run_on_cpu_func func, run_on_cpu_data data);
+
 /**
  * cpu_in_exclusive_context()
  * @cpu: The vCPU to check
@@ -1026,6 +1166,14 @@ void cpu_exec_end(CPUState *cpu);
  */
 void start_exclusive(void);
 
+/**
+ * start_exclusive_for:
+ * @cause: What the exclusive section is for.
+ *
+ * Like start_exclusive, with the section accounted to @cause.
+ */
+void start_exclusive_for(ExclusiveCause cause);
+
 /**
  * end_exclusive:
  *
@@ -1033,6 +1181,38 @@ void start_exclusive(void);
  */
 void end_exclusive(void);
 
+/**
+ * ExclusiveStats:
+ * @sections: The number of exclusive sections started.
+ * @batched: The number of safe work items that were run in a section
+ *   started for an earlier one, rather than in one of their own.
+ * @wait_ns: The time spent waiting for the other CPUs to stop.
+ * @run_ns: The time spent with the other CPUs stopped.
+ */
+typedef struct ExclusiveStats {
+    uint64_t sections;
+    uint64_t batched;
+    uint64_t wait_ns;
+    uint64_t run_ns;
+} ExclusiveStats;
+
+/**
+ * exclusive_get_stats:
+ * @stats: An array of EXCLUSIVE_CAUSE__MAX elements.
+ *
+ * Get the statistics of the exclusive sections for each cause, see
+ * start_exclusive_for.  Sections nested in another are not counted.
+ */
+void exclusive_get_stats(ExclusiveStats *stats);
+
+/**
+ * exclusive_cause_name:
+ * @cause: An ExclusiveCause.
+ *
+ * Returns: A short name for @cause.
+ */
+const char *exclusive_cause_name(ExclusiveCause cause);
+
 /**
  * qemu_init_vcpu:
  * @cpu: The vCPU to initialize.
@@ -1044,6 +1224,7 @@ void qemu_init_vcpu(CPUState *cpu);
 #define SSTEP_ENABLE  0x1  /* Enable simulated HW single stepping */
 #define SSTEP_NOIRQ   0x2  /* Do not use IRQ while single stepping */
 #define SSTEP_NOTIMER 0x4  /* Do not Timers while single stepping */
+#define SSTEP_QFLEX   0x8  /* Stepping for QFlex, not for a debugger */
 
 /**
  * cpu_single_step:
@@ -0,0 +1,93 @@
+/*
+ * Incremental, deduplicated guest RAM checkpoints
+ *
+ * A checkpoint directory holds one chain of RAM checkpoints:
+ *
+ *   <tag>.map        one per checkpoint: RAMBlock table, parent tag and,
+ *                    for incremental checkpoints, the pages that changed
+ *   <tag>.<n>.ram    raw, sparse image of RAMBlock n, for the first
+ *                    (full) checkpoint of a chain only
+ *   pages.bin        content-addressed store of every page written by an
+ *                    incremental checkpoint, each distinct page once
+ *
+ * The first save in a process writes a full checkpoint and starts dirty
+ * tracking; every later save writes only the pages dirtied since the
+ * previous save or load, deduplicated against pages.bin.
+ *
+ * This only covers guest RAM; device state is saved by the caller.
+ * Plugins are told about every save and load through their checkpoint
+ * callback, so they can keep files of their own, such as warmed cache
+ * state, next to the checkpoint.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_SNAPSHOT_PAGES_H
+#define QEMU_MIGRATION_SNAPSHOT_PAGES_H
+
+typedef struct SnapshotPageStore SnapshotPageStore;
+
+typedef struct SnapshotPagesStats {
+    uint64_t dirty;         /* pages considered by the last save */
+    uint64_t zero;          /* ... of which were zero pages */
+    uint64_t dedup;         /* ... of which were already in the store */
+    uint64_t written;       /* ... of which were added to the store */
+    uint64_t mapped;        /* bytes mapped by the last lazy load */
+} SnapshotPagesStats;
+
+/**
+ * snapshot_pages_open: Open or create a checkpoint directory.
+ * @dir: directory path, created if missing unless @readonly
+ * @readonly: only load checkpoints, without dirty tracking
+ * @errp: pointer to error object
+ * Any number of processes may open the same directory read-only and load
+ * from it lazily: the pages they share are then backed by one copy in the
+ * host page cache, and each process only holds the pages its guest wrote.
+ * On failure, store an error through @errp and return %NULL.
+ */
+SnapshotPageStore *snapshot_pages_open(const char *dir, bool readonly,
+                                       Error **errp);
+
+/**
+ * snapshot_pages_close: Close a checkpoint directory and stop the dirty
+ * tracking started for it.
+ */
+void snapshot_pages_close(SnapshotPageStore *s);
+
+/**
+ * snapshot_pages_save: Save guest RAM as checkpoint @tag.
+ * @s: checkpoint directory
+ * @tag: checkpoint name
+ * @errp: pointer to error object
+ * The VM must be stopped.
+ * On success, return %true.
+ * On failure, store an error through @errp and return %false.
+ */
+bool snapshot_pages_save(SnapshotPageStore *s, const char *tag, Error **errp);
+
+/**
+ * snapshot_pages_load: Restore guest RAM from checkpoint @tag.
+ * @s: checkpoint directory
+ * @tag: checkpoint name
+ * @lazy: map the full image copy-on-write instead of reading it
+ * @errp: pointer to error object
+ * The VM must be stopped.  Later saves are incremental on top of @tag.
+ * With @lazy, guest pages are read from the image on first access, so the
+ * load takes the same time whatever the size of guest RAM; RAMBlocks that
+ * cannot be remapped (file-backed, shared or huge pages) are still read,
+ * as is all RAM when a device requires RAM discard.  Once RAM has been
+ * mapped, RAM discard stays disabled, e.g. the balloon no longer frees
+ * pages.
+ * On success, return %true.
+ * On failure, store an error through @errp and return %false.
+ */
+bool snapshot_pages_load(SnapshotPageStore *s, const char *tag, bool lazy,
+                         Error **errp);
+
+/**
+ * snapshot_pages_stats: Statistics of the last save or load.
+ */
+const SnapshotPagesStats *snapshot_pages_stats(SnapshotPageStore *s);
+
+#endif
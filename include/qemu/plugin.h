@@ -62,6 +62,7 @@ union qemu_plugin_cb_sig {
     qemu_plugin_vcpu_mem_cb_t        vcpu_mem;
     qemu_plugin_vcpu_syscall_cb_t    vcpu_syscall;
     qemu_plugin_vcpu_syscall_ret_cb_t vcpu_syscall_ret;
+    qemu_plugin_checkpoint_cb_t      checkpoint;
     void *generic;
 };
 
@@ -151,9 +152,32 @@ struct qemu_plugin_tb {
     /* if set, the TB calls helpers that might access guest memory */
     bool mem_helper;
 
+    /* if set, fill the vCPU trace buffers */
+    bool trace;
+    /* trace records the current insn may still append inline */
+    unsigned int trace_inline;
+
     GArray *cbs[PLUGIN_N_CB_SUBTYPES];
 };
 
+/*
+ * Per-vCPU trace buffer, see qemu_plugin_register_vcpu_trace_cb().
+ * Generated code checks for QEMU_PLUGIN_TRACE_SLACK free records at the
+ * start of each instruction, then appends through @cur unchecked.
+ * Helpers append through qemu_plugin_trace_append(), which flushes the
+ * buffer rather than go past @limit, so the slack stays available.
+ */
+#define QEMU_PLUGIN_TRACE_SLACK 32
+
+struct qemu_plugin_trace_buf {
+    struct qemu_plugin_trace_record *cur;
+    /* @end - QEMU_PLUGIN_TRACE_SLACK */
+    struct qemu_plugin_trace_record *limit;
+    struct qemu_plugin_trace_record *start;
+    struct qemu_plugin_trace_record *end;
+    unsigned int cpu_index;
+};
+
 /**
  * qemu_plugin_tb_insn_get(): get next plugin record for translation.
  * @tb: the internal tb context
@@ -199,10 +223,32 @@ void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret);
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              MemOpIdx oi, enum qemu_plugin_mem_rw rw);
 
+void qemu_plugin_trace_flush(struct qemu_plugin_trace_buf *buf);
+void qemu_plugin_trace_append(struct qemu_plugin_trace_buf *buf,
+                              uint64_t addr, uint32_t info);
+
+/* Hand the records of @cpu's trace buffer, if any, to the tracing plugin */
+static inline void qemu_plugin_vcpu_trace_flush(CPUState *cpu)
+{
+    if (unlikely(cpu->plugin_trace)) {
+        qemu_plugin_trace_flush(cpu->plugin_trace);
+    }
+}
+
 void qemu_plugin_flush_cb(void);
 
 void qemu_plugin_atexit_cb(void);
 
+/**
+ * qemu_plugin_checkpoint_cb(): tell plugins about a checkpoint
+ * @path: checkpoint path prefix, "<directory>/<tag>"
+ * @save: the checkpoint was saved rather than loaded
+ *
+ * Called with the VM stopped, so plugins can save or restore their own
+ * state next to the checkpoint files.
+ */
+void qemu_plugin_checkpoint_cb(const char *path, bool save);
+
 void qemu_plugin_add_dyn_cb_arr(GArray *arr);
 
 static inline void qemu_plugin_disable_mem_helpers(CPUState *cpu)
@@ -285,12 +331,18 @@ static inline void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                                            enum qemu_plugin_mem_rw rw)
 { }
 
+static inline void qemu_plugin_vcpu_trace_flush(CPUState *cpu)
+{ }
+
 static inline void qemu_plugin_flush_cb(void)
 { }
 
 static inline void qemu_plugin_atexit_cb(void)
 { }
 
+static inline void qemu_plugin_checkpoint_cb(const char *path, bool save)
+{ }
+
 static inline
 void qemu_plugin_add_dyn_cb_arr(GArray *arr)
 { }
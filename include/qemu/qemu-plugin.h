@@ -50,11 +50,15 @@ typedef uint64_t qemu_plugin_id_t;
  *
  * The plugins export the API they were built against by exposing the
  * symbol qemu_plugin_version which can be checked.
+ *
+ * version 2:
+ * - added qemu_plugin_register_vcpu_trace_cb()
+ * - added qemu_plugin_register_checkpoint_cb()
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 1
+#define QEMU_PLUGIN_VERSION 2
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -94,6 +98,54 @@ typedef struct qemu_info_t {
  */
 qemu_plugin_id_t qemu_plugin_register_builtin(void);
 
+/**
+ * struct qemu_plugin_trace_record - a record in a vCPU trace buffer
+ * @addr: PC of the instruction, or virtual address of the access
+ * @info: QEMU_PLUGIN_TRACE_INSN for an instruction, otherwise the
+ *        qemu_plugin_meminfo_t of a memory access by the last instruction
+ */
+struct qemu_plugin_trace_record {
+    uint64_t addr;
+    uint32_t info;
+    uint32_t pad;
+};
+
+#define QEMU_PLUGIN_TRACE_INSN 0
+
+/**
+ * typedef qemu_plugin_vcpu_trace_cb_t - trace buffer callback type
+ * @vcpu_index: vCPU that filled the buffer
+ * @recs: records, oldest first
+ * @n: number of records
+ * @userdata: user data pointer
+ *
+ * @recs is only valid until the callback returns.
+ */
+typedef void (*qemu_plugin_vcpu_trace_cb_t)(
+    unsigned int vcpu_index, const struct qemu_plugin_trace_record *recs,
+    size_t n, void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_trace_cb() - trace instructions and memory
+ * accesses into per-vCPU buffers
+ * @id: builtin plugin ID
+ * @nr_records: size of each vCPU buffer, in records
+ * @cb: callback consuming the records
+ * @userdata: user data passed to @cb
+ *
+ * Only available to builtin plugins, and to one of them at a time.
+ * Generated code appends a record for every instruction executed and
+ * every memory access performed, without calling out of the code
+ * cache.  @cb is called on the vCPU thread when the buffer is full and
+ * whenever the vCPU leaves its execution loop.  Accesses made by helpers
+ * through host pointers they probed themselves are not recorded.
+ *
+ * Returns 0 on success, -1 if another plugin is already tracing.
+ */
+int qemu_plugin_register_vcpu_trace_cb(qemu_plugin_id_t id, size_t nr_records,
+                                       qemu_plugin_vcpu_trace_cb_t cb,
+                                       void *userdata);
+
 /**
  * qemu_plugin_install() - Install a plugin
  * @id: this plugin's opaque ID
@@ -652,6 +704,34 @@ QEMU_PLUGIN_API
 void qemu_plugin_register_atexit_cb(qemu_plugin_id_t id,
                                     qemu_plugin_udata_cb_t cb, void *userdata);
 
+/**
+ * typedef qemu_plugin_checkpoint_cb_t - checkpoint callback
+ * @id: the unique qemu_plugin_id_t
+ * @path: path prefix of the checkpoint files, "<directory>/<tag>"
+ * @save: true if the checkpoint was just saved, false if just loaded
+ * @userdata: user data supplied when the callback was registered
+ */
+typedef void (*qemu_plugin_checkpoint_cb_t)(qemu_plugin_id_t id,
+                                            const char *path, bool save,
+                                            void *userdata);
+
+/**
+ * qemu_plugin_register_checkpoint_cb() - register checkpoint callback
+ * @id: plugin ID
+ * @cb: callback
+ * @userdata: user data for callback
+ *
+ * The @cb function is called after an external checkpoint of guest RAM
+ * is saved or loaded, with the VM stopped. Plugins modelling
+ * microarchitectural state can write it to, or read it back from, a
+ * file of their own named after @path, so that it travels with the
+ * checkpoint.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_checkpoint_cb(qemu_plugin_id_t id,
+                                        qemu_plugin_checkpoint_cb_t cb,
+                                        void *userdata);
+
 /* returns -1 in user-mode */
 int qemu_plugin_n_vcpus(void);
 
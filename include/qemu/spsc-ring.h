@@ -0,0 +1,199 @@
+/*
+ * Lock-free single-producer/single-consumer ring of fixed-size records
+ *
+ * The ring is a single self-contained block of memory with no pointers
+ * in it, so it can live in memory shared between processes (e.g. a
+ * memfd mapped by both sides).  Exactly one thread may produce and one
+ * thread may consume at any time; neither side ever takes a lock.
+ *
+ * The producer and consumer indexes are free-running 32-bit counters on
+ * separate cache lines.  Each side also keeps a private copy of the
+ * other side's index on its own line, so that the shared line is only
+ * read when the ring looks full (producer) or empty (consumer).
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_SPSC_RING_H
+#define QEMU_SPSC_RING_H
+
+#include "qemu/atomic.h"
+
+#define SPSC_RING_ALIGN 64
+
+typedef struct SPSCRing {
+    /* Producer side */
+    uint32_t head QEMU_ALIGNED(SPSC_RING_ALIGN);
+    uint32_t cached_tail;
+
+    /* Consumer side */
+    uint32_t tail QEMU_ALIGNED(SPSC_RING_ALIGN);
+    uint32_t cached_head;
+
+    /* Read-only once initialised */
+    uint32_t nr_slots QEMU_ALIGNED(SPSC_RING_ALIGN);
+    uint32_t rec_size;
+    uint32_t slot_size;
+
+    uint8_t data[] QEMU_ALIGNED(SPSC_RING_ALIGN);
+} SPSCRing;
+
+/**
+ * spsc_ring_size:
+ * @nr_slots: number of records, must be a power of two
+ * @slot_size: size of one record in bytes
+ *
+ * Returns the number of bytes to allocate for a ring of @nr_slots records
+ * of @slot_size bytes each, header included.
+ */
+static inline size_t spsc_ring_size(uint32_t nr_slots, uint32_t slot_size)
+{
+    return sizeof(SPSCRing) + (size_t)nr_slots * ROUND_UP(slot_size, 8);
+}
+
+/**
+ * spsc_ring_init:
+ * @ring: memory of at least spsc_ring_size(@nr_slots, @slot_size) bytes,
+ *        aligned to SPSC_RING_ALIGN
+ * @nr_slots: number of records, must be a power of two
+ * @slot_size: size of one record in bytes
+ *
+ * Initialise an empty ring.  Must be done before either side uses it.
+ */
+static inline void spsc_ring_init(SPSCRing *ring, uint32_t nr_slots,
+                                  uint32_t slot_size)
+{
+    g_assert(is_power_of_2(nr_slots));
+
+    memset(ring, 0, sizeof(*ring));
+    ring->nr_slots = nr_slots;
+    ring->rec_size = slot_size;
+    ring->slot_size = ROUND_UP(slot_size, 8);
+    smp_wmb();
+}
+
+static inline void *spsc_ring_slot(SPSCRing *ring, uint32_t idx)
+{
+    return ring->data + (idx & (ring->nr_slots - 1)) * ring->slot_size;
+}
+
+/**
+ * spsc_ring_reserve:
+ * @ring: the ring
+ *
+ * Producer side.  Returns a pointer to the next free record for the
+ * caller to fill in place, or NULL if the ring is full.  The record is
+ * only visible to the consumer after spsc_ring_commit().
+ */
+static inline void *spsc_ring_reserve(SPSCRing *ring)
+{
+    uint32_t head = ring->head;
+
+    if (unlikely(head - ring->cached_tail == ring->nr_slots)) {
+        ring->cached_tail = qatomic_load_acquire(&ring->tail);
+        if (head - ring->cached_tail == ring->nr_slots) {
+            return NULL;
+        }
+    }
+    return spsc_ring_slot(ring, head);
+}
+
+/**
+ * spsc_ring_commit:
+ * @ring: the ring
+ *
+ * Producer side.  Publish the record returned by the last
+ * spsc_ring_reserve().
+ */
+static inline void spsc_ring_commit(SPSCRing *ring)
+{
+    qatomic_store_release(&ring->head, ring->head + 1);
+}
+
+/**
+ * spsc_ring_push:
+ * @ring: the ring
+ * @rec: record of the size given to spsc_ring_init()
+ *
+ * Producer side.  Copy @rec into the ring.  Returns false if the ring
+ * is full, in which case nothing is written.
+ */
+static inline bool spsc_ring_push(SPSCRing *ring, const void *rec)
+{
+    void *slot = spsc_ring_reserve(ring);
+
+    if (!slot) {
+        return false;
+    }
+    memcpy(slot, rec, ring->rec_size);
+    spsc_ring_commit(ring);
+    return true;
+}
+
+/**
+ * spsc_ring_peek:
+ * @ring: the ring
+ *
+ * Consumer side.  Returns a pointer to the oldest record, or NULL if
+ * the ring is empty.  The record stays valid until spsc_ring_release().
+ */
+static inline const void *spsc_ring_peek(SPSCRing *ring)
+{
+    uint32_t tail = ring->tail;
+
+    if (unlikely(tail == ring->cached_head)) {
+        ring->cached_head = qatomic_load_acquire(&ring->head);
+        if (tail == ring->cached_head) {
+            return NULL;
+        }
+    }
+    return spsc_ring_slot(ring, tail);
+}
+
+/**
+ * spsc_ring_release:
+ * @ring: the ring
+ *
+ * Consumer side.  Hand the record returned by the last spsc_ring_peek()
+ * back to the producer.
+ */
+static inline void spsc_ring_release(SPSCRing *ring)
+{
+    qatomic_store_release(&ring->tail, ring->tail + 1);
+}
+
+/**
+ * spsc_ring_pop:
+ * @ring: the ring
+ * @rec: buffer of the size given to spsc_ring_init()
+ *
+ * Consumer side.  Copy the oldest record to @rec and remove it from the
+ * ring.  Returns false if the ring is empty.
+ */
+static inline bool spsc_ring_pop(SPSCRing *ring, void *rec)
+{
+    const void *slot = spsc_ring_peek(ring);
+
+    if (!slot) {
+        return false;
+    }
+    memcpy(rec, slot, ring->rec_size);
+    spsc_ring_release(ring);
+    return true;
+}
+
+/**
+ * spsc_ring_count:
+ * @ring: the ring
+ *
+ * Returns the number of records in the ring.  Only a snapshot when
+ * called concurrently with the other side.
+ */
+static inline uint32_t spsc_ring_count(SPSCRing *ring)
+{
+    return qatomic_load_acquire(&ring->head) -
+           qatomic_load_acquire(&ring->tail);
+}
+
+#endif /* QEMU_SPSC_RING_H */
@@ -74,6 +74,37 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_lookup_and_goto_ptr_cached() - as tcg_gen_lookup_and_goto_ptr,
+ * for an indirect branch
+ * @pc: the global holding the new pc
+ * @site: guest address of the branch insn
+ *
+ * Compare @pc inline with the target this branch took last time, and
+ * jump straight to its TB if they match; see CPUBranchCache.  Only valid
+ * when the flags of the next TB are fixed by those of this TB, e.g. for
+ * a branch that does not change the cpu mode.
+ */
+void tcg_gen_lookup_and_goto_ptr_cached(TCGv_i64 pc, uint64_t site);
+
+/**
+ * tcg_gen_push_return() - push a predicted return onto the return stack
+ * @site: guest address of the call insn
+ *
+ * For a call, before tcg_gen_lookup_and_goto_ptr_cached.
+ */
+void tcg_gen_push_return(uint64_t site);
+
+/**
+ * tcg_gen_lookup_and_goto_ptr_return() - as
+ * tcg_gen_lookup_and_goto_ptr_cached, for a return
+ * @pc: the global holding the new pc
+ *
+ * Pop the return stack and compare @pc with the target that the return
+ * to the popped call took last time.
+ */
+void tcg_gen_lookup_and_goto_ptr_return(TCGv_i64 pc);
+
 void tcg_gen_plugin_cb_start(unsigned from, unsigned type, unsigned wr);
 void tcg_gen_plugin_cb_end(void);
 
@@ -513,6 +544,12 @@ static inline void tcg_gen_movi_ptr(TCGv_ptr d, intptr_t s)
     glue(tcg_gen_movi_,PTR)((NAT)d, s);
 }
 
+static inline void tcg_gen_brcond_ptr(TCGCond cond, TCGv_ptr a,
+                                      TCGv_ptr b, TCGLabel *label)
+{
+    glue(tcg_gen_brcond_,PTR)(cond, (NAT)a, (NAT)b, label);
+}
+
 static inline void tcg_gen_brcondi_ptr(TCGCond cond, TCGv_ptr a,
                                        intptr_t b, TCGLabel *label)
 {
@@ -309,6 +309,11 @@ DEF(last_generic, 0, 0, 0, TCG_OPF_NOT_PRESENT)
 /* These opcodes are only for use between the tci generator and interpreter. */
 DEF(tci_movi, 1, 0, 1, TCG_OPF_NOT_PRESENT)
 DEF(tci_movl, 1, 0, 1, TCG_OPF_NOT_PRESENT)
+/* Superinstructions: the first insn of a pair, which also runs the second. */
+DEF(tci_brcond_i32, 1, 2, 1, TCG_OPF_NOT_PRESENT)
+DEF(tci_brcond_i64, 1, 2, 1, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_add_i32, 1, 1, 1, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld_add_i64, 1, 1, 1, TCG_OPF_NOT_PRESENT)
 #endif
 
 #undef DATA64_ARGS
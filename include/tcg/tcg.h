@@ -211,10 +211,16 @@ struct TCGLabelUse {
 };
 
 typedef struct TCGLabel TCGLabel;
+typedef struct TCGLabelGlobal TCGLabelGlobal;
 struct TCGLabel {
     bool present;
     bool has_value;
+    /* Reached only by one forward conditional branch: globals are
+       synced here rather than at the branch.  */
+    bool side_exit;
     uint16_t id;
+    int nb_side_globals;
+    TCGLabelGlobal *side_globals;
     union {
         uintptr_t value;
         const tcg_insn_unit *value_ptr;
@@ -499,6 +505,7 @@ struct TCGContext {
     TCGTemp *frame_temp;
 
     TranslationBlock *gen_tb;     /* tb for which code is being generated */
+    bool gen_ahead;               /* ... by tb_gen_code_ahead() */
     tcg_insn_unit *code_buf;      /* pointer for start of tb */
     tcg_insn_unit *code_ptr;      /* pointer for running end of tb */
 
@@ -755,10 +762,19 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict(void (*invalidate)(TranslationBlock *tb));
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
 
+typedef struct TCGRegionUsage {
+    size_t used;        /* bytes of code and TBs */
+    size_t size;        /* bytes available for them */
+    int ctx;            /* index in tcg_ctxs[] of the context using it, or -1 */
+} TCGRegionUsage;
+
+size_t tcg_region_usage(TCGRegionUsage *usage, size_t n);
+
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
@@ -1019,6 +1035,11 @@ static inline size_t tcg_current_code_size(TCGContext *s)
 
 #ifdef CONFIG_TCG_INTERPRETER
 uintptr_t tcg_qemu_tb_exec(CPUArchState *env, const void *tb_ptr);
+/*
+ * Threaded dispatch, superinstructions and inline TLB lookups in the
+ * interpreter; off, it runs every insn through its switch.
+ */
+extern bool tci_fast_path;
 #else
 typedef uintptr_t tcg_prologue_fn(CPUArchState *env, const void *tb_ptr);
 extern tcg_prologue_fn *tcg_qemu_tb_exec;
@@ -0,0 +1,822 @@
+/*
+ * Incremental, deduplicated guest RAM checkpoints
+ *
+ * See include/migration/snapshot-pages.h for the directory layout.  All
+ * files are in host byte order: checkpoints are meant to be restored on
+ * the machine that took them.
+ *
+ * Dirty pages are tracked with the DIRTY_MEMORY_MIGRATION bitmap under
+ * GLOBAL_DIRTY_SNAPSHOT.  Migration consumes the same bitmap, so saves
+ * are refused while one is in progress; a migration between two saves
+ * leaves the second one incomplete.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/bitops.h"
+#include "qemu/cutils.h"
+#include "qemu/plugin.h"
+#include "qemu/rcu.h"
+#include "exec/memory.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "hw/boards.h"
+#include "migration/misc.h"
+#include "migration/snapshot-pages.h"
+#include "sysemu/qtest.h"
+#include "sysemu/runstate.h"
+#include "ram.h"
+#include "trace.h"
+
+#define SNAPSHOT_MAP_MAGIC      0x514d4150 /* "QMAP" */
+#define SNAPSHOT_MAP_VERSION    1
+#define SNAPSHOT_MAP_FULL       (1u << 0)
+#define SNAPSHOT_TAG_MAX        128
+#define SNAPSHOT_CHAIN_MAX      4096
+#define SNAPSHOT_PAGE_ZERO      UINT64_MAX
+/* Delta runs a lazy load maps, well under the default vm.max_map_count */
+#define SNAPSHOT_MAP_RUNS_MAX   16384
+
+typedef struct SnapshotMapHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t page_size;
+    uint32_t nr_blocks;
+    uint32_t reserved;
+    uint64_t nr_entries;
+    char parent[SNAPSHOT_TAG_MAX];
+} SnapshotMapHeader;
+
+typedef struct SnapshotMapBlock {
+    char idstr[256];
+    uint64_t used_length;
+} SnapshotMapBlock;
+
+typedef struct SnapshotMapEntry {
+    uint32_t block;
+    uint32_t reserved;
+    uint64_t offset;        /* in the RAMBlock */
+    uint64_t page;          /* in pages.bin, or SNAPSHOT_PAGE_ZERO */
+} SnapshotMapEntry;
+
+/* Both key and value of the page index; g_int64_hash() reads @hash */
+typedef struct SnapshotIndexEntry {
+    uint64_t hash;
+    uint64_t page;
+} SnapshotIndexEntry;
+
+struct SnapshotPageStore {
+    char *dir;
+    bool readonly;
+    int store_fd;
+    uint64_t store_pages;
+    GHashTable *index;
+    /* Last checkpoint saved or loaded, parent of the next save */
+    char *parent;
+    GArray *parent_blocks;
+    bool tracking;
+    uint8_t *buf;
+    SnapshotPagesStats stats;
+};
+
+static uint64_t snapshot_page_hash(const void *page, size_t size)
+{
+    const uint64_t *p = page;
+    uint64_t h0 = 0x9e3779b97f4a7c15ull, h1 = 0xc2b2ae3d27d4eb4full;
+    uint64_t h2 = 0x165667b19e3779f9ull, h3 = 0x27d4eb2f165667c5ull;
+    size_t i;
+
+    /* Four independent lanes so the multiplies can overlap */
+    for (i = 0; i < size / 8; i += 4) {
+        h0 = (h0 ^ p[i + 0]) * 0xff51afd7ed558ccdull;
+        h1 = (h1 ^ p[i + 1]) * 0xff51afd7ed558ccdull;
+        h2 = (h2 ^ p[i + 2]) * 0xff51afd7ed558ccdull;
+        h3 = (h3 ^ p[i + 3]) * 0xff51afd7ed558ccdull;
+        h0 ^= h0 >> 29;
+        h1 ^= h1 >> 29;
+        h2 ^= h2 >> 29;
+        h3 ^= h3 >> 29;
+    }
+    return h0 ^ ror64(h1, 17) ^ ror64(h2, 31) ^ ror64(h3, 47);
+}
+
+static bool snapshot_pwrite_full(int fd, const void *buf, size_t len,
+                                 off_t offset, Error **errp)
+{
+    while (len) {
+        ssize_t ret = pwrite(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno, "Could not write checkpoint");
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+static bool snapshot_pread_full(int fd, void *buf, size_t len,
+                                off_t offset, Error **errp)
+{
+    while (len) {
+        ssize_t ret = pread(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno, "Could not read checkpoint");
+            return false;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Checkpoint file is truncated");
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+static char *snapshot_map_path(SnapshotPageStore *s, const char *tag)
+{
+    g_autofree char *name = g_strdup_printf("%s.map", tag);
+
+    return g_build_filename(s->dir, name, NULL);
+}
+
+static char *snapshot_image_path(SnapshotPageStore *s, const char *tag,
+                                 unsigned int block)
+{
+    g_autofree char *name = g_strdup_printf("%s.%u.ram", tag, block);
+
+    return g_build_filename(s->dir, name, NULL);
+}
+
+/* Let plugins save or restore their own state next to checkpoint @tag */
+static void snapshot_pages_notify(SnapshotPageStore *s, const char *tag,
+                                  bool save)
+{
+    g_autofree char *path = g_build_filename(s->dir, tag, NULL);
+
+    qemu_plugin_checkpoint_cb(path, save);
+}
+
+/* Must be called within an RCU critical section */
+static GArray *snapshot_pages_blocks(GPtrArray *rbs)
+{
+    GArray *blocks = g_array_new(false, true, sizeof(SnapshotMapBlock));
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        SnapshotMapBlock b = { .used_length = block->used_length };
+
+        pstrcpy(b.idstr, sizeof(b.idstr), block->idstr);
+        g_array_append_val(blocks, b);
+        g_ptr_array_add(rbs, block);
+    }
+    return blocks;
+}
+
+static bool snapshot_blocks_equal(GArray *a, const SnapshotMapBlock *b,
+                                  uint32_t nr_blocks)
+{
+    return a->len == nr_blocks &&
+           !memcmp(a->data, b, nr_blocks * sizeof(SnapshotMapBlock));
+}
+
+static void snapshot_pages_set_parent(SnapshotPageStore *s, const char *tag,
+                                      GArray *blocks)
+{
+    g_free(s->parent);
+    s->parent = g_strdup(tag);
+    if (s->parent_blocks) {
+        g_array_unref(s->parent_blocks);
+    }
+    s->parent_blocks = g_array_ref(blocks);
+}
+
+/*
+ * Start tracking from the current content of guest RAM, which is what
+ * the checkpoint just saved or loaded holds.
+ */
+static void snapshot_pages_track(SnapshotPageStore *s, GPtrArray *rbs)
+{
+    unsigned int i;
+
+    if (!s->tracking) {
+        memory_global_dirty_log_start(GLOBAL_DIRTY_SNAPSHOT);
+        s->tracking = true;
+    }
+
+    for (i = 0; i < rbs->len; i++) {
+        RAMBlock *rb = g_ptr_array_index(rbs, i);
+
+        g_free(memory_region_snapshot_and_clear_dirty(rb->mr, 0,
+                                                      rb->used_length,
+                                                      DIRTY_MEMORY_MIGRATION));
+    }
+}
+
+static void snapshot_index_add(SnapshotPageStore *s, uint64_t hash,
+                               uint64_t page)
+{
+    SnapshotIndexEntry *e;
+
+    if (g_hash_table_contains(s->index, &hash)) {
+        return;
+    }
+    e = g_new(SnapshotIndexEntry, 1);
+    e->hash = hash;
+    e->page = page;
+    g_hash_table_add(s->index, e);
+}
+
+/* Find @data in pages.bin, or append it there */
+static bool snapshot_store_page(SnapshotPageStore *s, const void *data,
+                                uint64_t *page, Error **errp)
+{
+    size_t size = qemu_target_page_size();
+    uint64_t hash = snapshot_page_hash(data, size);
+    SnapshotIndexEntry *e = g_hash_table_lookup(s->index, &hash);
+
+    if (e) {
+        if (!snapshot_pread_full(s->store_fd, s->buf, size,
+                                 e->page * size, errp)) {
+            return false;
+        }
+        if (!memcmp(s->buf, data, size)) {
+            *page = e->page;
+            s->stats.dedup++;
+            return true;
+        }
+    }
+
+    if (!snapshot_pwrite_full(s->store_fd, data, size,
+                              s->store_pages * size, errp)) {
+        return false;
+    }
+    *page = s->store_pages++;
+    s->stats.written++;
+    snapshot_index_add(s, hash, *page);
+    return true;
+}
+
+static bool snapshot_write_map(SnapshotPageStore *s, const char *tag,
+                               uint32_t flags, const char *parent,
+                               GArray *blocks, GArray *entries, Error **errp)
+{
+    g_autofree char *path = snapshot_map_path(s, tag);
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    g_autoptr(GError) gerr = NULL;
+    SnapshotMapHeader hdr = {
+        .magic = SNAPSHOT_MAP_MAGIC,
+        .version = SNAPSHOT_MAP_VERSION,
+        .flags = flags,
+        .page_size = qemu_target_page_size(),
+        .nr_blocks = blocks->len,
+        .nr_entries = entries ? entries->len : 0,
+    };
+
+    if (parent) {
+        pstrcpy(hdr.parent, sizeof(hdr.parent), parent);
+    }
+
+    g_byte_array_append(buf, (guint8 *)&hdr, sizeof(hdr));
+    g_byte_array_append(buf, (guint8 *)blocks->data,
+                        blocks->len * sizeof(SnapshotMapBlock));
+    if (entries) {
+        g_byte_array_append(buf, (guint8 *)entries->data,
+                            entries->len * sizeof(SnapshotMapEntry));
+    }
+
+    /* Written to a temporary file and renamed, so never half there */
+    if (!g_file_set_contents(path, (char *)buf->data, buf->len, &gerr)) {
+        error_setg(errp, "Could not write %s: %s", path, gerr->message);
+        return false;
+    }
+    return true;
+}
+
+static bool snapshot_pages_save_full(SnapshotPageStore *s, const char *tag,
+                                     GPtrArray *rbs, Error **errp)
+{
+    size_t size = qemu_target_page_size();
+    unsigned int i;
+
+    for (i = 0; i < rbs->len; i++) {
+        RAMBlock *rb = g_ptr_array_index(rbs, i);
+        g_autofree char *path = snapshot_image_path(s, tag, i);
+        g_autofree char *tmp = g_strdup_printf("%s.tmp", path);
+        ram_addr_t off, run = 0;
+        bool ok = true;
+        int fd;
+
+        /*
+         * Replace the image with a rename: it may be mapped into guest RAM
+         * by a lazy load, and truncating it in place would fault the guest.
+         */
+        fd = qemu_create(tmp, O_WRONLY | O_TRUNC, 0644, errp);
+        if (fd < 0) {
+            return false;
+        }
+
+        /* Zero pages are left as holes */
+        if (ftruncate(fd, rb->used_length) < 0) {
+            error_setg_errno(errp, errno, "Could not size %s", tmp);
+            ok = false;
+        }
+
+        for (off = 0; ok && off < rb->used_length; off += size) {
+            if (buffer_is_zero(rb->host + off, size)) {
+                s->stats.zero++;
+                if (off > run) {
+                    ok = snapshot_pwrite_full(fd, rb->host + run, off - run,
+                                              run, errp);
+                }
+                run = off + size;
+            } else {
+                s->stats.written++;
+            }
+        }
+        if (ok && rb->used_length > run) {
+            ok = snapshot_pwrite_full(fd, rb->host + run,
+                                      rb->used_length - run, run, errp);
+        }
+
+        s->stats.dirty += rb->used_length / size;
+        close(fd);
+        if (ok && rename(tmp, path) < 0) {
+            error_setg_errno(errp, errno, "Could not rename %s", tmp);
+            ok = false;
+        }
+        if (!ok) {
+            unlink(tmp);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool snapshot_pages_save_delta(SnapshotPageStore *s, GPtrArray *rbs,
+                                      GArray *entries, Error **errp)
+{
+    size_t size = qemu_target_page_size();
+    unsigned int i;
+
+    for (i = 0; i < rbs->len; i++) {
+        RAMBlock *rb = g_ptr_array_index(rbs, i);
+        g_autofree DirtyBitmapSnapshot *snap = NULL;
+        ram_addr_t off;
+
+        snap = memory_region_snapshot_and_clear_dirty(rb->mr, 0,
+                                                      rb->used_length,
+                                                      DIRTY_MEMORY_MIGRATION);
+
+        for (off = 0; off < rb->used_length; off += size) {
+            SnapshotMapEntry e = { .block = i, .offset = off };
+
+            if (!memory_region_snapshot_get_dirty(rb->mr, snap, off, size)) {
+                continue;
+            }
+
+            s->stats.dirty++;
+            if (buffer_is_zero(rb->host + off, size)) {
+                e.page = SNAPSHOT_PAGE_ZERO;
+                s->stats.zero++;
+            } else if (!snapshot_store_page(s, rb->host + off, &e.page,
+                                            errp)) {
+                return false;
+            }
+            g_array_append_val(entries, e);
+        }
+    }
+    return true;
+}
+
+bool snapshot_pages_save(SnapshotPageStore *s, const char *tag, Error **errp)
+{
+    g_autoptr(GPtrArray) rbs = g_ptr_array_new();
+    g_autoptr(GArray) blocks = NULL;
+    g_autoptr(GArray) entries = NULL;
+    bool full;
+
+    if (s->readonly) {
+        error_setg(errp, "Checkpoint directory %s is read-only", s->dir);
+        return false;
+    }
+    if (runstate_is_running()) {
+        error_setg(errp, "The VM must be stopped to save a checkpoint");
+        return false;
+    }
+    if (!migration_is_idle()) {
+        error_setg(errp, "Checkpoints cannot be saved during migration");
+        return false;
+    }
+    if (strlen(tag) >= SNAPSHOT_TAG_MAX) {
+        error_setg(errp, "Checkpoint name '%s' is too long", tag);
+        return false;
+    }
+
+    memset(&s->stats, 0, sizeof(s->stats));
+
+    RCU_READ_LOCK_GUARD();
+
+    blocks = snapshot_pages_blocks(rbs);
+
+    /* A change in the RAMBlock layout starts a new chain */
+    full = !s->tracking || !s->parent ||
+           !snapshot_blocks_equal(s->parent_blocks,
+                                  (SnapshotMapBlock *)blocks->data,
+                                  blocks->len);
+
+    if (full) {
+        if (!snapshot_pages_save_full(s, tag, rbs, errp) ||
+            !snapshot_write_map(s, tag, SNAPSHOT_MAP_FULL, NULL,
+                                blocks, NULL, errp)) {
+            return false;
+        }
+    } else {
+        entries = g_array_new(false, false, sizeof(SnapshotMapEntry));
+        if (!snapshot_pages_save_delta(s, rbs, entries, errp) ||
+            !snapshot_write_map(s, tag, 0, s->parent,
+                                blocks, entries, errp)) {
+            /* The dirty log was consumed, the next save must be full */
+            g_clear_pointer(&s->parent, g_free);
+            return false;
+        }
+    }
+
+    trace_snapshot_pages_save(tag, full, s->stats.dirty, s->stats.zero,
+                              s->stats.dedup, s->stats.written);
+
+    snapshot_pages_set_parent(s, tag, blocks);
+    snapshot_pages_track(s, rbs);
+    snapshot_pages_notify(s, tag, true);
+    return true;
+}
+
+/* Read and validate map @tag */
+static bool snapshot_read_map(SnapshotPageStore *s, const char *tag,
+                              GArray *blocks, char **contents, Error **errp)
+{
+    g_autofree char *path = snapshot_map_path(s, tag);
+    g_autoptr(GError) gerr = NULL;
+    SnapshotMapHeader *hdr;
+    const SnapshotMapEntry *e;
+    size_t len;
+    uint64_t i;
+
+    if (!g_file_get_contents(path, contents, &len, &gerr)) {
+        error_setg(errp, "Could not read checkpoint %s: %s", tag,
+                   gerr->message);
+        return false;
+    }
+
+    hdr = (SnapshotMapHeader *)*contents;
+    if (len < sizeof(*hdr) || hdr->magic != SNAPSHOT_MAP_MAGIC ||
+        hdr->version != SNAPSHOT_MAP_VERSION ||
+        hdr->page_size != qemu_target_page_size() ||
+        memchr(hdr->parent, 0, sizeof(hdr->parent)) == NULL ||
+        len != sizeof(*hdr) + hdr->nr_blocks * sizeof(SnapshotMapBlock) +
+               hdr->nr_entries * sizeof(SnapshotMapEntry)) {
+        error_setg(errp, "Checkpoint %s is invalid", tag);
+        return false;
+    }
+
+    if (!snapshot_blocks_equal(blocks, (SnapshotMapBlock *)(hdr + 1),
+                               hdr->nr_blocks)) {
+        error_setg(errp, "Checkpoint %s does not match the guest RAM layout",
+                   tag);
+        return false;
+    }
+
+    e = (SnapshotMapEntry *)((SnapshotMapBlock *)(hdr + 1) + hdr->nr_blocks);
+    for (i = 0; i < hdr->nr_entries; i++, e++) {
+        SnapshotMapBlock *b = &g_array_index(blocks, SnapshotMapBlock,
+                                             e->block < blocks->len ?
+                                             e->block : 0);
+
+        if (e->block >= blocks->len ||
+            e->offset + hdr->page_size > b->used_length ||
+            (e->page != SNAPSHOT_PAGE_ZERO && e->page >= s->store_pages)) {
+            error_setg(errp, "Checkpoint %s is corrupted", tag);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Set once guest RAM has been mapped from a checkpoint, see below */
+static bool snapshot_discard_disabled;
+
+/*
+ * Only private anonymous memory can be replaced by a private file mapping
+ * without changing what the rest of QEMU, or another process sharing the
+ * RAM, sees.
+ *
+ * Discarding a page of such a mapping brings back the checkpoint contents
+ * instead of zeroes, so the first mapping disables RAM discard for good,
+ * and nothing is mapped if a device such as virtio-mem requires discard.
+ * The mappings outlive the store, so discard is never enabled again.
+ */
+static bool snapshot_can_map(RAMBlock *rb)
+{
+    size_t pagesize = qemu_real_host_page_size();
+
+    if (rb->fd >= 0 || qemu_ram_is_shared(rb) ||
+        qemu_ram_pagesize(rb) != pagesize ||
+        !QEMU_PTR_IS_ALIGNED(rb->host, pagesize) ||
+        !QEMU_IS_ALIGNED(rb->used_length, pagesize)) {
+        return false;
+    }
+
+    if (!snapshot_discard_disabled) {
+        if (ram_block_discard_disable(true)) {
+            return false;
+        }
+        snapshot_discard_disabled = true;
+    }
+    return true;
+}
+
+/*
+ * A new mapping drops the advice physmem.c gave for the RAM it replaces,
+ * see ram_block_add().
+ */
+static void snapshot_map_advise(void *host, size_t len)
+{
+    if (!machine_dump_guest_core(current_machine)) {
+        qemu_madvise(host, len, QEMU_MADV_DONTDUMP);
+    }
+    if (machine_mem_merge(current_machine)) {
+        qemu_madvise(host, len, QEMU_MADV_MERGEABLE);
+    }
+    qemu_madvise(host, len, QEMU_MADV_HUGEPAGE);
+    if (!qtest_enabled()) {
+        qemu_madvise(host, len, QEMU_MADV_DONTFORK);
+    }
+}
+
+/*
+ * Map @fd copy-on-write over guest RAM: pages are read from the page
+ * cache on first touch, shared with every other process mapping the same
+ * file, and only pages the guest writes take private memory.
+ */
+static bool snapshot_map_range(void *host, size_t len, int fd, off_t offset,
+                               Error **errp)
+{
+    /* MAP_FIXED failing leaves the range unchanged */
+    if (mmap(host, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fd, offset) == MAP_FAILED) {
+        error_setg_errno(errp, errno, "Could not map checkpoint");
+        return false;
+    }
+    snapshot_map_advise(host, len);
+    return true;
+}
+
+static bool snapshot_map_image(RAMBlock *rb, int fd, const char *path,
+                               Error **errp)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "Could not stat %s", path);
+        return false;
+    }
+    if (st.st_size != rb->used_length) {
+        error_setg(errp, "%s does not match the size of RAMBlock %s",
+                   path, rb->idstr);
+        return false;
+    }
+
+    return snapshot_map_range(rb->host, rb->used_length, fd, 0, errp);
+}
+
+static bool snapshot_load_image(SnapshotPageStore *s, const char *tag,
+                                GPtrArray *rbs, bool lazy, Error **errp)
+{
+    unsigned int i;
+
+    for (i = 0; i < rbs->len; i++) {
+        RAMBlock *rb = g_ptr_array_index(rbs, i);
+        g_autofree char *path = snapshot_image_path(s, tag, i);
+        bool ok;
+        int fd;
+
+        fd = qemu_open(path, O_RDONLY, errp);
+        if (fd < 0) {
+            return false;
+        }
+        if (lazy && snapshot_can_map(rb)) {
+            ok = snapshot_map_image(rb, fd, path, errp);
+            s->stats.mapped += ok ? rb->used_length : 0;
+        } else {
+            ok = snapshot_pread_full(fd, rb->host, rb->used_length, 0, errp);
+        }
+        close(fd);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Number of entries from @e on that are contiguous in RAM and pages.bin */
+static uint64_t snapshot_delta_run(const SnapshotMapEntry *e, uint64_t left,
+                                   size_t size)
+{
+    uint64_t n = 1;
+
+    while (n < left && e[n].block == e->block &&
+           e[n].offset == e->offset + n * size &&
+           e[n].page != SNAPSHOT_PAGE_ZERO && e[n].page == e->page + n) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Apply one delta.  With @lazy, runs of pages are mapped from pages.bin
+ * like the full image, as long as guest pages are host pages and the
+ * number of mappings stays under SNAPSHOT_MAP_RUNS_MAX.
+ */
+static bool snapshot_load_delta(SnapshotPageStore *s, const char *map,
+                                GPtrArray *rbs, bool lazy,
+                                unsigned int *nr_runs, Error **errp)
+{
+    const SnapshotMapHeader *hdr = (const SnapshotMapHeader *)map;
+    const SnapshotMapEntry *e;
+    size_t size = qemu_target_page_size();
+    uint64_t i, n;
+
+    lazy &= size == qemu_real_host_page_size();
+
+    e = (SnapshotMapEntry *)((SnapshotMapBlock *)(hdr + 1) + hdr->nr_blocks);
+    for (i = 0; i < hdr->nr_entries; i += n, e += n) {
+        RAMBlock *rb = g_ptr_array_index(rbs, e->block);
+
+        n = 1;
+        if (e->page == SNAPSHOT_PAGE_ZERO) {
+            memset(rb->host + e->offset, 0, size);
+        } else if (lazy && *nr_runs < SNAPSHOT_MAP_RUNS_MAX &&
+                   snapshot_can_map(rb)) {
+            n = snapshot_delta_run(e, hdr->nr_entries - i, size);
+            if (!snapshot_map_range(rb->host + e->offset, n * size,
+                                    s->store_fd, e->page * size, errp)) {
+                return false;
+            }
+            (*nr_runs)++;
+            s->stats.mapped += n * size;
+        } else if (!snapshot_pread_full(s->store_fd, rb->host + e->offset,
+                                        size, e->page * size, errp)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool snapshot_pages_load(SnapshotPageStore *s, const char *tag, bool lazy,
+                         Error **errp)
+{
+    g_autoptr(GPtrArray) rbs = g_ptr_array_new();
+    g_autoptr(GPtrArray) chain = g_ptr_array_new_with_free_func(g_free);
+    g_autoptr(GArray) blocks = NULL;
+    const SnapshotMapHeader *hdr;
+    const char *cur = tag;
+    unsigned int nr_runs = 0;
+    int i;
+
+    if (runstate_is_running()) {
+        error_setg(errp, "The VM must be stopped to load a checkpoint");
+        return false;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    blocks = snapshot_pages_blocks(rbs);
+
+    /* Walk back to the full checkpoint at the root of the chain */
+    for (;;) {
+        char *map = NULL;
+
+        if (chain->len == SNAPSHOT_CHAIN_MAX) {
+            error_setg(errp, "Checkpoint chain of %s is too long", tag);
+            return false;
+        }
+        if (!snapshot_read_map(s, cur, blocks, &map, errp)) {
+            g_free(map);
+            return false;
+        }
+        g_ptr_array_add(chain, map);
+
+        hdr = (const SnapshotMapHeader *)map;
+        if (hdr->flags & SNAPSHOT_MAP_FULL) {
+            break;
+        }
+        cur = hdr->parent;
+    }
+
+    memset(&s->stats, 0, sizeof(s->stats));
+    if (!snapshot_load_image(s, cur, rbs, lazy, errp)) {
+        return false;
+    }
+    for (i = chain->len - 2; i >= 0; i--) {
+        if (!snapshot_load_delta(s, g_ptr_array_index(chain, i), rbs, lazy,
+                                 &nr_runs, errp)) {
+            return false;
+        }
+    }
+
+    trace_snapshot_pages_load(tag, chain->len, s->stats.mapped);
+
+    snapshot_pages_set_parent(s, tag, blocks);
+    if (!s->readonly) {
+        snapshot_pages_track(s, rbs);
+    }
+    snapshot_pages_notify(s, tag, false);
+    return true;
+}
+
+const SnapshotPagesStats *snapshot_pages_stats(SnapshotPageStore *s)
+{
+    return &s->stats;
+}
+
+SnapshotPageStore *snapshot_pages_open(const char *dir, bool readonly,
+                                       Error **errp)
+{
+    size_t size = qemu_target_page_size();
+    g_autofree char *path = NULL;
+    SnapshotPageStore *s;
+    off_t len;
+    uint64_t i;
+    int fd;
+
+    path = g_build_filename(dir, "pages.bin", NULL);
+    if (readonly) {
+        fd = qemu_open(path, O_RDONLY, errp);
+    } else if (g_mkdir_with_parents(dir, 0755) < 0) {
+        error_setg_errno(errp, errno, "Could not create %s", dir);
+        return NULL;
+    } else {
+        fd = qemu_create(path, O_RDWR, 0644, errp);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+
+    len = lseek(fd, 0, SEEK_END);
+    if (len < 0) {
+        error_setg_errno(errp, errno, "Could not size %s", path);
+        close(fd);
+        return NULL;
+    }
+
+    s = g_new0(SnapshotPageStore, 1);
+    s->dir = g_strdup(dir);
+    s->readonly = readonly;
+    s->store_fd = fd;
+    s->store_pages = len / size;
+    s->index = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                     g_free, NULL);
+    s->buf = g_malloc(size);
+
+    /* Index the pages saved by earlier runs, unless nothing can be saved */
+    for (i = 0; !readonly && i < s->store_pages; i++) {
+        if (!snapshot_pread_full(fd, s->buf, size, i * size, errp)) {
+            snapshot_pages_close(s);
+            return NULL;
+        }
+        snapshot_index_add(s, snapshot_page_hash(s->buf, size), i);
+    }
+
+    return s;
+}
+
+void snapshot_pages_close(SnapshotPageStore *s)
+{
+    if (s->tracking) {
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_SNAPSHOT);
+    }
+    if (s->parent_blocks) {
+        g_array_unref(s->parent_blocks);
+    }
+    g_hash_table_destroy(s->index);
+    close(s->store_fd);
+    g_free(s->parent);
+    g_free(s->buf);
+    g_free(s->dir);
+    g_free(s);
+}
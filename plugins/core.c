@@ -209,12 +209,118 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+static struct qemu_plugin_trace_buf *plugin_trace_buf_new(CPUState *cpu)
+{
+    struct qemu_plugin_trace_buf *buf = g_new0(struct qemu_plugin_trace_buf, 1);
+
+    buf->start = g_new(struct qemu_plugin_trace_record,
+                       plugin.trace_nr_records);
+    buf->end = buf->start + plugin.trace_nr_records;
+    buf->limit = buf->end - QEMU_PLUGIN_TRACE_SLACK;
+    buf->cur = buf->start;
+    buf->cpu_index = cpu->cpu_index;
+    return buf;
+}
+
+static void plugin_trace_buf_free(CPUState *cpu)
+{
+    struct qemu_plugin_trace_buf *buf = cpu->plugin_trace;
+
+    if (buf) {
+        qemu_plugin_trace_flush(buf);
+        cpu->plugin_trace = NULL;
+        g_free(buf->start);
+        g_free(buf);
+    }
+}
+
+static void plugin_trace_enable__async(CPUState *cpu, run_on_cpu_data data)
+{
+    cpu->plugin_trace = data.host_ptr;
+}
+
+static void plugin_trace_enable__locked(gpointer k, gpointer v, gpointer udata)
+{
+    CPUState *cpu = container_of(k, CPUState, cpu_index);
+    run_on_cpu_data buf = RUN_ON_CPU_HOST_PTR(plugin_trace_buf_new(cpu));
+
+    if (DEVICE(cpu)->realized) {
+        async_run_on_cpu(cpu, plugin_trace_enable__async, buf);
+    } else {
+        plugin_trace_enable__async(cpu, buf);
+    }
+}
+
+int qemu_plugin_register_vcpu_trace_cb(qemu_plugin_id_t id, size_t nr_records,
+                                       qemu_plugin_vcpu_trace_cb_t cb,
+                                       void *userdata)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    g_assert(cb && nr_records > QEMU_PLUGIN_TRACE_SLACK);
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    ctx = plugin_id_to_ctx_locked(id);
+    /* the buffers are handed out directly, only builtins get them */
+    g_assert(ctx->desc == NULL);
+    if (plugin.trace_ctx) {
+        qemu_rec_mutex_unlock(&plugin.lock);
+        return -1;
+    }
+    plugin.trace_ctx = ctx;
+    plugin.trace_cb = cb;
+    plugin.trace_udata = userdata;
+    plugin.trace_nr_records = nr_records;
+    g_hash_table_foreach(plugin.cpu_ht, plugin_trace_enable__locked, NULL);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    /* code translated so far does not fill the buffers */
+    if (first_cpu) {
+        tb_flush(first_cpu);
+    }
+    return 0;
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void qemu_plugin_trace_flush(struct qemu_plugin_trace_buf *buf)
+{
+    if (buf->cur != buf->start) {
+        plugin.trace_cb(buf->cpu_index, buf->start, buf->cur - buf->start,
+                        plugin.trace_udata);
+        buf->cur = buf->start;
+    }
+}
+
+/*
+ * Append a record from a helper.  Never leave @cur beyond @limit: the
+ * slack above it is for the records that generated code appends inline
+ * for the current instruction, having checked for it at its start.
+ */
+void qemu_plugin_trace_append(struct qemu_plugin_trace_buf *buf,
+                              uint64_t addr, uint32_t info)
+{
+    if (unlikely(buf->cur >= buf->limit)) {
+        qemu_plugin_trace_flush(buf);
+    }
+    buf->cur->addr = addr;
+    buf->cur->info = info;
+    buf->cur++;
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
     qemu_rec_mutex_lock(&plugin.lock);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
+    if (plugin.trace_ctx) {
+        cpu->plugin_trace = plugin_trace_buf_new(cpu);
+    }
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
     g_assert(success);
@@ -230,6 +336,7 @@ void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
 
     qemu_rec_mutex_lock(&plugin.lock);
+    plugin_trace_buf_free(cpu);
     success = g_hash_table_remove(plugin.cpu_ht, &cpu->cpu_index);
     g_assert(success);
     qemu_rec_mutex_unlock(&plugin.lock);
@@ -450,6 +557,12 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
     GArray *arr = cpu->plugin_mem_cbs;
     size_t i;
 
+    /* accesses by helpers; generated code records its own inline */
+    if (cpu->plugin_trace) {
+        qemu_plugin_trace_append(cpu->plugin_trace, vaddr,
+                                 make_plugin_meminfo(oi, rw));
+    }
+
     if (arr == NULL) {
         return;
     }
@@ -486,6 +599,31 @@ void qemu_plugin_register_atexit_cb(qemu_plugin_id_t id,
     plugin_register_cb_udata(id, QEMU_PLUGIN_EV_ATEXIT, cb, udata);
 }
 
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void qemu_plugin_checkpoint_cb(const char *path, bool save)
+{
+    struct qemu_plugin_cb *cb, *next;
+    enum qemu_plugin_event ev = QEMU_PLUGIN_EV_CHECKPOINT;
+
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
+        qemu_plugin_checkpoint_cb_t func = cb->f.checkpoint;
+
+        func(cb->ctx->id, path, save, cb->udata);
+    }
+}
+
+void qemu_plugin_register_checkpoint_cb(qemu_plugin_id_t id,
+                                        qemu_plugin_checkpoint_cb_t cb,
+                                        void *udata)
+{
+    plugin_register_cb_udata(id, QEMU_PLUGIN_EV_CHECKPOINT, cb, udata);
+}
+
 /*
  * Handle exit from linux-user. Unlike the normal atexit() mechanism
  * we need to handle the clean-up manually as it's possible threads
@@ -191,9 +191,8 @@ qemu_plugin_id_t qemu_plugin_register_builtin(void) {
             g_assert(g_hash_table_insert(plugin.id_ht, &ctx->id, &ctx->id));
             break;
         }
-
-        QTAILQ_INSERT_TAIL(&plugin.ctxs, ctx, entry);
     }
+    QTAILQ_INSERT_TAIL(&plugin.ctxs, ctx, entry);
 
     qemu_rec_mutex_unlock(&plugin.lock);
     return ctx->id;
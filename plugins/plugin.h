@@ -44,6 +44,11 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /* Builtin plugin tracing into per-vCPU buffers, if any */
+    struct qemu_plugin_ctx *trace_ctx;
+    qemu_plugin_vcpu_trace_cb_t trace_cb;
+    void *trace_udata;
+    size_t trace_nr_records;
 };
 
 
@@ -183,8 +183,15 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
+    "                qflex-ff-insns=n (QFlex: instructions per vCPU before timing starts)\n"
+    "                qflex-ring-slots=n (QFlex: records in each vCPU's instruction ring)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
+    "                superblock-threshold=n (retranslate TCG blocks run n times as superblocks)\n"
+    "                tb-cache=file (translate the blocks of a previous run before starting)\n"
+    "                tb-profile=on|off (count the executions of each TCG block)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-workers=n (threads translating TCG blocks ahead of execution)\n"
+    "                tci-fast-path=on|off (TCG interpreter fast path, default=on)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
@@ -218,15 +225,69 @@ SRST
         can be useful in some situations, such as when trying to analyse
         the logs produced by the ``-d`` option.
 
+    ``qflex-ff-insns=n``
+        With QFlex timing simulation, first runs every vCPU at full
+        TCG speed for n instructions, then switches all vCPUs to
+        timing-model driven stepping within the same process. Requires
+        ``-icount`` and ``thread=single``.
+
+    ``qflex-ring-slots=n``
+        With QFlex, creates one ring of n instruction records per vCPU,
+        n being a power of two, in memory the timing model can map from
+        another process. The rings receive the pc and memory accesses of
+        every executed instruction, and the exceptions taken, which
+        requires a QEMU built with plugin support. A vCPU waits a few
+        milliseconds for room in a full ring, then drops the record and
+        counts it in the ring header. The default, 0, creates no rings.
+
     ``split-wx=on|off``
         Controls the use of split w^x mapping for the TCG code generation
         buffer. Some operating systems require this to be enabled, and in
         such a case this will default on. On other operating systems, this
         will default off, but one may enable this for testing or debugging.
 
+    ``superblock-threshold=n``
+        Retranslates a TCG translation block once it has run n times
+        as a superblock, which continues along direct branches on the
+        same guest page, so that hot loops run as one block and keep
+        guest registers in host registers across their branches. Only
+        AArch64 guests follow branches so far. Not used with
+        ``-icount``. The default, 0, disables superblocks.
+
+    ``tb-cache=file``
+        Saves the list of TCG translation blocks to file at exit, and
+        reads it back at startup. Before a vCPU first runs, it translates
+        the blocks recorded for its current CPU state whose guest page
+        still has the same contents, as when the same checkpoint is
+        restored again. Other blocks are translated when first run, as
+        usual. Only available in system emulation.
+
+    ``tb-profile=on|off``
+        Counts the executions of each TCG translation block, for the
+        hottest blocks listed by ``info code-cache``. Each block then
+        increments a counter in memory when it starts. The first 262144
+        blocks translated after each flush of the translation cache are
+        counted. The default is off. Only available in system emulation.
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-workers=n``
+        Starts n threads that translate TCG blocks ahead of execution, on
+        otherwise idle host cores. When a vCPU translates a block, the
+        targets of its direct jumps on the same guest page are translated
+        by a worker, so that the vCPU finds them already translated if it
+        goes there. The default, 0, translates blocks only when they are
+        first run. Only available in system emulation.
+
+    ``tci-fast-path=on|off``
+        With the TCG interpreter, dispatches the most frequent bytecodes
+        directly from one handler to the next, fuses common pairs of
+        bytecodes into one, and looks up the softmmu TLB inline for guest
+        memory accesses. Turning it off runs the plain interpreter, for
+        comparison. The default is on. Only available when QEMU is built
+        with ``--enable-tcg-interpreter``.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+#
+# Run one QEMU instance per checkpoint, several at a time.
+#
+# Every occurrence of {tag} in the command line is replaced by the name
+# of the checkpoint an instance restores.  The instances are meant to
+# open the checkpoint directory read-only and load lazily, so the pages
+# they have in common are held once by the host page cache.
+#
+# USAGE: qflex-samples.py [-j JOBS] [--log-dir DIR] TAG... -- COMMAND...
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or
+# later.  See the COPYING file in the top-level directory.
+
+import argparse
+import os
+import subprocess
+import sys
+import time
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Run one QEMU instance per checkpoint in parallel.')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(),
+                        help='instances running at once (default: %(default)s)')
+    parser.add_argument('--log-dir', default='.',
+                        help='where to write <tag>.log (default: %(default)s)')
+    parser.add_argument('tags', nargs='+', metavar='TAG')
+
+    argv = sys.argv[1:]
+    if '--' not in argv:
+        parser.error('missing "--" before the QEMU command line')
+    sep = argv.index('--')
+    args = parser.parse_args(argv[:sep])
+    command = argv[sep + 1:]
+    if not command:
+        parser.error('missing QEMU command line')
+
+    os.makedirs(args.log_dir, exist_ok=True)
+    pending = list(args.tags)
+    running = {}
+    failed = []
+
+    while pending or running:
+        while pending and len(running) < args.jobs:
+            tag = pending.pop(0)
+            log = open(os.path.join(args.log_dir, tag + '.log'), 'w')
+            cmd = [arg.replace('{tag}', tag) for arg in command]
+            running[tag] = (subprocess.Popen(cmd, stdin=subprocess.DEVNULL,
+                                             stdout=log,
+                                             stderr=subprocess.STDOUT), log)
+
+        for tag, (proc, log) in list(running.items()):
+            if proc.poll() is None:
+                continue
+            log.close()
+            del running[tag]
+            print('%s: exit status %d' % (tag, proc.returncode))
+            if proc.returncode:
+                failed.append(tag)
+        time.sleep(0.1)
+
+    if failed:
+        print('failed: %s' % ' '.join(failed), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+#
+# Benchmark the fast path of the TCG interpreter
+#
+# Runs guest programs that exit by themselves, such as the system mode
+# tests of tests/tcg, on a QEMU built with --enable-tcg-interpreter,
+# with and without tci-fast-path.  For example, for AArch64:
+#
+#   bench_tci.py qemu-system-aarch64 \
+#       build/tests/tcg/aarch64-softmmu/memory \
+#       build/tests/tcg/aarch64-softmmu/hello -- \
+#       -M virt -cpu max -display none \
+#       -semihosting-config enable=on,target=native
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import os
+import subprocess
+import sys
+import time
+
+import simplebench
+from results_to_text import results_to_text
+
+
+def bench_func(env, case):
+    args = [env['qemu-binary']] + env['qemu-args'] + [
+        '-accel', f"tcg,tci-fast-path={env['fast-path']}",
+        '-kernel', case['kernel']]
+
+    start = time.monotonic()
+    p = subprocess.run(args, stdout=subprocess.DEVNULL,
+                       stderr=subprocess.PIPE, universal_newlines=True)
+    seconds = time.monotonic() - start
+
+    if p.returncode != 0:
+        return {'error': f'qemu failed: {p.returncode}: {p.stderr}'}
+    return {'seconds': seconds}
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3 or '--' not in sys.argv:
+        print(f'USAGE: {sys.argv[0]} <qemu binary> KERNEL ... '
+              '-- QEMU_ARGS ...')
+        exit(1)
+
+    sep = sys.argv.index('--')
+    qemu = sys.argv[1]
+    kernels = sys.argv[2:sep]
+    qemu_args = sys.argv[sep + 1:]
+
+    envs = [
+        {
+            'id': 'switch',
+            'qemu-binary': qemu,
+            'qemu-args': qemu_args,
+            'fast-path': 'off'
+        },
+        {
+            'id': 'fast path',
+            'qemu-binary': qemu,
+            'qemu-args': qemu_args,
+            'fast-path': 'on'
+        }
+    ]
+
+    cases = [{'id': os.path.basename(k), 'kernel': k} for k in kernels]
+
+    result = simplebench.bench(bench_func, envs, cases, count=5)
+    print(results_to_text(result))
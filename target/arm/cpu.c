@@ -648,6 +648,7 @@ void arm_emulate_firmware_reset(CPUState *cpustate, int target_el)
 
         cpsr_write(env, mode_for_el[target_el], CPSR_M, CPSRWriteRaw);
     }
+    arm_irq_deliverable_invalidate(env);
 }
 
 
@@ -849,64 +850,59 @@ static bool arm_cpu_exec_interrupt(CPUState *cs, int interrupt_request)
     return true;
 }
 
-static bool arm_cpu_check_interrupt(CPUState *cs, int interrupt_request)
+/*
+ * Compute which of the ARM_CPU_INTERRUPT_MASK interrupts would be taken if
+ * pending.  This only depends on state that invalidates the result through
+ * arm_irq_deliverable_invalidate(), not on the interrupt lines.
+ */
+static uint32_t arm_cpu_deliverable_interrupts(CPUState *cs)
 {
     CPUARMState *env = cpu_env(cs);
     uint32_t cur_el = arm_current_el(env);
     bool secure = arm_is_secure(env);
     uint64_t hcr_el2 = arm_hcr_el2_eff(env);
+    uint32_t deliverable = ARM_IRQ_DELIVERABLE_VALID;
     uint32_t target_el;
-    uint32_t excp_idx;
 
-    /* The prioritization of interrupts is IMPLEMENTATION DEFINED. */
-
-    if (interrupt_request & CPU_INTERRUPT_FIQ) {
-        excp_idx = EXCP_FIQ;
-        target_el = arm_phys_excp_target_el(cs, excp_idx, cur_el, secure);
-        if (arm_excp_unmasked(cs, excp_idx, target_el,
-                              cur_el, secure, hcr_el2)) {
-            goto found;
-        }
+    target_el = arm_phys_excp_target_el(cs, EXCP_FIQ, cur_el, secure);
+    if (arm_excp_unmasked(cs, EXCP_FIQ, target_el, cur_el, secure, hcr_el2)) {
+        deliverable |= CPU_INTERRUPT_FIQ;
     }
-    if (interrupt_request & CPU_INTERRUPT_HARD) {
-        excp_idx = EXCP_IRQ;
-        target_el = arm_phys_excp_target_el(cs, excp_idx, cur_el, secure);
-        if (arm_excp_unmasked(cs, excp_idx, target_el,
-                              cur_el, secure, hcr_el2)) {
-            goto found;
-        }
+    target_el = arm_phys_excp_target_el(cs, EXCP_IRQ, cur_el, secure);
+    if (arm_excp_unmasked(cs, EXCP_IRQ, target_el, cur_el, secure, hcr_el2)) {
+        deliverable |= CPU_INTERRUPT_HARD;
     }
-    if (interrupt_request & CPU_INTERRUPT_VIRQ) {
-        excp_idx = EXCP_VIRQ;
-        target_el = 1;
-        if (arm_excp_unmasked(cs, excp_idx, target_el,
-                              cur_el, secure, hcr_el2)) {
-            goto found;
-        }
+    if (arm_excp_unmasked(cs, EXCP_VIRQ, 1, cur_el, secure, hcr_el2)) {
+        deliverable |= CPU_INTERRUPT_VIRQ;
     }
-    if (interrupt_request & CPU_INTERRUPT_VFIQ) {
-        excp_idx = EXCP_VFIQ;
-        target_el = 1;
-        if (arm_excp_unmasked(cs, excp_idx, target_el,
-                              cur_el, secure, hcr_el2)) {
-            goto found;
-        }
+    if (arm_excp_unmasked(cs, EXCP_VFIQ, 1, cur_el, secure, hcr_el2)) {
+        deliverable |= CPU_INTERRUPT_VFIQ;
     }
-    if (interrupt_request & CPU_INTERRUPT_VSERR) {
-        excp_idx = EXCP_VSERR;
-        target_el = 1;
-        if (arm_excp_unmasked(cs, excp_idx, target_el,
-                              cur_el, secure, hcr_el2)) {
-            /* Taking a virtual abort clears HCR_EL2.VSE */
-            env->cp15.hcr_el2 &= ~HCR_VSE;
-            cpu_reset_interrupt(cs, CPU_INTERRUPT_VSERR);
-            goto found;
-        }
+    if (arm_excp_unmasked(cs, EXCP_VSERR, 1, cur_el, secure, hcr_el2)) {
+        deliverable |= CPU_INTERRUPT_VSERR;
     }
-    return false;
+    return deliverable;
+}
 
- found:
-    return true;
+static bool arm_cpu_check_interrupt(CPUState *cs, int interrupt_request)
+{
+    CPUARMState *env = cpu_env(cs);
+    uint32_t pending = interrupt_request & ARM_CPU_INTERRUPT_MASK;
+
+    if (!pending) {
+        return false;
+    }
+    if (unlikely(!env->irq_deliverable)) {
+        env->irq_deliverable = arm_cpu_deliverable_interrupts(cs);
+    }
+
+    pending &= env->irq_deliverable;
+    if (pending == CPU_INTERRUPT_VSERR) {
+        /* Taking a virtual abort clears HCR_EL2.VSE */
+        env->cp15.hcr_el2 &= ~HCR_VSE;
+        cpu_reset_interrupt(cs, CPU_INTERRUPT_VSERR);
+    }
+    return pending;
 }
 #endif /* CONFIG_TCG && !CONFIG_USER_ONLY */
 
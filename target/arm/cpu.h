@@ -93,6 +93,13 @@ enum {
 #define CPU_INTERRUPT_VFIQ  CPU_INTERRUPT_TGT_EXT_3
 #define CPU_INTERRUPT_VSERR CPU_INTERRUPT_TGT_INT_0
 
+/* Interrupts taken by arm_cpu_exec_interrupt(), in priority order */
+#define ARM_CPU_INTERRUPT_MASK (CPU_INTERRUPT_FIQ | CPU_INTERRUPT_HARD | \
+                                CPU_INTERRUPT_VIRQ | CPU_INTERRUPT_VFIQ | \
+                                CPU_INTERRUPT_VSERR)
+/* Set in env->irq_deliverable when it is up to date */
+#define ARM_IRQ_DELIVERABLE_VALID (1u << 31)
+
 /* The usual mapping for an AArch64 system register to its AArch32
  * counterpart is for the 32 bit world to have access to the lower
  * half only (with writes leaving the upper half untouched). It's
@@ -622,6 +629,13 @@ typedef struct CPUArchState {
     /* State of our input IRQ/FIQ/VIRQ/VFIQ lines */
     uint32_t irq_line_state;
 
+    /*
+     * Cached set of ARM_CPU_INTERRUPT_MASK bits that would be taken if
+     * pending, with ARM_IRQ_DELIVERABLE_VALID, or 0 when out of date.
+     * See arm_irq_deliverable_invalidate().
+     */
+    uint32_t irq_deliverable;
+
     /* Thumb-2 EE state.  */
     uint32_t teecr;
     uint32_t teehbr;
@@ -1621,6 +1635,16 @@ static inline uint32_t pstate_read(CPUARMState *env)
         | env->pstate | env->daif | (env->btype << 10);
 }
 
+/*
+ * Drop the cached set of deliverable interrupts.  This must be called
+ * whenever PSTATE.DAIF, the current EL or security state, HCR_EL2 or
+ * SCR_EL3 change; arm_rebuild_hflags() does it for the EL changes.
+ */
+static inline void arm_irq_deliverable_invalidate(CPUARMState *env)
+{
+    env->irq_deliverable = 0;
+}
+
 static inline void pstate_write(CPUARMState *env, uint32_t val)
 {
     env->ZF = (~val) & PSTATE_Z;
@@ -1630,6 +1654,7 @@ static inline void pstate_write(CPUARMState *env, uint32_t val)
     env->daif = val & PSTATE_DAIF;
     env->btype = (val >> 10) & 3;
     env->pstate = val & ~CACHED_PSTATE_BITS;
+    arm_irq_deliverable_invalidate(env);
 }
 
 /* Return the current CPSR value.  */
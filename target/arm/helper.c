@@ -1916,6 +1916,7 @@ static void scr_write(CPUARMState *env, const ARMCPRegInfo *ri, uint64_t value)
     value &= valid_mask;
     changed = env->cp15.scr_el3 ^ value;
     env->cp15.scr_el3 = value;
+    arm_irq_deliverable_invalidate(env);
 
     /*
      * If SCR_EL3.{NS,NSE} changes, i.e. change of security state,
@@ -4183,6 +4184,29 @@ static void vmsa_tcr_el12_write(CPUARMState *env, const ARMCPRegInfo *ri,
     raw_write(env, ri, value);
 }
 
+/*
+ * The context of the AArch64 EL1&0 regime for tlb_set_context_by_mmuidx,
+ * for the ASID @asid: that and the VMID.  Only the low 8 bits of the ASID
+ * are significant without TCR_EL1.AS.  The VMID bits beyond VTCR_EL2.VS
+ * are RES0, so they need no such care.
+ */
+static uint64_t e10_tlb_context(CPUARMState *env, uint64_t asid)
+{
+    if (!extract64(env->cp15.tcr_el[1], 36, 1)) {
+        asid &= 0xff;
+    }
+    return extract64(env->cp15.vttbr_el2, 48, 16) << 16 | asid;
+}
+
+/* The same, for the ASID in use. */
+static uint64_t e10_tlb_current_context(CPUARMState *env)
+{
+    uint64_t ttbr = env->cp15.tcr_el[1] & TTBCR_A1 ? env->cp15.ttbr1_ns
+                                                   : env->cp15.ttbr0_ns;
+
+    return e10_tlb_context(env, extract64(ttbr, 48, 16));
+}
+
 static void vmsa_ttbr_write(CPUARMState *env, const ARMCPRegInfo *ri,
                             uint64_t value)
 {
@@ -4190,6 +4214,21 @@ static void vmsa_ttbr_write(CPUARMState *env, const ARMCPRegInfo *ri,
     if (cpreg_field_is_64bit(ri) &&
         extract64(raw_read(env, ri) ^ value, 48, 16) != 0) {
         ARMCPU *cpu = env_archcpu(env);
+
+        if (ri->state == ARM_CP_STATE_AA64) {
+            /*
+             * Or rather, set aside the entries of the old ASID, which
+             * only a TLBI removes.  This is a no-op if TCR_EL1.A1 says
+             * that the register written does not hold the ASID.
+             */
+            raw_write(env, ri, value);
+            tlb_set_context_by_mmuidx(CPU(cpu),
+                                      ARMMMUIdxBit_E10_1 |
+                                      ARMMMUIdxBit_E10_1_PAN |
+                                      ARMMMUIdxBit_E10_0,
+                                      e10_tlb_current_context(env));
+            return;
+        }
         tlb_flush(CPU(cpu));
     }
     raw_write(env, ri, value);
@@ -4223,9 +4262,19 @@ static void vttbr_write(CPUARMState *env, const ARMCPRegInfo *ri,
     /*
      * A change in VMID to the stage2 page table (Stage2) invalidates
      * the stage2 and combined stage 1&2 tlbs (EL10_1 and EL10_0).
+     * Those are set aside for the old VMID instead, to be used again
+     * when the hypervisor switches back to it.
      */
     if (extract64(raw_read(env, ri) ^ value, 48, 16) != 0) {
-        tlb_flush_by_mmuidx(cs, alle1_tlbmask(env));
+        raw_write(env, ri, value);
+        tlb_set_context_by_mmuidx(cs, ARMMMUIdxBit_E10_1 |
+                                  ARMMMUIdxBit_E10_1_PAN |
+                                  ARMMMUIdxBit_E10_0,
+                                  e10_tlb_current_context(env));
+        tlb_set_context_by_mmuidx(cs, ARMMMUIdxBit_Stage2,
+                                  extract64(value, 48, 16));
+        tlb_flush_by_mmuidx(cs, ARMMMUIdxBit_Stage2_S);
+        return;
     }
     raw_write(env, ri, value);
 }
@@ -4572,6 +4621,7 @@ static void aa64_daif_write(CPUARMState *env, const ARMCPRegInfo *ri,
                             uint64_t value)
 {
     env->daif = value & PSTATE_DAIF;
+    arm_irq_deliverable_invalidate(env);
 }
 
 static uint64_t aa64_pan_read(CPUARMState *env, const ARMCPRegInfo *ri)
@@ -4804,6 +4854,43 @@ static void tlbi_aa64_vmalle1_write(CPUARMState *env, const ARMCPRegInfo *ri,
     }
 }
 
+static void tlbi_aa64_aside1is_write(CPUARMState *env, const ARMCPRegInfo *ri,
+                                     uint64_t value)
+{
+    CPUState *cs = env_cpu(env);
+    int mask = vae1_tlbmask(env);
+
+    /* The EL2&0 regime does not track ASIDs, see vmsa_tcr_ttbr_el2_write. */
+    if (mask & ARMMMUIdxBit_E10_0) {
+        uint64_t ctx = e10_tlb_context(env, extract64(value, 48, 16));
+
+        tlb_flush_context_by_mmuidx_all_cpus_synced(cs, mask, ctx);
+    } else {
+        tlb_flush_by_mmuidx_all_cpus_synced(cs, mask);
+    }
+}
+
+static void tlbi_aa64_aside1_write(CPUARMState *env, const ARMCPRegInfo *ri,
+                                   uint64_t value)
+{
+    CPUState *cs = env_cpu(env);
+    int mask = vae1_tlbmask(env);
+
+    if (mask & ARMMMUIdxBit_E10_0) {
+        uint64_t ctx = e10_tlb_context(env, extract64(value, 48, 16));
+
+        if (tlb_force_broadcast(env)) {
+            tlb_flush_context_by_mmuidx_all_cpus_synced(cs, mask, ctx);
+        } else {
+            tlb_flush_context_by_mmuidx(cs, mask, ctx);
+        }
+    } else if (tlb_force_broadcast(env)) {
+        tlb_flush_by_mmuidx_all_cpus_synced(cs, mask);
+    } else {
+        tlb_flush_by_mmuidx(cs, mask);
+    }
+}
+
 static int e2_tlbmask(CPUARMState *env)
 {
     return (ARMMMUIdxBit_E20_0 |
@@ -5479,7 +5566,7 @@ static const ARMCPRegInfo v8_cp_reginfo[] = {
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 3, .opc2 = 2,
       .access = PL1_W, .accessfn = access_ttlbis, .type = ARM_CP_NO_RAW,
       .fgt = FGT_TLBIASIDE1IS,
-      .writefn = tlbi_aa64_vmalle1is_write },
+      .writefn = tlbi_aa64_aside1is_write },
     { .name = "TLBI_VAAE1IS", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 3, .opc2 = 3,
       .access = PL1_W, .accessfn = access_ttlbis, .type = ARM_CP_NO_RAW,
@@ -5509,7 +5596,7 @@ static const ARMCPRegInfo v8_cp_reginfo[] = {
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 7, .opc2 = 2,
       .access = PL1_W, .accessfn = access_ttlb, .type = ARM_CP_NO_RAW,
       .fgt = FGT_TLBIASIDE1,
-      .writefn = tlbi_aa64_vmalle1_write },
+      .writefn = tlbi_aa64_aside1_write },
     { .name = "TLBI_VAAE1", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 7, .opc2 = 3,
       .access = PL1_W, .accessfn = access_ttlb, .type = ARM_CP_NO_RAW,
@@ -5830,6 +5917,7 @@ static void do_hcr_write(CPUARMState *env, uint64_t value, uint64_t valid_mask)
         tlb_flush(CPU(cpu));
     }
     env->cp15.hcr_el2 = value;
+    arm_irq_deliverable_invalidate(env);
 
     /*
      * Updates to VI and VF require us to update the status of
@@ -7553,7 +7641,7 @@ static const ARMCPRegInfo tlbios_reginfo[] = {
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 1, .opc2 = 2,
       .access = PL1_W, .accessfn = access_ttlbos, .type = ARM_CP_NO_RAW,
       .fgt = FGT_TLBIASIDE1OS,
-      .writefn = tlbi_aa64_vmalle1is_write },
+      .writefn = tlbi_aa64_aside1is_write },
     { .name = "TLBI_VAAE1OS", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 1, .opc2 = 3,
       .access = PL1_W, .accessfn = access_ttlbos, .type = ARM_CP_NO_RAW,
@@ -10097,6 +10185,7 @@ void cpsr_write(CPUARMState *env, uint32_t val, uint32_t mask,
 
     env->daif &= ~(CPSR_AIF & mask);
     env->daif |= val & CPSR_AIF & mask;
+    arm_irq_deliverable_invalidate(env);
 
     if (write_type != CPSRWriteRaw &&
         ((env->uncached_cpsr ^ val) & mask & CPSR_M)) {
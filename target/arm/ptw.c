@@ -2054,6 +2054,7 @@ static bool get_phys_addr_lpae(CPUARMState *env, S1Translate *ptw,
 
     result->f.phys_addr = descaddr;
     result->f.lg_page_size = ctz64(page_size);
+    result->f.contiguous = page_size > TARGET_PAGE_SIZE;
     return false;
 
  do_translation_fault:
@@ -3233,6 +3234,8 @@ static bool get_phys_addr_twostage(CPUARMState *env, S1Translate *ptw,
     } else if (result->f.lg_page_size < s1_lgpgsz) {
         result->f.lg_page_size = s1_lgpgsz;
     }
+    /* The combined result only holds for the current page. */
+    result->f.contiguous = false;
 
     /* Combine the S1 and S2 cache attributes. */
     hcr = arm_hcr_el2_eff_secstate(env, in_space);
@@ -3421,6 +3424,10 @@ static bool get_phys_addr_gpc(CPUARMState *env, S1Translate *ptw,
         fi->type = ARMFault_GPCFOnOutput;
         return true;
     }
+    /* The granule protection table may differ within a block. */
+    if (FIELD_EX64(env->cp15.gpccr_el3, GPCCR, GPC)) {
+        result->f.contiguous = false;
+    }
     return false;
 }
 
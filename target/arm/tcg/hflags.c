@@ -363,6 +363,7 @@ static CPUARMTBFlags rebuild_hflags_internal(CPUARMState *env)
 void arm_rebuild_hflags(CPUARMState *env)
 {
     env->hflags = rebuild_hflags_internal(env);
+    arm_irq_deliverable_invalidate(env);
 }
 
 /*
@@ -396,6 +397,7 @@ void HELPER(rebuild_hflags_a32_newel)(CPUARMState *env)
     int fp_el = fp_exception_el(env, el);
     ARMMMUIdx mmu_idx = arm_mmu_idx_el(env, el);
     env->hflags = rebuild_hflags_a32(env, fp_el, mmu_idx);
+    arm_irq_deliverable_invalidate(env);
 }
 
 void HELPER(rebuild_hflags_a32)(CPUARMState *env, int el)
@@ -404,6 +406,7 @@ void HELPER(rebuild_hflags_a32)(CPUARMState *env, int el)
     ARMMMUIdx mmu_idx = arm_mmu_idx_el(env, el);
 
     env->hflags = rebuild_hflags_a32(env, fp_el, mmu_idx);
+    arm_irq_deliverable_invalidate(env);
 }
 
 void HELPER(rebuild_hflags_a64)(CPUARMState *env, int el)
@@ -412,6 +415,7 @@ void HELPER(rebuild_hflags_a64)(CPUARMState *env, int el)
     ARMMMUIdx mmu_idx = arm_mmu_idx_el(env, el);
 
     env->hflags = rebuild_hflags_a64(env, el, fp_el, mmu_idx);
+    arm_irq_deliverable_invalidate(env);
 }
 
 void assert_hflags_rebuild_correctly(CPUARMState *env)
@@ -423,12 +423,182 @@ static MemOp check_ordered_align(DisasContext *s, int rn, int imm,
 typedef struct DisasCompare64 {
     TCGCond cond;
     TCGv_i64 value;
+    TCGv_i64 value2;    /* compared with value */
 } DisasCompare64;
 
-static void a64_test_cc(DisasCompare64 *c64, int cc)
+/*
+ * Flags are most often tested by the insn right after the one that set
+ * them, as with CMP + B.cond or TST + CSEL.  For such a pair, record the
+ * inputs of the flag-setting operation, so that the condition can be
+ * evaluated on them with a single comparison rather than rebuilt from
+ * NZCV.  NZCV itself is still computed and written back; this only saves
+ * materialising the condition from it within the TB.
+ * Call with the inputs before emitting the operation, which may overwrite
+ * them, or for A64_CC_LOGIC with the result afterwards.
+ *
+ * The copies go to a pair of temps allocated once per TB.  A path that
+ * joins at a label may not have set them, so the next insn must not use
+ * them once a label has been emitted.
+ */
+static void a64_set_cc_op(DisasContext *s, A64CCOp op, bool sf,
+                          TCGv_i64 t0, TCGv_i64 t1)
+{
+    if (!s->cc_src1) {
+        s->cc_src1 = tcg_temp_new_i64();
+        s->cc_src2 = tcg_temp_new_i64();
+    }
+
+    s->cc_op = op;
+    s->cc_insn = s->base.num_insns;
+    s->cc_sf = sf;
+    tcg_gen_mov_i64(s->cc_src1, t0);
+    if (t1) {
+        tcg_gen_mov_i64(s->cc_src2, t1);
+    }
+    s->cc_last_op = tcg_last_op();
+}
+
+/* Whether a label was emitted since a64_set_cc_op */
+static bool a64_cc_op_label_since(DisasContext *s)
+{
+    TCGOp *op = s->cc_last_op;
+
+    while ((op = QTAILQ_NEXT(op, link)) != NULL) {
+        if (op->opc == INDEX_op_set_label) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Test @cc on the inputs recorded by a64_set_cc_op in the previous insn.
+ * Return false if there are none, or if @cc does not map onto a single
+ * comparison of them.
+ */
+static bool a64_test_cc_op(DisasContext *s, DisasCompare64 *c64, int cc)
+{
+    TCGv_i64 a, b, zero;
+    TCGCond cond;
+
+    if (s->cc_op == A64_CC_NONE || s->cc_insn + 1 != s->base.num_insns ||
+        a64_cc_op_label_since(s)) {
+        s->cc_op = A64_CC_NONE;
+        return false;
+    }
+    a = s->cc_src1;
+    b = s->cc_src2;
+    zero = tcg_constant_i64(0);
+
+    switch (s->cc_op) {
+    case A64_CC_SUB:
+        switch (cc >> 1) {
+        case 0: /* eq: a == b */
+            cond = TCG_COND_EQ;
+            break;
+        case 1: /* cs: a >= b unsigned */
+            cond = TCG_COND_GEU;
+            break;
+        case 2: /* mi: a - b < 0 */
+            cond = TCG_COND_LT;
+            a = tcg_temp_new_i64();
+            tcg_gen_sub_i64(a, s->cc_src1, s->cc_src2);
+            b = zero;
+            break;
+        case 4: /* hi: a > b unsigned */
+            cond = TCG_COND_GTU;
+            break;
+        case 5: /* ge: a >= b */
+            cond = TCG_COND_GE;
+            break;
+        case 6: /* gt: a > b */
+            cond = TCG_COND_GT;
+            break;
+        default:
+            return false;
+        }
+        break;
+
+    case A64_CC_ADD:
+        switch (cc >> 1) {
+        case 0: /* eq: a + b == 0 */
+        case 2: /* mi: a + b < 0 */
+            cond = cc >> 1 ? TCG_COND_LT : TCG_COND_EQ;
+            a = tcg_temp_new_i64();
+            tcg_gen_add_i64(a, s->cc_src1, s->cc_src2);
+            b = zero;
+            break;
+        case 1: /* cs: a + b < a unsigned */
+            cond = TCG_COND_LTU;
+            a = tcg_temp_new_i64();
+            tcg_gen_add_i64(a, s->cc_src1, s->cc_src2);
+            b = s->cc_src1;
+            break;
+        default:
+            return false;
+        }
+        break;
+
+    case A64_CC_LOGIC:
+        b = zero;
+        switch (cc >> 1) {
+        case 0: /* eq: a == 0 */
+            cond = TCG_COND_EQ;
+            break;
+        case 2: /* mi: a < 0 */
+            cond = TCG_COND_LT;
+            break;
+        case 5: /* ge: N == V, with V clear */
+            cond = TCG_COND_GE;
+            break;
+        case 6: /* gt: !Z && N == V, with V clear */
+            cond = TCG_COND_GT;
+            break;
+        case 1: /* cs: C clear */
+        case 3: /* vs: V clear */
+        case 4: /* hi: C && !Z, with C clear */
+            cond = TCG_COND_NEVER;
+            break;
+        default:
+            return false;
+        }
+        break;
+
+    default:
+        g_assert_not_reached();
+    }
+
+    if (cc & 1) {
+        cond = tcg_invert_cond(cond);
+    }
+    if (!s->cc_sf) {
+        TCGv_i64 a32 = tcg_temp_new_i64();
+        TCGv_i64 b32 = tcg_temp_new_i64();
+
+        if (is_unsigned_cond(cond)) {
+            tcg_gen_ext32u_i64(a32, a);
+            tcg_gen_ext32u_i64(b32, b);
+        } else {
+            tcg_gen_ext32s_i64(a32, a);
+            tcg_gen_ext32s_i64(b32, b);
+        }
+        a = a32;
+        b = b32;
+    }
+
+    c64->cond = cond;
+    c64->value = a;
+    c64->value2 = b;
+    return true;
+}
+
+static void a64_test_cc(DisasContext *s, DisasCompare64 *c64, int cc)
 {
     DisasCompare c32;
 
+    if (a64_test_cc_op(s, c64, cc)) {
+        return;
+    }
     arm_test_cc(&c32, cc);
 
     /*
@@ -438,6 +608,18 @@ static void a64_test_cc(DisasCompare64 *c64, int cc)
     c64->cond = c32.cond;
     c64->value = tcg_temp_new_i64();
     tcg_gen_ext_i32_i64(c64->value, c32.value);
+    c64->value2 = tcg_constant_i64(0);
+}
+
+static void a64_gen_test_cc(DisasContext *s, int cc, TCGLabel *label)
+{
+    DisasCompare64 c;
+
+    if (a64_test_cc_op(s, &c, cc)) {
+        tcg_gen_brcond_i64(c.cond, c.value, c.value2, label);
+    } else {
+        arm_gen_test_cc(cc, label);
+    }
 }
 
 static void gen_rebuild_hflags(DisasContext *s)
@@ -520,6 +702,47 @@ static void gen_goto_tb(DisasContext *s, int n, int64_t diff)
     }
 }
 
+/*
+ * In a superblock, continue translating at pc_curr + @diff, the target
+ * of the current direct branch, rather than ending the TB.
+ */
+static bool a64_follow_branch(DisasContext *s, int64_t diff)
+{
+    uint64_t dest = s->pc_curr + diff;
+
+    if (s->ss_active || s->nr_side_exits == ARRAY_SIZE(s->side_exits) ||
+        !translator_follow_branch(&s->base, dest)) {
+        return false;
+    }
+    /* As in aarch64_tr_init_disas_context, do not cross the page. */
+    s->base.max_insns = MIN(s->base.max_insns, s->base.num_insns +
+                            -(dest | TARGET_PAGE_MASK) / 4);
+    return true;
+}
+
+/*
+ * In a superblock, follow one path of the conditional branch to
+ * pc_curr + @diff, using the static backward-taken, forward-not-taken
+ * prediction, so that loops stay within the superblock.  Return the label
+ * the branch must jump to when the other path is taken, and set @taken if
+ * the path followed is the taken one; return NULL to end the TB as usual.
+ */
+static TCGLabel *a64_follow_cond_branch(DisasContext *s, int64_t diff,
+                                        bool *taken)
+{
+    int n = s->nr_side_exits;
+
+    *taken = diff <= 0;
+    if (!a64_follow_branch(s, *taken ? diff : 4)) {
+        return NULL;
+    }
+    s->side_exits[n].label = gen_new_label();
+    s->side_exits[n].pc_save = s->pc_save;
+    s->side_exits[n].dest = s->pc_curr + (*taken ? 4 : diff);
+    s->nr_side_exits++;
+    return s->side_exits[n].label;
+}
+
 /*
  * Register access functions
  *
@@ -1377,7 +1600,9 @@ static inline AArch64DecodeFn *lookup_disas_fn(const AArch64DecodeTable *table,
 static bool trans_B(DisasContext *s, arg_i *a)
 {
     reset_btype(s);
-    gen_goto_tb(s, 0, a->imm);
+    if (!a64_follow_branch(s, a->imm)) {
+        gen_goto_tb(s, 0, a->imm);
+    }
     return true;
 }
 
@@ -1385,7 +1610,9 @@ static bool trans_BL(DisasContext *s, arg_i *a)
 {
     gen_pc_plus_diff(s, cpu_reg(s, 30), curr_insn_len(s));
     reset_btype(s);
-    gen_goto_tb(s, 0, a->imm);
+    if (!a64_follow_branch(s, a->imm)) {
+        gen_goto_tb(s, 0, a->imm);
+    }
     return true;
 }
 
@@ -1394,13 +1621,22 @@ static bool trans_CBZ(DisasContext *s, arg_cbz *a)
 {
     DisasLabel match;
     TCGv_i64 tcg_cmp;
+    TCGCond cond = a->nz ? TCG_COND_NE : TCG_COND_EQ;
+    TCGLabel *side_exit;
+    bool taken;
 
     tcg_cmp = read_cpu_reg(s, a->rt, a->sf);
     reset_btype(s);
 
+    side_exit = a64_follow_cond_branch(s, a->imm, &taken);
+    if (side_exit) {
+        tcg_gen_brcondi_i64(taken ? tcg_invert_cond(cond) : cond,
+                            tcg_cmp, 0, side_exit);
+        return true;
+    }
+
     match = gen_disas_label(s);
-    tcg_gen_brcondi_i64(a->nz ? TCG_COND_NE : TCG_COND_EQ,
-                        tcg_cmp, 0, match.label);
+    tcg_gen_brcondi_i64(cond, tcg_cmp, 0, match.label);
     gen_goto_tb(s, 0, 4);
     set_disas_label(s, match);
     gen_goto_tb(s, 1, a->imm);
@@ -1411,15 +1647,24 @@ static bool trans_TBZ(DisasContext *s, arg_tbz *a)
 {
     DisasLabel match;
     TCGv_i64 tcg_cmp;
+    TCGCond cond = a->nz ? TCG_COND_NE : TCG_COND_EQ;
+    TCGLabel *side_exit;
+    bool taken;
 
     tcg_cmp = tcg_temp_new_i64();
     tcg_gen_andi_i64(tcg_cmp, cpu_reg(s, a->rt), 1ULL << a->bitpos);
 
     reset_btype(s);
 
+    side_exit = a64_follow_cond_branch(s, a->imm, &taken);
+    if (side_exit) {
+        tcg_gen_brcondi_i64(taken ? tcg_invert_cond(cond) : cond,
+                            tcg_cmp, 0, side_exit);
+        return true;
+    }
+
     match = gen_disas_label(s);
-    tcg_gen_brcondi_i64(a->nz ? TCG_COND_NE : TCG_COND_EQ,
-                        tcg_cmp, 0, match.label);
+    tcg_gen_brcondi_i64(cond, tcg_cmp, 0, match.label);
     gen_goto_tb(s, 0, 4);
     set_disas_label(s, match);
     gen_goto_tb(s, 1, a->imm);
@@ -1435,12 +1680,22 @@ static bool trans_B_cond(DisasContext *s, arg_B_cond *a)
     reset_btype(s);
     if (a->cond < 0x0e) {
         /* genuinely conditional branches */
-        DisasLabel match = gen_disas_label(s);
-        arm_gen_test_cc(a->cond, match.label);
+        DisasLabel match;
+        TCGLabel *side_exit;
+        bool taken;
+
+        side_exit = a64_follow_cond_branch(s, a->imm, &taken);
+        if (side_exit) {
+            a64_gen_test_cc(s, taken ? a->cond ^ 1 : a->cond, side_exit);
+            return true;
+        }
+
+        match = gen_disas_label(s);
+        a64_gen_test_cc(s, a->cond, match.label);
         gen_goto_tb(s, 0, 4);
         set_disas_label(s, match);
         gen_goto_tb(s, 1, a->imm);
-    } else {
+    } else if (!a64_follow_branch(s, a->imm)) {
         /* 0xe and 0xf are both "always" conditions */
         gen_goto_tb(s, 0, a->imm);
     }
@@ -1463,11 +1718,23 @@ static void set_btype_for_blr(DisasContext *s)
     }
 }
 
+/*
+ * End the TB with a branch to cpu_pc, which tb_stop predicts inline.
+ * The prediction relies on the branch leaving everything that goes into
+ * the TB flags as it was at the start of the TB, except BTYPE, which is
+ * the same each time the branch is executed.
+ */
+static void gen_a64_indirect_branch(DisasContext *s, A64BranchKind kind)
+{
+    s->branch_kind = kind;
+    s->base.is_jmp = DISAS_JUMP;
+}
+
 static bool trans_BR(DisasContext *s, arg_r *a)
 {
     gen_a64_set_pc(s, cpu_reg(s, a->rn));
     set_btype_for_br(s, a->rn);
-    s->base.is_jmp = DISAS_JUMP;
+    gen_a64_indirect_branch(s, A64_BRANCH_JUMP);
     return true;
 }
 
@@ -1483,14 +1750,14 @@ static bool trans_BLR(DisasContext *s, arg_r *a)
     gen_pc_plus_diff(s, lr, curr_insn_len(s));
     gen_a64_set_pc(s, dst);
     set_btype_for_blr(s);
-    s->base.is_jmp = DISAS_JUMP;
+    gen_a64_indirect_branch(s, A64_BRANCH_CALL);
     return true;
 }
 
 static bool trans_RET(DisasContext *s, arg_r *a)
 {
     gen_a64_set_pc(s, cpu_reg(s, a->rn));
-    s->base.is_jmp = DISAS_JUMP;
+    gen_a64_indirect_branch(s, A64_BRANCH_RET);
     return true;
 }
 
@@ -1527,7 +1794,7 @@ static bool trans_BRAZ(DisasContext *s, arg_braz *a)
     dst = auth_branch_target(s, cpu_reg(s, a->rn), tcg_constant_i64(0), !a->m);
     gen_a64_set_pc(s, dst);
     set_btype_for_br(s, a->rn);
-    s->base.is_jmp = DISAS_JUMP;
+    gen_a64_indirect_branch(s, A64_BRANCH_JUMP);
     return true;
 }
 
@@ -1549,7 +1816,7 @@ static bool trans_BLRAZ(DisasContext *s, arg_braz *a)
     gen_pc_plus_diff(s, lr, curr_insn_len(s));
     gen_a64_set_pc(s, dst);
     set_btype_for_blr(s);
-    s->base.is_jmp = DISAS_JUMP;
+    gen_a64_indirect_branch(s, A64_BRANCH_CALL);
     return true;
 }
 
@@ -1559,7 +1826,7 @@ static bool trans_RETA(DisasContext *s, arg_reta *a)
 
     dst = auth_branch_target(s, cpu_reg(s, 30), cpu_X[31], !a->m);
     gen_a64_set_pc(s, dst);
-    s->base.is_jmp = DISAS_JUMP;
+    gen_a64_indirect_branch(s, A64_BRANCH_RET);
     return true;
 }
 
@@ -1573,7 +1840,7 @@ static bool trans_BRA(DisasContext *s, arg_bra *a)
     dst = auth_branch_target(s, cpu_reg(s,a->rn), cpu_reg_sp(s, a->rm), !a->m);
     gen_a64_set_pc(s, dst);
     set_btype_for_br(s, a->rn);
-    s->base.is_jmp = DISAS_JUMP;
+    gen_a64_indirect_branch(s, A64_BRANCH_JUMP);
     return true;
 }
 
@@ -1594,7 +1861,7 @@ static bool trans_BLRA(DisasContext *s, arg_bra *a)
     gen_pc_plus_diff(s, lr, curr_insn_len(s));
     gen_a64_set_pc(s, dst);
     set_btype_for_blr(s);
-    s->base.is_jmp = DISAS_JUMP;
+    gen_a64_indirect_branch(s, A64_BRANCH_CALL);
     return true;
 }
 
@@ -4064,6 +4331,14 @@ static bool gen_rri(DisasContext *s, arg_rri_sf *a,
     return true;
 }
 
+static bool gen_rri_cc(DisasContext *s, arg_rri_sf *a,
+                       A64CCOp op, ArithTwoOp *fn)
+{
+    a64_set_cc_op(s, op, a->sf, cpu_reg_sp(s, a->rn),
+                  tcg_constant_i64(a->imm));
+    return gen_rri(s, a, 0, 1, fn);
+}
+
 /*
  * PC-rel. addressing
  */
@@ -4089,8 +4364,10 @@ static bool trans_ADRP(DisasContext *s, arg_ri *a)
  */
 TRANS(ADD_i, gen_rri, a, 1, 1, tcg_gen_add_i64)
 TRANS(SUB_i, gen_rri, a, 1, 1, tcg_gen_sub_i64)
-TRANS(ADDS_i, gen_rri, a, 0, 1, a->sf ? gen_add64_CC : gen_add32_CC)
-TRANS(SUBS_i, gen_rri, a, 0, 1, a->sf ? gen_sub64_CC : gen_sub32_CC)
+TRANS(ADDS_i, gen_rri_cc, a, A64_CC_ADD,
+      a->sf ? gen_add64_CC : gen_add32_CC)
+TRANS(SUBS_i, gen_rri_cc, a, A64_CC_SUB,
+      a->sf ? gen_sub64_CC : gen_sub32_CC)
 
 /*
  * Add/subtract (immediate, with tags)
@@ -4231,6 +4508,7 @@ static bool gen_rri_log(DisasContext *s, arg_rri_log *a, bool set_cc,
     fn(tcg_rd, tcg_rn, imm);
     if (set_cc) {
         gen_logic_CC(a->sf, tcg_rd);
+        a64_set_cc_op(s, A64_CC_LOGIC, a->sf, tcg_rd, NULL);
     }
     if (!a->sf) {
         tcg_gen_ext32u_i64(tcg_rd, tcg_rd);
@@ -4567,6 +4845,7 @@ static void disas_logic_reg(DisasContext *s, uint32_t insn)
 
     if (opc == 3) {
         gen_logic_CC(sf, tcg_rd);
+        a64_set_cc_op(s, A64_CC_LOGIC, sf, tcg_rd, NULL);
     }
 }
 
@@ -4628,6 +4907,8 @@ static void disas_add_sub_ext_reg(DisasContext *s, uint32_t insn)
             tcg_gen_add_i64(tcg_result, tcg_rn, tcg_rm);
         }
     } else {
+        a64_set_cc_op(s, sub_op ? A64_CC_SUB : A64_CC_ADD, sf,
+                      tcg_rn, tcg_rm);
         if (sub_op) {
             gen_sub_CC(sf, tcg_result, tcg_rn, tcg_rm);
         } else {
@@ -4690,6 +4971,8 @@ static void disas_add_sub_reg(DisasContext *s, uint32_t insn)
             tcg_gen_add_i64(tcg_result, tcg_rn, tcg_rm);
         }
     } else {
+        a64_set_cc_op(s, sub_op ? A64_CC_SUB : A64_CC_ADD, sf,
+                      tcg_rn, tcg_rm);
         if (sub_op) {
             gen_sub_CC(sf, tcg_result, tcg_rn, tcg_rm);
         } else {
@@ -4920,6 +5203,7 @@ static void disas_cc(DisasContext *s, uint32_t insn)
     TCGv_i32 tcg_t0, tcg_t1, tcg_t2;
     TCGv_i64 tcg_tmp, tcg_y, tcg_rn;
     DisasCompare c;
+    DisasCompare64 c64;
 
     if (!extract32(insn, 29, 1)) {
         unallocated_encoding(s);
@@ -4939,8 +5223,16 @@ static void disas_cc(DisasContext *s, uint32_t insn)
 
     /* Set T0 = !COND.  */
     tcg_t0 = tcg_temp_new_i32();
-    arm_test_cc(&c, cond);
-    tcg_gen_setcondi_i32(tcg_invert_cond(c.cond), tcg_t0, c.value, 0);
+    if (a64_test_cc_op(s, &c64, cond)) {
+        TCGv_i64 t = tcg_temp_new_i64();
+
+        tcg_gen_setcond_i64(tcg_invert_cond(c64.cond), t,
+                            c64.value, c64.value2);
+        tcg_gen_extrl_i64_i32(tcg_t0, t);
+    } else {
+        arm_test_cc(&c, cond);
+        tcg_gen_setcondi_i32(tcg_invert_cond(c.cond), tcg_t0, c.value, 0);
+    }
 
     /* Load the arguments for the new comparison.  */
     if (is_imm) {
@@ -5016,7 +5308,7 @@ static void disas_cc(DisasContext *s, uint32_t insn)
 static void disas_cond_select(DisasContext *s, uint32_t insn)
 {
     unsigned int sf, else_inv, rm, cond, else_inc, rn, rd;
-    TCGv_i64 tcg_rd, zero;
+    TCGv_i64 tcg_rd;
     DisasCompare64 c;
 
     if (extract32(insn, 29, 1) || extract32(insn, 11, 1)) {
@@ -5034,17 +5326,16 @@ static void disas_cond_select(DisasContext *s, uint32_t insn)
 
     tcg_rd = cpu_reg(s, rd);
 
-    a64_test_cc(&c, cond);
-    zero = tcg_constant_i64(0);
+    a64_test_cc(s, &c, cond);
 
     if (rn == 31 && rm == 31 && (else_inc ^ else_inv)) {
         /* CSET & CSETM.  */
         if (else_inv) {
             tcg_gen_negsetcond_i64(tcg_invert_cond(c.cond),
-                                   tcg_rd, c.value, zero);
+                                   tcg_rd, c.value, c.value2);
         } else {
             tcg_gen_setcond_i64(tcg_invert_cond(c.cond),
-                                tcg_rd, c.value, zero);
+                                tcg_rd, c.value, c.value2);
         }
     } else {
         TCGv_i64 t_true = cpu_reg(s, rn);
@@ -5056,7 +5347,8 @@ static void disas_cond_select(DisasContext *s, uint32_t insn)
         } else if (else_inc) {
             tcg_gen_addi_i64(t_false, t_false, 1);
         }
-        tcg_gen_movcond_i64(c.cond, tcg_rd, c.value, zero, t_true, t_false);
+        tcg_gen_movcond_i64(c.cond, tcg_rd, c.value, c.value2,
+                            t_true, t_false);
     }
 
     if (!sf) {
@@ -5790,7 +6082,7 @@ static void disas_fp_ccomp(DisasContext *s, uint32_t insn)
     if (cond < 0x0e) { /* not always */
         TCGLabel *label_match = gen_new_label();
         label_continue = gen_new_label();
-        arm_gen_test_cc(cond, label_match);
+        a64_gen_test_cc(s, cond, label_match);
         /* nomatch: */
         gen_set_nzcv(tcg_constant_i64(nzcv << 28));
         tcg_gen_br(label_continue);
@@ -5857,8 +6149,8 @@ static void disas_fp_csel(DisasContext *s, uint32_t insn)
     read_vec_element(s, t_true, rn, 0, sz);
     read_vec_element(s, t_false, rm, 0, sz);
 
-    a64_test_cc(&c, cond);
-    tcg_gen_movcond_i64(c.cond, t_true, c.value, tcg_constant_i64(0),
+    a64_test_cc(s, &c, cond);
+    tcg_gen_movcond_i64(c.cond, t_true, c.value, c.value2,
                         t_true, t_false);
 
     /* Note that sregs & hregs write back zeros to the high bits,
@@ -14193,7 +14485,8 @@ static void aarch64_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
         switch (dc->base.is_jmp) {
         case DISAS_NEXT:
         case DISAS_TOO_MANY:
-            gen_goto_tb(dc, 1, 4);
+            /* The last insn may be a branch followed in a superblock. */
+            gen_goto_tb(dc, 1, curr_insn_len(dc));
             break;
         default:
         case DISAS_UPDATE_EXIT:
@@ -14204,10 +14497,21 @@ static void aarch64_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
             break;
         case DISAS_UPDATE_NOCHAIN:
             gen_a64_update_pc(dc, 4);
-            /* fall through */
-        case DISAS_JUMP:
             tcg_gen_lookup_and_goto_ptr();
             break;
+        case DISAS_JUMP:
+            switch (dc->branch_kind) {
+            case A64_BRANCH_CALL:
+                tcg_gen_push_return(dc->pc_curr);
+                /* fall through */
+            case A64_BRANCH_JUMP:
+                tcg_gen_lookup_and_goto_ptr_cached(cpu_pc, dc->pc_curr);
+                break;
+            case A64_BRANCH_RET:
+                tcg_gen_lookup_and_goto_ptr_return(cpu_pc);
+                break;
+            }
+            break;
         case DISAS_NORETURN:
         case DISAS_SWI:
             break;
@@ -14234,6 +14538,14 @@ static void aarch64_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
             break;
         }
     }
+
+    for (int i = 0; i < dc->nr_side_exits; i++) {
+        gen_set_label(dc->side_exits[i].label);
+        dc->pc_save = dc->side_exits[i].pc_save;
+        dc->pc_curr = dc->side_exits[i].dest;
+        gen_a64_update_pc(dc, 0);
+        tcg_gen_lookup_and_goto_ptr();
+    }
 }
 
 static void aarch64_tr_disas_log(const DisasContextBase *dcbase,
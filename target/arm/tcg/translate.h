@@ -21,6 +21,21 @@ typedef struct DisasLabel {
     target_ulong pc_save;
 } DisasLabel;
 
+/* A64: operation that last set NZCV, see a64_set_cc_op.  */
+typedef enum A64CCOp {
+    A64_CC_NONE,
+    A64_CC_ADD,         /* cc_src1 + cc_src2 */
+    A64_CC_SUB,         /* cc_src1 - cc_src2 */
+    A64_CC_LOGIC,       /* NZ from cc_src1, CV clear */
+} A64CCOp;
+
+/* A64: kind of the indirect branch that ends the TB with DISAS_JUMP.  */
+typedef enum A64BranchKind {
+    A64_BRANCH_JUMP,
+    A64_BRANCH_CALL,
+    A64_BRANCH_RET,
+} A64BranchKind;
+
 typedef struct DisasContext {
     DisasContextBase base;
     const ARMISARegisters *isar;
@@ -159,6 +174,21 @@ typedef struct DisasContext {
     int c15_cpar;
     /* TCG op of the current insn_start.  */
     TCGOp *insn_start;
+    /* Superblock exits for the branch paths not followed, see tb_stop. */
+    int nr_side_exits;
+    struct {
+        TCGLabel *label;
+        target_ulong pc_save;
+        target_ulong dest;
+    } side_exits[8];
+    /* A64: operation that set NZCV in insn number cc_insn, and its inputs */
+    A64CCOp cc_op;
+    int cc_insn;
+    bool cc_sf;
+    TCGv_i64 cc_src1;
+    TCGv_i64 cc_src2;
+    TCGOp *cc_last_op;      /* last op emitted by a64_set_cc_op */
+    A64BranchKind branch_kind;
 } DisasContext;
 
 typedef struct DisasCompare {
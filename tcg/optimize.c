@@ -53,8 +53,28 @@ typedef struct TempOptInfo {
     uint64_t val;
     uint64_t z_mask;  /* mask bit is 0 if and only if value bit is 0 */
     uint64_t s_mask;  /* a left-aligned mask of clrsb(value) bits. */
+    uint32_t version; /* incremented each time the temp is redefined */
 } TempOptInfo;
 
+/*
+ * An operation available for common subexpression elimination: its
+ * result is still in @out as long as neither @out nor any input temp
+ * has been redefined since, which is checked through their version.
+ */
+#define CSE_BITS      7
+#define CSE_MAX_ARGS  6
+
+typedef struct CSEEntry {
+    uint32_t ebb;           /* valid only while equal to ctx->cse_ebb */
+    TCGOpcode opc;
+    TCGArg args[CSE_MAX_ARGS];
+    uint32_t version[CSE_MAX_ARGS];
+    TCGTemp *out;
+    uint32_t out_version;
+    bool is_load;           /* a load from env, of bytes [start, last] */
+    intptr_t start, last;
+} CSEEntry;
+
 typedef struct OptContext {
     TCGContext *tcg;
     TCGOp *prev_mb;
@@ -63,6 +83,10 @@ typedef struct OptContext {
     IntervalTreeRoot mem_copy;
     QSIMPLEQ_HEAD(, MemCopyInfo) mem_free;
 
+    CSEEntry *cse;
+    uint32_t cse_ebb;
+    bool cse_loads;
+
     /* In flight values from optimization. */
     uint64_t a_mask;  /* mask bit is 0 iff value identical to first input */
     uint64_t z_mask;  /* mask bit is 0 iff value bit is 0 */
@@ -153,6 +177,7 @@ static void init_ts_info(OptContext *ctx, TCGTemp *ts)
     ti = ts->state_ptr;
     if (ti == NULL) {
         ti = tcg_malloc(sizeof(TempOptInfo));
+        ti->version = 0;
         ts->state_ptr = ti;
     }
 
@@ -193,8 +218,25 @@ static void remove_mem_copy(OptContext *ctx, MemCopyInfo *mc)
     QSIMPLEQ_INSERT_TAIL(&ctx->mem_free, mc, next);
 }
 
+/* Forget the loads from env that read any of bytes [s, l].  */
+static void remove_cse_loads_in(OptContext *ctx, intptr_t s, intptr_t l)
+{
+    if (!ctx->cse_loads) {
+        return;
+    }
+    for (int i = 0; i < 1 << CSE_BITS; i++) {
+        CSEEntry *e = &ctx->cse[i];
+        if (e->ebb == ctx->cse_ebb && e->is_load
+            && (uint64_t)e->start <= (uint64_t)l
+            && (uint64_t)s <= (uint64_t)e->last) {
+            e->ebb = 0;
+        }
+    }
+}
+
 static void remove_mem_copy_in(OptContext *ctx, intptr_t s, intptr_t l)
 {
+    remove_cse_loads_in(ctx, s, l);
     while (true) {
         MemCopyInfo *mc = mem_copy_first(ctx, s, l);
         if (!mc) {
@@ -255,6 +297,7 @@ static void reset_ts(OptContext *ctx, TCGTemp *ts)
     ti->is_const = false;
     ti->z_mask = -1;
     ti->s_mask = 0;
+    ti->version++;
 
     if (!QSIMPLEQ_EMPTY(&ti->mem_copy)) {
         if (ts == nts) {
@@ -817,6 +860,8 @@ static void finish_folding(OptContext *ctx, TCGOp *op)
         ctx->prev_mb = NULL;
         if (!(def->flags & TCG_OPF_COND_BRANCH)) {
             memset(&ctx->temps_used, 0, sizeof(ctx->temps_used));
+            ctx->cse_ebb++;
+            ctx->cse_loads = false;
             remove_mem_copy_all(ctx);
         }
         return;
@@ -1014,6 +1059,140 @@ static bool fold_xx_to_x(OptContext *ctx, TCGOp *op)
     return false;
 }
 
+/*
+ * Return the number of bytes read by @op if it is a load from env that
+ * is not already covered by the mem copy tracking, else 0.
+ */
+static int cse_load_size(TCGOp *op)
+{
+    if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+        return 0;
+    }
+    switch (op->opc) {
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(ld8u):
+        return 1;
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(ld16u):
+        return 2;
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_ld32u_i64:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+/* Return true if a repeated @op can be replaced by a copy of its result. */
+static bool cse_candidate(TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+    if (def->nb_oargs != 1
+        || def->nb_iargs + def->nb_cargs > CSE_MAX_ARGS
+        || (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS |
+                          TCG_OPF_CALL_CLOBBER | TCG_OPF_NOT_PRESENT |
+                          TCG_OPF_VECTOR))) {
+        return false;
+    }
+    switch (op->opc) {
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(ld16u):
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_ld32u_i64:
+        return cse_load_size(op) != 0;
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld_i64:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static CSEEntry *cse_slot(OptContext *ctx, TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+    int n = def->nb_iargs + def->nb_cargs;
+    uint64_t h = op->opc;
+
+    for (int i = 0; i < n; i++) {
+        h = (h ^ op->args[1 + i]) * 0x9e3779b97f4a7c15ull;
+    }
+    return &ctx->cse[h >> (64 - CSE_BITS)];
+}
+
+/*
+ * If the value computed by @op is already available in a temp, in the
+ * same extended basic block, replace @op by a copy of it.
+ */
+static bool fold_cse(OptContext *ctx, TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+    int nb_iargs = def->nb_iargs;
+    CSEEntry *e;
+
+    if (!cse_candidate(op)) {
+        return false;
+    }
+
+    e = cse_slot(ctx, op);
+    if (e->ebb != ctx->cse_ebb || e->opc != op->opc
+        || memcmp(e->args, &op->args[1],
+                  (nb_iargs + def->nb_cargs) * sizeof(TCGArg))) {
+        return false;
+    }
+    for (int i = 0; i < nb_iargs; i++) {
+        if (arg_info(e->args[i])->version != e->version[i]) {
+            return false;
+        }
+    }
+    if (ts_info(e->out)->version != e->out_version) {
+        return false;
+    }
+    return tcg_opt_gen_mov(ctx, op, op->args[0], temp_arg(e->out));
+}
+
+/* Make the value computed by @op available to later identical ops.  */
+static void record_cse(OptContext *ctx, TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+    int nb_iargs = def->nb_iargs;
+    TCGTemp *out = arg_temp(op->args[0]);
+    CSEEntry *e;
+    int size;
+
+    if (!cse_candidate(op)) {
+        return;
+    }
+    /* An op that overwrites one of its inputs cannot be repeated.  */
+    for (int i = 1; i <= nb_iargs; i++) {
+        if (arg_temp(op->args[i]) == out) {
+            return;
+        }
+    }
+
+    e = cse_slot(ctx, op);
+    e->ebb = ctx->cse_ebb;
+    e->opc = op->opc;
+    memcpy(e->args, &op->args[1],
+           (nb_iargs + def->nb_cargs) * sizeof(TCGArg));
+    for (int i = 0; i < nb_iargs; i++) {
+        e->version[i] = arg_info(e->args[i])->version;
+    }
+    e->out = out;
+    e->out_version = ts_info(out)->version;
+
+    size = cse_load_size(op);
+    e->is_load = size != 0;
+    if (size) {
+        e->start = op->args[2];
+        e->last = e->start + size - 1;
+        ctx->cse_loads = true;
+    }
+}
+
 /*
  * These outermost fold_<op> functions are sorted alphabetically.
  *
@@ -2348,6 +2527,10 @@ void tcg_optimize(TCGContext *s)
 
     QSIMPLEQ_INIT(&ctx.mem_free);
 
+    ctx.cse = tcg_malloc(sizeof(CSEEntry) << CSE_BITS);
+    memset(ctx.cse, 0, sizeof(CSEEntry) << CSE_BITS);
+    ctx.cse_ebb = 1;
+
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
        If this temp is a copy of other ones then the other copies are
@@ -2579,8 +2762,12 @@ void tcg_optimize(TCGContext *s)
             break;
         }
 
+        if (!done) {
+            done = fold_cse(&ctx, op);
+        }
         if (!done) {
             finish_folding(&ctx, op);
+            record_cse(&ctx, op);
         }
     }
 }
@@ -72,6 +72,13 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    /* regions left full by their context, in the order they filled up */
+    size_t *full;
+    size_t full_head;
+    size_t n_full;
+    /* evicted regions, to be allocated again */
+    size_t *free;
+    size_t n_free;
 };
 
 static struct tcg_region_state region;
@@ -191,10 +198,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Return the index of the region containing @p, in the rw buffer.  */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
 
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -205,19 +225,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             return NULL;
         }
     }
-
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -359,11 +367,14 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    if (region.current < region.n) {
+        tcg_region_assign(s, region.current);
+        region.current++;
+    } else if (region.n_free) {
+        tcg_region_assign(s, region.free[--region.n_free]);
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
     return false;
 }
 
@@ -374,13 +385,15 @@ static bool tcg_region_alloc__locked(TCGContext *s)
 bool tcg_region_alloc(TCGContext *s)
 {
     bool err;
-    /* read the region size now; alloc__locked will overwrite it on success */
+    /* read the region now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full = tcg_region_index(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.full[(region.full_head + region.n_full++) % region.n] = full;
     }
     qemu_mutex_unlock(&region.lock);
     return err;
@@ -412,6 +425,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.full_head = 0;
+    region.n_full = 0;
+    region.n_free = 0;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,7 +438,63 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
-static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
+static gboolean tcg_region_collect_iter(gpointer key, gpointer value,
+                                        gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+/*
+ * Evict the region that filled up first, of those not in use by a TCG
+ * context, so that it can be allocated again.  @invalidate is called
+ * beforehand on each TB of the region, without region locks held, and
+ * must leave no way to reach them.
+ * Call from a safe-work context.  Returns false if no region is full.
+ */
+bool tcg_region_evict(void (*invalidate)(TranslationBlock *tb))
+{
+    struct tcg_region_tree *rt;
+    GPtrArray *tbs;
+    void *start, *end;
+    size_t r, i;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_full == 0) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    r = region.full[region.full_head];
+    region.full_head = (region.full_head + 1) % region.n;
+    region.n_full--;
+    qemu_mutex_unlock(&region.lock);
+
+    rt = region_trees + r * tree_size;
+    tbs = g_ptr_array_new();
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, tcg_region_collect_iter, tbs);
+    qemu_mutex_unlock(&rt->lock);
+
+    for (i = 0; i < tbs->len; i++) {
+        invalidate(g_ptr_array_index(tbs, i));
+    }
+    g_ptr_array_free(tbs, true);
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    tcg_region_bounds(r, &start, &end);
+    qemu_mutex_lock(&region.lock);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    region.free[region.n_free++] = r;
+    qemu_mutex_unlock(&region.lock);
+    return true;
+}
+
+static size_t tcg_n_regions(size_t tb_size, unsigned max_threads)
 {
 #ifdef CONFIG_USER_ONLY
     return 1;
@@ -430,25 +502,23 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
     size_t n_regions;
 
     /*
-     * It is likely that some vCPUs will translate more code than others,
-     * so we first try to set more regions than max_cpus, with those regions
-     * being of reasonable size. If that's not possible we make do by evenly
-     * dividing the code_gen_buffer among the vCPUs.
+     * It is likely that some threads will translate more code than others,
+     * so we first try to set more regions than max_threads, with those
+     * regions being of reasonable size. If that's not possible we make do
+     * by evenly dividing the code_gen_buffer among the threads.
+     * A single TCG thread gets several regions too, so that a full buffer
+     * can be reclaimed one region at a time, see tcg_region_evict().
      */
-    /* Use a single region if all we have is one vCPU thread */
-    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
-    }
 
     /*
-     * Try to have more regions than max_cpus, with each region being >= 2 MB.
-     * If we can't, then just allocate one region per vCPU thread.
+     * Try to have more regions than max_threads, with each region being
+     * >= 2 MB.  If we can't, then just allocate one region per TCG thread.
      */
     n_regions = tb_size / (2 * MiB);
-    if (n_regions <= max_cpus) {
-        return max_cpus;
+    if (n_regions <= max_threads) {
+        return max_threads;
     }
-    return MIN(n_regions, max_cpus * 8);
+    return MIN(n_regions, max_threads * 8);
 #endif
 }
 
@@ -733,11 +803,10 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * and then assigning regions to TCG threads so that the threads can translate
  * code in parallel without synchronization.
  *
- * In system-mode the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
- * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
- * must have been parsed before calling this function, since it calls
- * qemu_tcg_mttcg_enabled().
+ * In system-mode the number of TCG threads is bounded by max_threads: one per
+ * vCPU in MTTCG, a single one otherwise, plus the translation workers.  We use
+ * at least max_threads regions, or a single region if there is only one TCG
+ * thread.
  *
  * In user-mode we use a single region.  Having multiple regions in user-mode
  * is not supported, because the number of vCPU threads (recall that each thread
@@ -751,7 +820,7 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * in practice. Multi-threaded guests share most if not all of their translated
  * code, which makes parallel code generation less appealing than in system-mode
  */
-void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
 {
     const size_t page_size = qemu_real_host_page_size();
     size_t region_size;
@@ -789,7 +858,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      * As a result of this we might end up with a few extra pages at the end of
      * the buffer; we will assign those to the last region.
      */
-    region.n = tcg_n_regions(tb_size, max_cpus);
+    region.n = tcg_n_regions(tb_size, max_threads);
     region_size = tb_size / region.n;
     region_size = QEMU_ALIGN_DOWN(region_size, page_size);
 
@@ -810,6 +879,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.full = g_new(size_t, region.n);
+    region.free = g_new(size_t, region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
@@ -904,6 +975,65 @@ size_t tcg_code_size(void)
     return total;
 }
 
+static gboolean tcg_region_end_iter(gpointer key, gpointer value,
+                                    gpointer data)
+{
+    const struct tb_tc *tc = key;
+    const void **end = data;
+
+    /* The tree is traversed in order, so the last TB ends the region.  */
+    *end = tc->ptr + tc->size;
+    return false;
+}
+
+/*
+ * Store in @usage the use of the first @n regions, and return the number
+ * of regions.  The region of each TCG context is used up to its current
+ * allocation pointer; a region left by its context because it was full is
+ * used up to the end of its last TB.
+ */
+size_t tcg_region_usage(TCGRegionUsage *usage, size_t n)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int i;
+    size_t r;
+
+    n = MIN(n, region.n);
+    qemu_mutex_lock(&region.lock);
+    for (r = 0; r < n; r++) {
+        void *start, *end;
+
+        tcg_region_bounds(r, &start, &end);
+        usage[r].used = 0;
+        usage[r].size = end - start;
+        usage[r].ctx = -1;
+
+        if (r < region.current) {
+            struct tcg_region_tree *rt = region_trees + r * tree_size;
+            const void *last = NULL;
+
+            qemu_mutex_lock(&rt->lock);
+            q_tree_foreach(rt->tree, tcg_region_end_iter, &last);
+            qemu_mutex_unlock(&rt->lock);
+            if (last) {
+                usage[r].used = tcg_splitwx_to_rw(last) - start;
+            }
+        }
+    }
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        r = tcg_region_index(s->code_gen_buffer);
+        if (r < n) {
+            usage[r].used = qatomic_read(&s->code_gen_ptr) -
+                            s->code_gen_buffer;
+            usage[r].ctx = i;
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+    return region.n;
+}
+
 /*
  * Returns the code capacity (in bytes) of the entire cache, i.e. including all
  * regions.
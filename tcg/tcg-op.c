@@ -28,6 +28,7 @@
 #include "tcg/tcg-op-common.h"
 #include "exec/translation-block.h"
 #include "exec/plugin-gen.h"
+#include "hw/core/cpu.h"
 #include "tcg-internal.h"
 
 
@@ -3345,3 +3346,127 @@ void tcg_gen_lookup_and_goto_ptr(void)
     tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(ptr));
     tcg_temp_free_ptr(ptr);
 }
+
+/* Offset from env of @field in the CPUBranchCache. */
+#define BC_OFS(field) \
+    ((int)(offsetof(CPUNegativeOffsetState, bc.field) - \
+           sizeof(CPUNegativeOffsetState)))
+
+static unsigned branch_cache_hash(uint64_t site)
+{
+    /* Insns are at least 4 bytes apart on the targets that use this. */
+    return (site >> 2) & (CPU_BRANCH_CACHE_SIZE - 1);
+}
+
+/*
+ * Jump to the code of the branch cache entry at @entry + @ofs if it was
+ * filled by this TB for the current value of @pc, otherwise look up
+ * the TB and fill entry @idx.  @entry is NULL for a constant @idx;
+ * @idx must live across the branch to the miss path.
+ */
+static void gen_goto_cached_ptr(TCGv_i64 pc, TCGv_ptr entry, intptr_t ofs,
+                                TCGv_i32 idx)
+{
+    const TranslationBlock *site = tcg_ctx->gen_tb;
+    TCGLabel *miss = gen_new_label();
+    TCGv_ptr base = entry ? entry : tcg_env;
+    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
+    TCGv_i64 t = tcg_temp_ebb_new_i64();
+
+    tcg_gen_ld_ptr(ptr, base, ofs + offsetof(CPUBranchCacheEntry, site));
+    tcg_gen_brcondi_ptr(TCG_COND_NE, ptr, (intptr_t)site, miss);
+    tcg_gen_ld_i64(t, base, ofs + offsetof(CPUBranchCacheEntry, pc));
+    tcg_gen_brcond_i64(TCG_COND_NE, t, pc, miss);
+    tcg_gen_ld_ptr(ptr, base, ofs + offsetof(CPUBranchCacheEntry, ptr));
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(ptr));
+
+    gen_set_label(miss);
+    gen_helper_lookup_tb_ptr_cached(ptr, tcg_env, idx,
+                                    tcg_constant_ptr(site));
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(ptr));
+    tcg_temp_free_i64(t);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * The branch cache is bypassed unless the TB could also be chained
+ * directly: a breakpoint on the page or single-stepping needs the
+ * full lookup for each target.
+ */
+static bool use_branch_cache(void)
+{
+    return !(tcg_ctx->gen_tb->cflags & (CF_NO_GOTO_TB | CF_NO_GOTO_PTR));
+}
+
+void tcg_gen_lookup_and_goto_ptr_cached(TCGv_i64 pc, uint64_t site)
+{
+    unsigned idx = branch_cache_hash(site);
+
+    if (!use_branch_cache()) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+
+    plugin_gen_disable_mem_helpers();
+    gen_goto_cached_ptr(pc, NULL, BC_OFS(entry[idx]), tcg_constant_i32(idx));
+}
+
+void tcg_gen_push_return(uint64_t site)
+{
+    TCGv_i32 top;
+    TCGv_ptr p;
+
+    if (!use_branch_cache()) {
+        return;
+    }
+
+    top = tcg_temp_ebb_new_i32();
+    p = tcg_temp_ebb_new_ptr();
+    tcg_gen_ld_i32(top, tcg_env, BC_OFS(ret_top));
+    tcg_gen_addi_i32(top, top, 1);
+    tcg_gen_andi_i32(top, top, CPU_RETURN_STACK_SIZE - 1);
+    tcg_gen_st_i32(top, tcg_env, BC_OFS(ret_top));
+    tcg_gen_shli_i32(top, top, 2);
+    tcg_gen_ext_i32_ptr(p, top);
+    tcg_gen_add_ptr(p, p, tcg_env);
+    tcg_gen_st_i32(tcg_constant_i32(branch_cache_hash(site)),
+                   p, BC_OFS(ret_stack));
+    tcg_temp_free_ptr(p);
+    tcg_temp_free_i32(top);
+}
+
+void tcg_gen_lookup_and_goto_ptr_return(TCGv_i64 pc)
+{
+    TCGv_i32 top, idx;
+    TCGv_ptr p;
+
+    if (!use_branch_cache()) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+
+    plugin_gen_disable_mem_helpers();
+
+    /* Pop the index of the entry predicting this return. */
+    top = tcg_temp_ebb_new_i32();
+    idx = tcg_temp_new_i32();
+    p = tcg_temp_ebb_new_ptr();
+    tcg_gen_ld_i32(top, tcg_env, BC_OFS(ret_top));
+    tcg_gen_shli_i32(idx, top, 2);
+    tcg_gen_ext_i32_ptr(p, idx);
+    tcg_gen_add_ptr(p, p, tcg_env);
+    tcg_gen_ld_i32(idx, p, BC_OFS(ret_stack));
+    tcg_gen_subi_i32(top, top, 1);
+    tcg_gen_andi_i32(top, top, CPU_RETURN_STACK_SIZE - 1);
+    tcg_gen_st_i32(top, tcg_env, BC_OFS(ret_top));
+
+    /* Return entries are in the second half of the cache. */
+    tcg_gen_addi_i32(idx, idx, CPU_BRANCH_CACHE_SIZE);
+    tcg_gen_muli_i32(top, idx, sizeof(CPUBranchCacheEntry));
+    tcg_gen_ext_i32_ptr(p, top);
+    tcg_gen_add_ptr(p, p, tcg_env);
+    tcg_temp_free_i32(top);
+
+    gen_goto_cached_ptr(pc, p, BC_OFS(entry[0]), idx);
+    tcg_temp_free_ptr(p);
+}
@@ -1306,7 +1306,7 @@ static void process_op_defs(TCGContext *s);
 static TCGTemp *tcg_global_reg_new_internal(TCGContext *s, TCGType type,
                                             TCGReg reg, const char *name);
 
-static void tcg_context_init(unsigned max_cpus)
+static void tcg_context_init(unsigned max_threads)
 {
     TCGContext *s = &tcg_init_ctx;
     int op, total_args, n, i;
@@ -1367,15 +1367,15 @@ static void tcg_context_init(unsigned max_cpus)
      * In user-mode we simply share the init context among threads, since we
      * use a single region. See the documentation tcg_region_init() for the
      * reasoning behind this.
-     * In system-mode we will have at most max_cpus TCG threads.
+     * In system-mode we will have at most max_threads TCG threads.
      */
 #ifdef CONFIG_USER_ONLY
     tcg_ctxs = &tcg_ctx;
     tcg_cur_ctxs = 1;
     tcg_max_ctxs = 1;
 #else
-    tcg_max_ctxs = max_cpus;
-    tcg_ctxs = g_new0(TCGContext *, max_cpus);
+    tcg_max_ctxs = max_threads;
+    tcg_ctxs = g_new0(TCGContext *, max_threads);
 #endif
 
     tcg_debug_assert(!tcg_regset_test_reg(s->reserved_regs, TCG_AREG0));
@@ -1383,10 +1383,10 @@ static void tcg_context_init(unsigned max_cpus)
     tcg_env = temp_tcgv_ptr(ts);
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_init(size_t tb_size, int splitwx, unsigned max_threads)
 {
-    tcg_context_init(max_cpus);
-    tcg_region_init(tb_size, splitwx, max_cpus);
+    tcg_context_init(max_threads);
+    tcg_region_init(tb_size, splitwx, max_threads);
 }
 
 /*
@@ -3129,6 +3129,16 @@ static void process_op_defs(TCGContext *s)
     }
 }
 
+/* Return the label a conditional branch @op jumps to.  */
+static TCGLabel *cond_branch_label(const TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+    tcg_debug_assert(def->flags & TCG_OPF_COND_BRANCH);
+    return arg_label(op->args[def->nb_oargs + def->nb_iargs +
+                              def->nb_cargs - 1]);
+}
+
 static void remove_label_use(TCGOp *op, int idx)
 {
     TCGLabel *label = arg_label(op->args[idx]);
@@ -3263,6 +3273,9 @@ reachable_code_pass(TCGContext *s)
 {
     TCGOp *op, *op_next, *op_prev;
     bool dead = false;
+    bool *label_seen = tcg_malloc(s->nb_labels * sizeof(bool));
+
+    memset(label_seen, 0, s->nb_labels * sizeof(bool));
 
     QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
         bool remove = dead;
@@ -3271,6 +3284,7 @@ reachable_code_pass(TCGContext *s)
         switch (op->opc) {
         case INDEX_op_set_label:
             label = arg_label(op->args[0]);
+            label_seen[label->id] = true;
 
             /*
              * Note that the first op in the TB is always a load,
@@ -3304,6 +3318,17 @@ reachable_code_pass(TCGContext *s)
                 dead = false;
             }
 
+            /*
+             * A label that cannot be reached by falling through and whose
+             * only use is a forward conditional branch, seen above, is a
+             * side exit: liveness and register allocation let globals stay
+             * in registers across that branch and sync them at the label.
+             */
+            label->side_exit = (label->side_exit && dead &&
+                                !QSIMPLEQ_EMPTY(&label->branches) &&
+                                !QSIMPLEQ_NEXT(QSIMPLEQ_FIRST(&label->branches),
+                                               next));
+
             if (QSIMPLEQ_EMPTY(&label->branches)) {
                 /*
                  * While there is an occasional backward branch, virtually
@@ -3339,6 +3364,13 @@ reachable_code_pass(TCGContext *s)
             remove = false;
             break;
 
+        case INDEX_op_brcond_i32:
+        case INDEX_op_brcond_i64:
+        case INDEX_op_brcond2_i32:
+            label = cond_branch_label(op);
+            label->side_exit = !remove && !label_seen[label->id];
+            break;
+
         default:
             break;
         }
@@ -3429,14 +3461,43 @@ static void la_global_sync(TCGContext *s, int ng)
     }
 }
 
+/*
+ * liveness analysis: conditional branch to a side exit: globals are
+ * synced at the label instead, so they need only be live here.  Indirect
+ * globals are lowered to loads and stores by liveness_pass_2 and are
+ * synced as usual.
+ */
+static void la_side_exit_sync(TCGContext *s, int ng)
+{
+    int i;
+
+    for (i = 0; i < ng; ++i) {
+        TCGTemp *ts = &s->temps[i];
+        int state = ts->state;
+
+        if (ts->kind != TEMP_GLOBAL || ts->indirect_reg) {
+            ts->state = state | TS_MEM;
+        } else {
+            ts->state = state & ~TS_DEAD;
+        }
+        if (state == TS_DEAD) {
+            la_reset_pref(ts);
+        }
+    }
+}
+
 /*
  * liveness analysis: conditional branch: all temps are dead unless
  * explicitly live-across-conditional-branch, globals and local temps
  * should be synced.
  */
-static void la_bb_sync(TCGContext *s, int ng, int nt)
+static void la_bb_sync(TCGContext *s, int ng, int nt, bool side_exit)
 {
-    la_global_sync(s, ng);
+    if (side_exit) {
+        la_side_exit_sync(s, ng);
+    } else {
+        la_global_sync(s, ng);
+    }
 
     for (int i = ng; i < nt; ++i) {
         TCGTemp *ts = &s->temps[i];
@@ -3836,7 +3897,8 @@ liveness_pass_1(TCGContext *s)
             if (def->flags & TCG_OPF_BB_EXIT) {
                 la_func_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_COND_BRANCH) {
-                la_bb_sync(s, nb_globals, nb_temps);
+                la_bb_sync(s, nb_globals, nb_temps,
+                           cond_branch_label(op)->side_exit);
             } else if (def->flags & TCG_OPF_BB_END) {
                 la_bb_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -4511,14 +4573,93 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/*
+ * A global that was not synced at the branch to a side exit.  The label is
+ * reached from nowhere else, so this is still where the global is when
+ * the code at the label starts.
+ */
+struct TCGLabelGlobal {
+    TCGTemp *ts;
+    TCGTempVal val_type;
+    TCGReg reg;
+    int64_t val;
+};
+
+/* At a conditional branch to a side exit, record where globals are.  */
+static void tcg_reg_alloc_side_exit_save(TCGContext *s, TCGLabel *l)
+{
+    int i, n = 0;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+        if (ts->kind == TEMP_GLOBAL
+            && (ts->val_type == TEMP_VAL_REG || ts->val_type == TEMP_VAL_CONST)
+            && !ts->mem_coherent) {
+            n++;
+        }
+    }
+
+    l->nb_side_globals = n;
+    l->side_globals = n ? tcg_malloc(n * sizeof(TCGLabelGlobal)) : NULL;
+
+    for (i = 0, n = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+        if (ts->kind == TEMP_GLOBAL
+            && (ts->val_type == TEMP_VAL_REG || ts->val_type == TEMP_VAL_CONST)
+            && !ts->mem_coherent) {
+            TCGLabelGlobal *g = &l->side_globals[n++];
+            g->ts = ts;
+            g->val_type = ts->val_type;
+            g->reg = ts->reg;
+            g->val = ts->val;
+        } else {
+            tcg_debug_assert(ts->val_type != TEMP_VAL_REG
+                             || ts->kind == TEMP_FIXED
+                             || ts->mem_coherent);
+        }
+    }
+}
+
+/*
+ * At a side exit, put back the globals recorded at its branch and store
+ * those that were not synced.  On return all globals are in memory, as
+ * at any other label.
+ */
+static void tcg_reg_alloc_side_exit(TCGContext *s, TCGLabel *l)
+{
+    int i;
+
+    for (i = 0; i < l->nb_side_globals; i++) {
+        TCGLabelGlobal *g = &l->side_globals[i];
+        TCGTemp *ts = g->ts;
+
+        tcg_debug_assert(ts->val_type == TEMP_VAL_MEM);
+        if (g->val_type == TEMP_VAL_REG) {
+            set_temp_val_reg(s, ts, g->reg);
+        } else {
+            set_temp_val_nonreg(s, ts, g->val_type);
+            ts->val = g->val;
+        }
+        ts->mem_coherent = 0;
+    }
+    for (i = 0; i < l->nb_side_globals; i++) {
+        temp_sync(s, l->side_globals[i].ts, s->reserved_regs, 0, 1);
+    }
+}
+
 /*
  * At a conditional branch, we assume all temporaries are dead unless
  * explicitly live-across-conditional-branch; all globals and local
  * temps are synced to their location.
  */
-static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs,
+                                  TCGLabel *l)
 {
-    sync_globals(s, allocated_regs);
+    if (l->side_exit) {
+        tcg_reg_alloc_side_exit_save(s, l);
+    } else {
+        sync_globals(s, allocated_regs);
+    }
 
     for (int i = s->nb_globals; i < s->nb_temps; i++) {
         TCGTemp *ts = &s->temps[i];
@@ -5000,7 +5141,7 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
     }
 
     if (def->flags & TCG_OPF_COND_BRANCH) {
-        tcg_reg_alloc_cbranch(s, i_allocated_regs);
+        tcg_reg_alloc_cbranch(s, i_allocated_regs, cond_branch_label(op));
     } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
@@ -6160,6 +6301,9 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
         case INDEX_op_set_label:
             tcg_reg_alloc_bb_end(s, s->reserved_regs);
             tcg_out_label(s, arg_label(op->args[0]));
+            if (arg_label(op->args[0])->side_exit) {
+                tcg_reg_alloc_side_exit(s, arg_label(op->args[0]));
+            }
             break;
         case INDEX_op_call:
             tcg_reg_alloc_call(s, op);
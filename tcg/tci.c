@@ -20,6 +20,9 @@
 #include "qemu/osdep.h"
 #include "tcg/tcg.h"
 #include "tcg/tcg-ldst.h"
+#include "exec/tlb-common.h"
+#include "exec/target_page.h"
+#include "hw/core/cpu.h"
 #include <ffi.h>
 
 
@@ -34,6 +37,7 @@
 #endif
 
 __thread uintptr_t tci_tb_ptr;
+bool tci_fast_path = true;
 
 static void tci_write_reg64(tcg_target_ulong *regs, uint32_t high_index,
                             uint32_t low_index, uint64_t value)
@@ -276,11 +280,106 @@ static bool tci_compare64(uint64_t u0, uint64_t u1, TCGCond condition)
     return result;
 }
 
+/*
+ * Return the host address for a guest access that hits in the fast TLB,
+ * as checked inline by native backends, or NULL to use the helpers.
+ * Unaligned accesses always use the helpers, which handle both their
+ * atomicity and accesses that cross pages.
+ */
+static void *tci_tlb_host(CPUArchState *env, uint64_t taddr,
+                          MemOpIdx oi, bool is_ld)
+{
+#ifdef CONFIG_USER_ONLY
+    return NULL;
+#else
+    /*
+     * tcg_ctx only has the page size of the last translation made by this
+     * thread, if any, so ask the target.  It is final before any TB runs,
+     * even with TARGET_PAGE_BITS_VARY.
+     */
+    static int page_bits;
+    MemOp mop = get_memop(oi);
+    unsigned a_mask = MAX(1u << get_alignment_bits(mop),
+                          1u << (mop & MO_SIZE)) - 1;
+    CPUTLBDescFast *fast = (void *)env - sizeof(CPUNegativeOffsetState)
+        + offsetof(CPUNegativeOffsetState, tlb.f[get_mmuidx(oi)]);
+    uintptr_t ofs;
+    CPUTLBEntry *entry;
+    uint64_t cmp, addr;
+
+    if (unlikely(!page_bits)) {
+        qatomic_set(&page_bits, qemu_target_page_bits());
+    }
+    ofs = (taddr >> (page_bits - CPU_TLB_ENTRY_BITS)) & fast->mask;
+    entry = (void *)fast->table + ofs;
+    cmp = is_ld ? entry->addr_read : entry->addr_write;
+    addr = taddr & ((UINT64_MAX << page_bits) | a_mask);
+
+    /*
+     * The addresses of a 32-bit guest, in @taddr as in the comparators,
+     * are zero-extended; an invalid entry has all bits set and matches
+     * no aligned address.
+     */
+    if (cmp != addr) {
+        return NULL;
+    }
+    return (void *)(uintptr_t)(taddr + entry->addend);
+#endif
+}
+
+static uint64_t tci_host_ld(const void *host, MemOp mop)
+{
+    uint64_t val;
+
+    switch (mop & MO_SIZE) {
+    case MO_8:
+        return mop & MO_SIGN ? ldsb_p(host) : ldub_p(host);
+    case MO_16:
+        val = lduw_he_p(host);
+        val = mop & MO_BSWAP ? bswap16(val) : val;
+        return mop & MO_SIGN ? (int16_t)val : val;
+    case MO_32:
+        val = (uint32_t)ldl_he_p(host);
+        val = mop & MO_BSWAP ? bswap32(val) : val;
+        return mop & MO_SIGN ? (int32_t)val : val;
+    case MO_64:
+        val = ldq_he_p(host);
+        return mop & MO_BSWAP ? bswap64(val) : val;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void tci_host_st(void *host, uint64_t val, MemOp mop)
+{
+    switch (mop & MO_SIZE) {
+    case MO_8:
+        stb_p(host, val);
+        break;
+    case MO_16:
+        stw_he_p(host, mop & MO_BSWAP ? bswap16(val) : val);
+        break;
+    case MO_32:
+        stl_he_p(host, mop & MO_BSWAP ? bswap32(val) : val);
+        break;
+    case MO_64:
+        stq_he_p(host, mop & MO_BSWAP ? bswap64(val) : val);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 static uint64_t tci_qemu_ld(CPUArchState *env, uint64_t taddr,
                             MemOpIdx oi, const void *tb_ptr)
 {
     MemOp mop = get_memop(oi);
     uintptr_t ra = (uintptr_t)tb_ptr;
+    void *host = tci_fast_path ? tci_tlb_host(env, taddr, oi, true) : NULL;
+
+    if (host) {
+        return tci_host_ld(host, mop);
+    }
 
     switch (mop & MO_SSIZE) {
     case MO_UB:
@@ -307,6 +406,12 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
 {
     MemOp mop = get_memop(oi);
     uintptr_t ra = (uintptr_t)tb_ptr;
+    void *host = tci_fast_path ? tci_tlb_host(env, taddr, oi, false) : NULL;
+
+    if (host) {
+        tci_host_st(host, val, mop);
+        return;
+    }
 
     switch (mop & MO_SIZE) {
     case MO_UB:
@@ -347,6 +452,64 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
 uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
                                             const void *v_tb_ptr)
 {
+    /*
+     * Threaded dispatch of the most frequent opcodes: each handler ends
+     * with NEXT(), which fetches the next opcode and jumps to its handler
+     * through this table.  With one indirect jump per handler, the host
+     * predicts them much better than the single jump of the switch.
+     * The other opcodes still go through the switch.
+     */
+    static const void * const fast_ops[256] = {
+        [0 ... 255] = &&do_switch,
+        [INDEX_op_call] = &&fast_call,
+        [INDEX_op_br] = &&fast_br,
+        [INDEX_op_setcond_i32] = &&fast_setcond_i32,
+        [INDEX_op_mov_i32] = &&fast_mov,
+        [INDEX_op_tci_movi] = &&fast_movi,
+        [INDEX_op_tci_movl] = &&fast_movl,
+        [INDEX_op_ld_i32] = &&fast_ld_i32,
+        [INDEX_op_st_i32] = &&fast_st_i32,
+        [INDEX_op_tci_ld_add_i32] = &&fast_ld_add_i32,
+        [INDEX_op_add_i32] = &&fast_add,
+        [INDEX_op_sub_i32] = &&fast_sub,
+        [INDEX_op_and_i32] = &&fast_and,
+        [INDEX_op_or_i32] = &&fast_or,
+        [INDEX_op_xor_i32] = &&fast_xor,
+        [INDEX_op_brcond_i32] = &&fast_brcond_i32,
+        [INDEX_op_tci_brcond_i32] = &&fast_tci_brcond_i32,
+#if TCG_TARGET_REG_BITS == 64
+        [INDEX_op_setcond_i64] = &&fast_setcond_i64,
+        [INDEX_op_mov_i64] = &&fast_mov,
+        [INDEX_op_ld32u_i64] = &&fast_ld_i32,
+        [INDEX_op_st32_i64] = &&fast_st_i32,
+        [INDEX_op_ld_i64] = &&fast_ld_i64,
+        [INDEX_op_st_i64] = &&fast_st_i64,
+        [INDEX_op_tci_ld_add_i64] = &&fast_ld_add_i64,
+        [INDEX_op_add_i64] = &&fast_add,
+        [INDEX_op_sub_i64] = &&fast_sub,
+        [INDEX_op_and_i64] = &&fast_and,
+        [INDEX_op_or_i64] = &&fast_or,
+        [INDEX_op_xor_i64] = &&fast_xor,
+        [INDEX_op_brcond_i64] = &&fast_brcond_i64,
+        [INDEX_op_tci_brcond_i64] = &&fast_tci_brcond_i64,
+        [INDEX_op_ext32s_i64] = &&fast_ext32s,
+        [INDEX_op_ext_i32_i64] = &&fast_ext32s,
+        [INDEX_op_ext32u_i64] = &&fast_ext32u,
+        [INDEX_op_extu_i32_i64] = &&fast_ext32u,
+#endif
+        [INDEX_op_exit_tb] = &&fast_exit_tb,
+        [INDEX_op_goto_tb] = &&fast_goto_tb,
+        [INDEX_op_goto_ptr] = &&fast_goto_ptr,
+        [INDEX_op_qemu_ld_a32_i32] = &&fast_qemu_ld_a32_i32,
+        [INDEX_op_qemu_ld_a64_i32] = &&fast_qemu_ld_a64_i32,
+        [INDEX_op_qemu_ld_a32_i64] = &&fast_qemu_ld_a32_i64,
+        [INDEX_op_qemu_ld_a64_i64] = &&fast_qemu_ld_a64_i64,
+        [INDEX_op_qemu_st_a32_i32] = &&fast_qemu_st_a32_i32,
+        [INDEX_op_qemu_st_a64_i32] = &&fast_qemu_st_a64_i32,
+        [INDEX_op_qemu_st_a32_i64] = &&fast_qemu_st_a32_i64,
+        [INDEX_op_qemu_st_a64_i64] = &&fast_qemu_st_a64_i64,
+    };
+    const bool fast = tci_fast_path;
     const uint32_t *tb_ptr = v_tb_ptr;
     tcg_target_ulong regs[TCG_TARGET_NB_REGS];
     uint64_t stack[(TCG_STATIC_CALL_ARGS_SIZE + TCG_STATIC_FRAME_SIZE)
@@ -356,6 +519,15 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
     regs[TCG_REG_CALL_STACK] = (uintptr_t)stack;
     tci_assert(tb_ptr);
 
+    /* End of a handler; without the fast path, back to the switch. */
+#define NEXT()                              \
+    if (likely(fast)) {                     \
+        insn = *tb_ptr++;                   \
+        opc = extract32(insn, 0, 8);        \
+        goto *fast_ops[opc];                \
+    }                                       \
+    continue
+
     for (;;) {
         uint32_t insn;
         TCGOpcode opc;
@@ -373,8 +545,13 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
         insn = *tb_ptr++;
         opc = extract32(insn, 0, 8);
 
+        if (likely(fast)) {
+            goto *fast_ops[opc];
+        }
+    do_switch:
         switch (opc) {
         case INDEX_op_call:
+        fast_call:
             {
                 void *call_slots[MAX_CALL_IARGS];
                 ffi_cif *cif;
@@ -425,16 +602,18 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             default:
                 g_assert_not_reached();
             }
-            break;
+            NEXT();
 
         case INDEX_op_br:
+        fast_br:
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = ptr;
-            continue;
+            NEXT();
         case INDEX_op_setcond_i32:
+        fast_setcond_i32:
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare32(regs[r1], regs[r2], condition);
-            break;
+            NEXT();
         case INDEX_op_movcond_i32:
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             tmp32 = tci_compare32(regs[r1], regs[r2], condition);
@@ -449,9 +628,10 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #elif TCG_TARGET_REG_BITS == 64
         case INDEX_op_setcond_i64:
+        fast_setcond_i64:
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare64(regs[r1], regs[r2], condition);
-            break;
+            NEXT();
         case INDEX_op_movcond_i64:
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             tmp32 = tci_compare64(regs[r1], regs[r2], condition);
@@ -459,17 +639,20 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         CASE_32_64(mov)
+        fast_mov:
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = regs[r1];
-            break;
+            NEXT();
         case INDEX_op_tci_movi:
+        fast_movi:
             tci_args_ri(insn, &r0, &t1);
             regs[r0] = t1;
-            break;
+            NEXT();
         case INDEX_op_tci_movl:
+        fast_movl:
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             regs[r0] = *(tcg_target_ulong *)ptr;
-            break;
+            NEXT();
 
             /* Load/store operations (32 bit). */
 
@@ -495,10 +678,20 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
         case INDEX_op_ld_i32:
         CASE_64(ld32u)
+        fast_ld_i32:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint32_t *)ptr;
-            break;
+            NEXT();
+        case INDEX_op_tci_ld_add_i32:
+        fast_ld_add_i32:
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(uint32_t *)ptr;
+            insn = *tb_ptr++;
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            regs[r0] = regs[r1] + regs[r2];
+            NEXT();
         CASE_32_64(st8)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
@@ -511,37 +704,43 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
         case INDEX_op_st_i32:
         CASE_64(st32)
+        fast_st_i32:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint32_t *)ptr = regs[r0];
-            break;
+            NEXT();
 
             /* Arithmetic operations (mixed 32/64 bit). */
 
         CASE_32_64(add)
+        fast_add:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] + regs[r2];
-            break;
+            NEXT();
         CASE_32_64(sub)
+        fast_sub:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] - regs[r2];
-            break;
+            NEXT();
         CASE_32_64(mul)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] * regs[r2];
             break;
         CASE_32_64(and)
+        fast_and:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] & regs[r2];
-            break;
+            NEXT();
         CASE_32_64(or)
+        fast_or:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] | regs[r2];
-            break;
+            NEXT();
         CASE_32_64(xor)
+        fast_xor:
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ^ regs[r2];
-            break;
+            NEXT();
 #if TCG_TARGET_HAS_andc_i32 || TCG_TARGET_HAS_andc_i64
         CASE_32_64(andc)
             tci_args_rrr(insn, &r0, &r1, &r2);
@@ -655,11 +854,21 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i32:
+        fast_brcond_i32:
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             if ((uint32_t)regs[r0]) {
                 tb_ptr = ptr;
             }
-            break;
+            NEXT();
+        case INDEX_op_tci_brcond_i32:
+        fast_tci_brcond_i32:
+            tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
+            insn = *tb_ptr++;
+            if (tci_compare32(regs[r1], regs[r2], condition)) {
+                tci_args_rl(insn, tb_ptr, &r0, &ptr);
+                tb_ptr = ptr;
+            }
+            NEXT();
 #if TCG_TARGET_REG_BITS == 32 || TCG_TARGET_HAS_add2_i32
         case INDEX_op_add2_i32:
             tci_args_rrrrrr(insn, &r0, &r1, &r2, &r3, &r4, &r5);
@@ -746,15 +955,26 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             regs[r0] = *(int32_t *)ptr;
             break;
         case INDEX_op_ld_i64:
+        fast_ld_i64:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint64_t *)ptr;
-            break;
+            NEXT();
+        case INDEX_op_tci_ld_add_i64:
+        fast_ld_add_i64:
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(uint64_t *)ptr;
+            insn = *tb_ptr++;
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            regs[r0] = regs[r1] + regs[r2];
+            NEXT();
         case INDEX_op_st_i64:
+        fast_st_i64:
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint64_t *)ptr = regs[r0];
-            break;
+            NEXT();
 
             /* Arithmetic operations (64 bit). */
 
@@ -866,21 +1086,33 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i64:
+        fast_brcond_i64:
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             if (regs[r0]) {
                 tb_ptr = ptr;
             }
-            break;
+            NEXT();
+        case INDEX_op_tci_brcond_i64:
+        fast_tci_brcond_i64:
+            tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
+            insn = *tb_ptr++;
+            if (tci_compare64(regs[r1], regs[r2], condition)) {
+                tci_args_rl(insn, tb_ptr, &r0, &ptr);
+                tb_ptr = ptr;
+            }
+            NEXT();
         case INDEX_op_ext32s_i64:
         case INDEX_op_ext_i32_i64:
+        fast_ext32s:
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (int32_t)regs[r1];
-            break;
+            NEXT();
         case INDEX_op_ext32u_i64:
         case INDEX_op_extu_i32_i64:
+        fast_ext32u:
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (uint32_t)regs[r1];
-            break;
+            NEXT();
 #if TCG_TARGET_HAS_bswap64_i64
         case INDEX_op_bswap64_i64:
             tci_args_rr(insn, &r0, &r1);
@@ -892,28 +1124,33 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             /* QEMU specific operations. */
 
         case INDEX_op_exit_tb:
+        fast_exit_tb:
             tci_args_l(insn, tb_ptr, &ptr);
             return (uintptr_t)ptr;
 
         case INDEX_op_goto_tb:
+        fast_goto_tb:
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = *(void **)ptr;
-            break;
+            NEXT();
 
         case INDEX_op_goto_ptr:
+        fast_goto_ptr:
             tci_args_r(insn, &r0);
             ptr = (void *)regs[r0];
             if (!ptr) {
                 return 0;
             }
             tb_ptr = ptr;
-            break;
+            NEXT();
 
         case INDEX_op_qemu_ld_a32_i32:
+        fast_qemu_ld_a32_i32:
             tci_args_rrm(insn, &r0, &r1, &oi);
             taddr = (uint32_t)regs[r1];
             goto do_ld_i32;
         case INDEX_op_qemu_ld_a64_i32:
+        fast_qemu_ld_a64_i32:
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 taddr = regs[r1];
@@ -924,9 +1161,10 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
         do_ld_i32:
             regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr);
-            break;
+            NEXT();
 
         case INDEX_op_qemu_ld_a32_i64:
+        fast_qemu_ld_a32_i64:
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 taddr = (uint32_t)regs[r1];
@@ -937,6 +1175,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
             goto do_ld_i64;
         case INDEX_op_qemu_ld_a64_i64:
+        fast_qemu_ld_a64_i64:
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 taddr = regs[r1];
@@ -952,13 +1191,15 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             } else {
                 regs[r0] = tmp64;
             }
-            break;
+            NEXT();
 
         case INDEX_op_qemu_st_a32_i32:
+        fast_qemu_st_a32_i32:
             tci_args_rrm(insn, &r0, &r1, &oi);
             taddr = (uint32_t)regs[r1];
             goto do_st_i32;
         case INDEX_op_qemu_st_a64_i32:
+        fast_qemu_st_a64_i32:
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 taddr = regs[r1];
@@ -969,9 +1210,10 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
         do_st_i32:
             tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr);
-            break;
+            NEXT();
 
         case INDEX_op_qemu_st_a32_i64:
+        fast_qemu_st_a32_i64:
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 tmp64 = regs[r0];
@@ -984,6 +1226,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
             goto do_st_i64;
         case INDEX_op_qemu_st_a64_i64:
+        fast_qemu_st_a64_i64:
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 tmp64 = regs[r0];
@@ -996,7 +1239,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
         do_st_i64:
             tci_qemu_st(env, taddr, tmp64, oi, tb_ptr);
-            break;
+            NEXT();
 
         case INDEX_op_mb:
             /* Ensure ordering for all kinds */
@@ -1006,6 +1249,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             g_assert_not_reached();
         }
     }
+#undef NEXT
 }
 
 /*
@@ -1100,6 +1344,8 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
 
     case INDEX_op_setcond_i32:
     case INDEX_op_setcond_i64:
+    case INDEX_op_tci_brcond_i32:
+    case INDEX_op_tci_brcond_i64:
         tci_args_rrrc(insn, &r0, &r1, &r2, &c);
         info->fprintf_func(info->stream, "%-12s  %s, %s, %s, %s",
                            op_name, str_r(r0), str_r(r1), str_r(r2), str_c(c));
@@ -1129,6 +1375,8 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
     case INDEX_op_ld32s_i64:
     case INDEX_op_ld_i32:
     case INDEX_op_ld_i64:
+    case INDEX_op_tci_ld_add_i32:
+    case INDEX_op_tci_ld_add_i64:
     case INDEX_op_st8_i32:
     case INDEX_op_st8_i64:
     case INDEX_op_st16_i32:
@@ -0,0 +1,114 @@
+/*
+ * QFlex instruction-record ring tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "exec/memopidx.h"
+#include "exec/qflex-ring.h"
+
+#define NR_SLOTS 16
+
+static struct qemu_plugin_trace_record insn(uint64_t pc)
+{
+    return (struct qemu_plugin_trace_record) {
+        .addr = pc, .info = QEMU_PLUGIN_TRACE_INSN
+    };
+}
+
+static struct qemu_plugin_trace_record mem(uint64_t vaddr, MemOp op,
+                                           enum qemu_plugin_mem_rw rw)
+{
+    return (struct qemu_plugin_trace_record) {
+        .addr = vaddr, .info = make_memop_idx(op, 1) | (rw << 16)
+    };
+}
+
+static void check_pop(SPSCRing *ring, uint64_t pc, uint8_t flags,
+                      uint64_t vaddr, uint16_t size)
+{
+    QFlexInsnRecord rec;
+
+    g_assert_true(spsc_ring_pop(ring, &rec));
+    g_assert_cmphex(rec.pc, ==, pc);
+    g_assert_cmphex(rec.flags, ==, flags);
+    if (flags & (QFLEX_INSN_LOAD | QFLEX_INSN_STORE)) {
+        g_assert_cmphex(rec.mem_vaddr, ==, vaddr);
+        g_assert_cmpuint(rec.mem_size, ==, size);
+    }
+}
+
+static void test_trace(void)
+{
+    SPSCRing *ring = qflex_ring_get(0);
+    struct qemu_plugin_trace_record buf1[] = {
+        insn(0x1000),
+        mem(0x8000, MO_64, QEMU_PLUGIN_MEM_R),
+        insn(0x1004),
+        insn(0x1008),
+        mem(0x9000, MO_32, QEMU_PLUGIN_MEM_W),
+        mem(0x9004, MO_32, QEMU_PLUGIN_MEM_W),
+    };
+    /* The last instruction goes on in the next buffer */
+    struct qemu_plugin_trace_record buf2[] = {
+        mem(0xa000, MO_8, QEMU_PLUGIN_MEM_R),
+        insn(0x100c),
+    };
+    QFlexInsnRecord rec;
+
+    qflex_ring_push_trace(0, buf1, ARRAY_SIZE(buf1), NULL);
+    qflex_ring_push_trace(0, buf2, ARRAY_SIZE(buf2), NULL);
+    qflex_ring_push_exception(0, 0x100c, 3);
+
+    check_pop(ring, 0x1000, QFLEX_INSN_LOAD, 0x8000, 8);
+    check_pop(ring, 0x1004, 0, 0, 0);
+    check_pop(ring, 0x1008, QFLEX_INSN_STORE, 0x9000, 4);
+    check_pop(ring, 0x1008, QFLEX_INSN_MORE | QFLEX_INSN_STORE, 0x9004, 4);
+    check_pop(ring, 0x1008, QFLEX_INSN_MORE | QFLEX_INSN_LOAD, 0xa000, 1);
+    check_pop(ring, 0x100c, 0, 0, 0);
+
+    g_assert_true(spsc_ring_pop(ring, &rec));
+    g_assert_cmphex(rec.pc, ==, 0x100c);
+    g_assert_cmphex(rec.flags, ==, QFLEX_INSN_EXCP);
+    g_assert_cmpint(rec.excp, ==, 3);
+
+    g_assert_false(spsc_ring_pop(ring, &rec));
+    g_assert_cmpuint(qflex_rings_dropped(), ==, 0);
+}
+
+static void test_full(void)
+{
+    SPSCRing *ring = qflex_ring_get(1);
+    struct qemu_plugin_trace_record buf[NR_SLOTS + 1];
+    QFlexInsnRecord rec;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(buf); i++) {
+        buf[i] = insn(0x2000 + i * 4);
+    }
+
+    /* Nobody makes room, so the last record is dropped */
+    qflex_ring_push_trace(1, buf, ARRAY_SIZE(buf), NULL);
+    g_assert_cmpuint(qflex_rings_dropped(), ==, 1);
+
+    for (i = 0; i < NR_SLOTS; i++) {
+        check_pop(ring, 0x2000 + i * 4, 0, 0, 0);
+    }
+    g_assert_false(spsc_ring_pop(ring, &rec));
+
+    /* A vCPU without a ring is ignored */
+    g_assert_null(qflex_ring_get(2));
+    qflex_ring_push_trace(2, buf, 1, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    qflex_rings_init(2, NR_SLOTS, &error_abort);
+    g_test_add_func("/qflex-ring/trace", test_trace);
+    g_test_add_func("/qflex-ring/full", test_full);
+    return g_test_run();
+}
@@ -0,0 +1,130 @@
+/*
+ * SPSC ring tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/memalign.h"
+#include "qemu/spsc-ring.h"
+#include "qemu/thread.h"
+
+#define NR_SLOTS 64
+#define NR_RECORDS (1 << 20)
+
+typedef struct Record {
+    uint64_t seq;
+    uint32_t check;
+} Record;
+
+static SPSCRing *ring_new(uint32_t nr_slots)
+{
+    SPSCRing *ring;
+
+    ring = qemu_memalign(SPSC_RING_ALIGN,
+                         spsc_ring_size(nr_slots, sizeof(Record)));
+    spsc_ring_init(ring, nr_slots, sizeof(Record));
+    return ring;
+}
+
+static void test_single_thread(void)
+{
+    SPSCRing *ring = ring_new(NR_SLOTS);
+    Record rec;
+    uint64_t i;
+
+    g_assert_false(spsc_ring_pop(ring, &rec));
+    g_assert_cmpuint(spsc_ring_count(ring), ==, 0);
+
+    for (i = 0; i < NR_SLOTS; i++) {
+        rec.seq = i;
+        rec.check = ~i;
+        g_assert_true(spsc_ring_push(ring, &rec));
+    }
+    g_assert_false(spsc_ring_push(ring, &rec));
+    g_assert_null(spsc_ring_reserve(ring));
+    g_assert_cmpuint(spsc_ring_count(ring), ==, NR_SLOTS);
+
+    for (i = 0; i < NR_SLOTS; i++) {
+        g_assert_true(spsc_ring_pop(ring, &rec));
+        g_assert_cmpuint(rec.seq, ==, i);
+        g_assert_cmpuint(rec.check, ==, (uint32_t)~i);
+    }
+    g_assert_false(spsc_ring_pop(ring, &rec));
+    g_assert_null(spsc_ring_peek(ring));
+
+    qemu_vfree(ring);
+}
+
+static void test_reserve_commit(void)
+{
+    SPSCRing *ring = ring_new(4);
+    const Record *out;
+    Record *in;
+    uint64_t i;
+
+    /* Wrap around the ring several times, in place on both sides */
+    for (i = 0; i < 64; i++) {
+        in = spsc_ring_reserve(ring);
+        g_assert_nonnull(in);
+        in->seq = i;
+        g_assert_null(spsc_ring_peek(ring));
+        spsc_ring_commit(ring);
+
+        out = spsc_ring_peek(ring);
+        g_assert_nonnull(out);
+        g_assert_cmpuint(out->seq, ==, i);
+        spsc_ring_release(ring);
+    }
+
+    qemu_vfree(ring);
+}
+
+static void *producer_fn(void *opaque)
+{
+    SPSCRing *ring = opaque;
+    uint64_t i;
+
+    for (i = 0; i < NR_RECORDS; i++) {
+        Record rec = { .seq = i, .check = ~i };
+
+        while (!spsc_ring_push(ring, &rec)) {
+            g_thread_yield();
+        }
+    }
+    return NULL;
+}
+
+static void test_two_threads(void)
+{
+    SPSCRing *ring = ring_new(NR_SLOTS);
+    QemuThread producer;
+    Record rec;
+    uint64_t i;
+
+    qemu_thread_create(&producer, "producer", producer_fn, ring,
+                       QEMU_THREAD_JOINABLE);
+
+    for (i = 0; i < NR_RECORDS; i++) {
+        while (!spsc_ring_pop(ring, &rec)) {
+            g_thread_yield();
+        }
+        g_assert_cmpuint(rec.seq, ==, i);
+        g_assert_cmpuint(rec.check, ==, (uint32_t)~i);
+    }
+
+    qemu_thread_join(&producer);
+    g_assert_false(spsc_ring_pop(ring, &rec));
+
+    qemu_vfree(ring);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/spsc-ring/single-thread", test_single_thread);
+    g_test_add_func("/spsc-ring/reserve-commit", test_reserve_commit);
+    g_test_add_func("/spsc-ring/two-threads", test_two_threads);
+    return g_test_run();
+}